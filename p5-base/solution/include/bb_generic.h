@@ -0,0 +1,95 @@
+#ifndef BB_GENERIC_H
+#define BB_GENERIC_H
+
+#include "sync_utils.h"
+
+/* ---------- Type-generic bounded buffer with inline storage ----------
+ *
+ * BB_DEFINE(name, T, CAP) generates a queue type name_t that stores up to
+ * CAP values of type T directly in its ring, plus static inline operations:
+ *
+ *   int  name_init(name_t *q);                   0 on success, -1 on error
+ *   void name_destroy(name_t *q);
+ *   void name_put(name_t *q, T item);            blocks if full
+ *   T    name_take(name_t *q);                   blocks if empty
+ *   int  name_try_put(name_t *q, T item);        0, or -1 if full
+ *   int  name_try_take(name_t *q, T *out);       0, or -1 if empty
+ *   int  name_count(name_t *q);
+ *
+ * Same protocol as the locked bb_t engine (empty/full semaphores around a
+ * short mutex section), but items are copied by value, so small messages
+ * need no heap object, and CAP is a compile-time power of two, so slot
+ * index math is a mask. bb_t keeps its runtime capacity and engine choice;
+ * BB_DEFINE(name, food_tray_t*, CAP) is its fixed-size equivalent.
+ */
+#define BB_DEFINE(name, T, CAP)                                                \
+  _Static_assert((CAP) > 0 && ((CAP) & ((CAP) - 1)) == 0,                      \
+                 #name ": capacity must be a power of two");                   \
+                                                                               \
+  typedef struct {                                                             \
+    sync_sem_t empty;       /* Free slots */                                   \
+    sync_sem_t full;        /* Filled slots */                                 \
+    pthread_mutex_t m;      /* Protects head/tail and the ring */              \
+    unsigned head;          /* Next slot to take (free-running) */             \
+    unsigned tail;          /* Next slot to fill (free-running) */             \
+    T buf[CAP];                                                                \
+  } name##_t;                                                                  \
+                                                                               \
+  static inline int name##_init(name##_t *q) {                                 \
+    q->head = q->tail = 0;                                                     \
+    if (pthread_mutex_init(&q->m, NULL)) return -1;                            \
+    sync_sem_init(&q->empty, (CAP));                                           \
+    sync_sem_init(&q->full, 0);                                                \
+    return 0;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline void name##_destroy(name##_t *q) {                             \
+    sync_sem_destroy(&q->full);                                                \
+    sync_sem_destroy(&q->empty);                                               \
+    pthread_mutex_destroy(&q->m);                                              \
+  }                                                                            \
+                                                                               \
+  static inline void name##_push_locked(name##_t *q, T item) {                 \
+    pthread_mutex_lock(&q->m);                                                 \
+    q->buf[q->tail++ & ((CAP) - 1)] = item;                                    \
+    pthread_mutex_unlock(&q->m);                                               \
+    sync_sem_post(&q->full);                                                   \
+  }                                                                            \
+                                                                               \
+  static inline T name##_pop_locked(name##_t *q) {                             \
+    pthread_mutex_lock(&q->m);                                                 \
+    T item = q->buf[q->head++ & ((CAP) - 1)];                                  \
+    pthread_mutex_unlock(&q->m);                                               \
+    sync_sem_post(&q->empty);                                                  \
+    return item;                                                               \
+  }                                                                            \
+                                                                               \
+  static inline void name##_put(name##_t *q, T item) {                         \
+    while (sync_sem_wait(&q->empty)) ;  /* retry on EINTR */                   \
+    name##_push_locked(q, item);                                               \
+  }                                                                            \
+                                                                               \
+  static inline T name##_take(name##_t *q) {                                   \
+    while (sync_sem_wait(&q->full)) ;                                          \
+    return name##_pop_locked(q);                                               \
+  }                                                                            \
+                                                                               \
+  static inline int name##_try_put(name##_t *q, T item) {                      \
+    if (sync_sem_trywait(&q->empty)) return -1;                                \
+    name##_push_locked(q, item);                                               \
+    return 0;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline int name##_try_take(name##_t *q, T *out) {                     \
+    if (sync_sem_trywait(&q->full)) return -1;                                 \
+    *out = name##_pop_locked(q);                                               \
+    return 0;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline int name##_count(name##_t *q) {                                \
+    int n = 0;                                                                 \
+    sync_sem_getvalue(&q->full, &n);                                           \
+    return n;                                                                  \
+  }
+
+#endif
@@ -2,5 +2,7 @@
 #define BOUNDED_BUFFER_H
 /* Snacks (Producer–Consumer) */
 int snacks_run(void);
+int snacks_engine_ok(const char *engine);   /* 1 for "locked", "mpmc", "sharded[:N]", "prio" */
+int snacks_run_engine(const char *engine);  /* -1 (nothing run) for any other engine */
 #endif
 
@@ -2,4 +2,5 @@
 #define READERS_WRITERS_H
 /* Schedule board (Readers–Writers) */
 int schedule_run(void);
+int schedule_run_engine(const char *engine);  /* any rw_init_engine name, "seqlock" or "rcu" */
 #endif
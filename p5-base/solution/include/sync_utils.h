@@ -3,6 +3,7 @@
 
 #include <pthread.h>
 #include <semaphore.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -13,50 +14,546 @@
 
 #define DIE(msg) do { perror(msg); exit(EXIT_FAILURE); } while (0)
 
-/* Logging (timestamped) */
-uint64_t now_ms(void);
+/* Timing. now_ns is what every timestamp and latency probe uses: CLOCK_MONOTONIC
+ * in nanoseconds, or the TSC scaled to the same clock once now_ns_use_tsc
+ * succeeded (only on an invariant TSC, calibrated against CLOCK_MONOTONIC;
+ * SYNC_CLOCK=tsc in the environment selects it at startup). Switch before
+ * the threads that take timestamps start. mono_ns always reads
+ * CLOCK_MONOTONIC: use it to build futex and semaphore deadlines. */
+uint64_t mono_ns(void);
+struct timespec deadline_in_ms(int ms);   /* mono_ns + ms, as an absolute deadline */
+uint64_t now_ms(void);     /* now_ns in milliseconds */
+int now_ns_use_tsc(bool on);   /* -1: no invariant TSC, or it didn't calibrate steadily */
+
+typedef struct {
+  atomic_int on;           // Published last, after the calibration below
+  uint64_t base_tsc, base_ns;
+  uint64_t mult;           // Nanoseconds per tick, 32.32 fixed point
+} now_tsc_t;
+extern now_tsc_t now_tsc;
+
+static inline uint64_t now_ns(void) {
+#if defined(__x86_64__)
+  if (atomic_load_explicit(&now_tsc.on, memory_order_acquire))
+    return now_tsc.base_ns +
+           (uint64_t)(((unsigned __int128)(__builtin_ia32_rdtsc() - now_tsc.base_tsc) * now_tsc.mult) >> 32);
+#endif
+  return mono_ns();
+}
+
+/* Logging (timestamped with now_ns, in ms) */
 #define LOG(fmt, ...) \
-  do { fprintf(stdout, "[%10llu ms] " fmt "\n", (unsigned long long)now_ms(), ##__VA_ARGS__); fflush(stdout); } while (0)
+  log_printf("[%14.3f ms] " fmt "\n", now_ns() / 1e6, ##__VA_ARGS__)
+
+/* Writes one log line: straight to stdout (and flushed) by default. Between
+ * log_async_start and log_async_stop each thread formats into its own ring
+ * instead, and a flusher thread writes the rings out in batches, merged in
+ * the order the lines were logged. Lines longer than LOG_LINE_MAX bytes are
+ * truncated in async mode. */
+#define LOG_LINE_MAX 256
+void log_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+int  log_async_start(const char *path);  /* NULL: stdout; -1 if already started or path can't be opened */
+void log_flush(void);                    /* writes out every line logged so far */
+void log_async_stop(void);               /* flushes and goes back to direct writes; also run at exit */
 
-/* Thread helpers */
+/* Thread helpers. spawn names the k-th thread it starts under a given name
+ * "name-k" (pthread_setname_np, the name cut to fit 15 characters: what
+ * top -H and perf show) and pins it by the affinity policy set for that
+ * name, else by the default policy:
+ *   "none"      not pinned (the default)
+ *   "compact"   k-th allowed CPU with the SMT siblings of a core, then the
+ *               cores of a package, next to each other
+ *   "scatter"   k-th allowed CPU taking a package, then a core, then an SMT
+ *               sibling in turn, so neighbours share as little as possible
+ *   "0,2,4-7"   k-th CPU of the list
+ * all wrapping around. Setting a name's policy restarts its k at 0. Pool
+ * workers are spawned as "pool"; pooled actors run on them, unnamed. */
 typedef void* (*thread_fn)(void*);
 pthread_t spawn(thread_fn fn, void *arg, const char *name);
 void join(pthread_t t);
+int affinity_set(const char *name, const char *policy);   /* name NULL: default; -1 if policy is bad or lists a CPU we can't run on */
+int affinity_config(const char *spec);   /* "policy" or "name=policy" items separated by ';'
+                                            (also read from SYNC_AFFINITY at startup) */
+int affinity_cpu(const char *name, int k);   /* CPU for the k-th thread of name, -1 if unpinned */
 
-/* Random jitter for schedule perturbation */
+/* Thread pool. Each worker owns a work-stealing deque: tasks submitted
+ * from a worker go on the bottom of its own deque and it pops them LIFO,
+ * idle workers steal from the top of the others'; tasks submitted from
+ * outside go through a shared queue. pool_submit returns a future that
+ * task_wait redeems exactly once (and frees); a worker waiting in
+ * task_wait runs queued tasks meanwhile, so fork-join inside the pool
+ * can't starve it. Workers run on POOL_STACK_BYTES stacks. */
+#define POOL_MAX_WORKERS 1024
+#define POOL_STACK_BYTES (256 * 1024)
+typedef struct pool pool_t;
+typedef struct task task_t;
+pool_t* pool_create(int workers);              /* <= 0: one per online CPU; NULL on failure */
+void    pool_destroy(pool_t *pool);            /* runs what is queued, then joins the workers */
+task_t* pool_submit(pool_t *pool, thread_fn fn, void *arg);   /* NULL on allocation failure */
+void*   task_wait(task_t *task);               /* returns fn's result */
+bool    task_done(task_t *task);
+int     pool_workers(pool_t *pool);
+
+/* Actors: spawn/join with a future in place of the thread. Each actor gets
+ * a thread of its own, as with spawn, until actors_use_pool; then actors
+ * run on the pool, each on an ACTOR_STACK_BYTES stack of its own. An actor
+ * blocked in a bb_t put or take (not the timed ones), task_wait or
+ * joining a pooled actor parks and hands its worker back, so those cost no thread
+ * however many wait at once. Blocked anywhere else (rwlocks, sleeps,
+ * jitter, timed waits, pthread calls) it keeps its worker; the pool adds
+ * a worker when every one is held and retires those above the number
+ * asked for once idle, so threads track the actors blocked that way, plus
+ * a few per burst of spawns (an actor gets its own thread past
+ * POOL_MAX_WORKERS). A parked actor may resume on another worker. */
+#define ACTOR_STACK_BYTES (64 * 1024)
+void    actors_use_pool(pool_t *pool);         /* NULL: one thread per actor again */
+task_t* actor_spawn(thread_fn fn, void *arg, const char *name);
+void*   actor_join(task_t *actor);
+
+/* Per-thread PRNG (xoshiro256**), no shared state on the draw path. A
+ * thread's stream is seeded from the master seed and its stream number:
+ * rng_thread(n) picks the number (so a run repeats whatever order the
+ * threads start in), otherwise the thread takes the next automatic one at
+ * its first draw and keeps it. Automatic streams are numbered from
+ * RNG_AUTO_STREAMS up, past any int rng_thread accepts, so the two never
+ * share a sequence. The master seed is SYNC_SEED from the environment,
+ * else RNG_DEFAULT_SEED; rng_seed replaces it and every thread restarts
+ * its stream from it at its next draw. */
+#define RNG_DEFAULT_SEED 1
+#define RNG_AUTO_STREAMS (1ULL << 32)
+void     rng_seed(uint64_t master);
+uint64_t rng_master(void);
+void     rng_thread(int stream);   /* stream >= 0; -1 goes back to an automatic stream */
+uint64_t rng_next(void);
+uint32_t rng_below(uint32_t n);   /* uniform in [0, n) */
+
+/* Random jitter for schedule perturbation (drawn from the thread's PRNG) */
 void jitter_us(int min_us, int max_us);
 
+/* ---------- Binary event tracing ---------- */
+
+/* Between trace_start and trace_stop, the TRACE probes in bb_t and rwlock_t
+ * (compiled in with -DSYNC_TRACE) append fixed-size records to per-thread
+ * chunks of the trace file, mmap'd so recording is a few stores. Nothing is
+ * formatted until trace_decode reads the file back. */
+typedef enum {
+  TR_NONE,              // Unused record (tail of a chunk)
+  TR_BB_PUT,            // arg: tray id
+  TR_BB_TAKE,           // arg: tray id
+  TR_BB_PUT_MANY,       // arg: trays queued
+  TR_BB_TAKE_MANY,      // arg: trays taken
+  TR_RW_RLOCK,
+  TR_RW_RUNLOCK,
+  TR_RW_WLOCK,
+  TR_RW_WUNLOCK,
+  TR_EVENTS
+} trace_event_t;
+
+typedef struct {
+  uint64_t ns;          // now_ns when the operation completed
+  uint64_t obj;         // The bb_t / rwlock_t
+  uint32_t tid;         // Kernel thread id
+  uint16_t event;       // trace_event_t
+  uint16_t pad;
+  uint32_t arg;
+  uint32_t wait_ns;     // From the call to completion (saturates at ~4.29 s)
+} trace_record_t;
+
+/* File layout: a trace_header_t padded to TRACE_CHUNK_BYTES, then chunks of
+ * TRACE_CHUNK_BYTES, each filled by one thread in time order */
+#define TRACE_MAGIC       "SYNCTRC1"
+#define TRACE_CHUNK_BYTES (128 * 1024)
+
+typedef struct {
+  char magic[8];
+  uint32_t record_size;
+  uint32_t chunk_bytes;
+} trace_header_t;
+
+int  trace_start(const char *path);   /* -1 if already started or path can't be created */
+void trace_stop(void);                /* once the traced threads are done with the objects */
+void trace_record(int event, const void *obj, uint32_t arg, uint64_t t0);  /* t0: call time, or 0 */
+/* Prints the records of a trace in time order: one line each, or (chrome)
+ * a Chrome trace-event JSON timeline. -1 if path isn't a readable trace. */
+int  trace_decode(const char *path, FILE *out, bool chrome);
+
+extern atomic_int trace_on;
+#ifdef SYNC_TRACE
+#define TRACE_NOW() now_ns()
+#define TRACE(ev, obj, arg, t0) \
+  do { if (atomic_load_explicit(&trace_on, memory_order_relaxed)) trace_record((ev), (obj), (arg), (t0)); } while (0)
+#else
+#define TRACE_NOW() 0
+#define TRACE(ev, obj, arg, t0) ((void)(ev), (void)(obj), (void)(arg), (void)(t0))
+#endif
+
+/* ---------- Futex helpers ---------- */
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+/* Private futex on a 32-bit word. futex_wait sleeps while *word == val and
+ * returns -1 only if the absolute CLOCK_MONOTONIC deadline (NULL: none) passed. */
+int  futex_wait(atomic_uint *word, unsigned val, const struct timespec *deadline);
+void futex_wake(atomic_uint *word, int n);
+
+/* ---------- Futex-backed counting semaphore ---------- */
+
+/* wait/post are one atomic op when nobody has to sleep; FUTEX_WAKE is only
+ * issued when a waiter has registered. Deadlines are absolute CLOCK_MONOTONIC. */
+typedef struct {
+  atomic_uint value;            // Units available (futex word)
+  atomic_uint waiters;          // Threads registered to sleep on value
+} fsem_t;
+
+int  fsem_init(fsem_t *s, unsigned value);
+void fsem_destroy(fsem_t *s);
+int  fsem_wait(fsem_t *s);
+int  fsem_trywait(fsem_t *s);                                    /* -1/EAGAIN if no unit */
+int  fsem_clockwait(fsem_t *s, const struct timespec *deadline); /* -1/ETIMEDOUT */
+int  fsem_trywait_many(fsem_t *s, unsigned max);                 /* takes up to max units at once */
+int  fsem_post(fsem_t *s);
+int  fsem_post_many(fsem_t *s, unsigned n);
+int  fsem_getvalue(fsem_t *s, int *value);
+
+/* Semaphore used inside bb_t and rwlock_t: POSIX sem_t by default, fsem_t
+ * when built with -DUSE_FUTEX_SEM (make SEM=futex) */
+#ifdef USE_FUTEX_SEM
+typedef fsem_t sync_sem_t;
+#define sync_sem_init(s, v)          fsem_init((s), (v))
+#define sync_sem_destroy(s)          fsem_destroy(s)
+#define sync_sem_wait(s)             fsem_wait(s)
+#define sync_sem_trywait(s)          fsem_trywait(s)
+#define sync_sem_clockwait(s, dl)    fsem_clockwait((s), (dl))
+#define sync_sem_trywait_many(s, n)  fsem_trywait_many((s), (n))
+#define sync_sem_post(s)             fsem_post(s)
+#define sync_sem_post_many(s, n)     fsem_post_many((s), (n))
+#define sync_sem_getvalue(s, v)      fsem_getvalue((s), (v))
+#else
+int sem_clockwait(sem_t *sem, clockid_t clock, const struct timespec *abstime);
+int psem_trywait_many(sem_t *s, unsigned max);
+int psem_post_many(sem_t *s, unsigned n);
+typedef sem_t sync_sem_t;
+#define sync_sem_init(s, v)          sem_init((s), 0, (v))
+#define sync_sem_destroy(s)          sem_destroy(s)
+#define sync_sem_wait(s)             sem_wait(s)
+#define sync_sem_trywait(s)          sem_trywait(s)
+#define sync_sem_clockwait(s, dl)    sem_clockwait((s), CLOCK_MONOTONIC, (dl))
+#define sync_sem_trywait_many(s, n)  psem_trywait_many((s), (n))
+#define sync_sem_post(s)             sem_post(s)
+#define sync_sem_post_many(s, n)     psem_post_many((s), (n))
+#define sync_sem_getvalue(s, v)      sem_getvalue((s), (v))
+#endif
+
 /* ---------- Reader-Writer Lock for Conference Schedule ---------- */
 
+/* Engine behind a rwlock_t, chosen by the init function */
+typedef enum {
+  RW_MODE_SEM = 0,          // Mutex + semaphores, writer priority (rw_init)
+  RW_MODE_PERCPU,           // Read-mostly: per-slot reader indicators (rw_init_percpu)
+  RW_MODE_FUTEX             // Whole state in one atomic word, futex waits (rw_init_futex)
+} rw_mode_t;
+
+/* Who goes first on the semaphore engine (rw_init_ex) */
+typedef enum {
+  RW_POLICY_WRITER = 0,     // Writer priority: a waiting writer blocks new readers (rw_init)
+  RW_POLICY_READER,         // Reader priority: readers enter unless a writer holds the lock
+  RW_POLICY_PHASE_FAIR      // Reader and writer phases alternate: each side waits one phase at most
+} rw_policy_t;
+
+/* Layout of rwlock_t.word for RW_MODE_FUTEX */
+#define RW_READERS_MASK    0x0000ffffu  // Readers holding the lock
+#define RW_WRITER_ONE      0x00010000u  // One queued writer
+#define RW_WRITERS_MASK    0x1fff0000u  // Queued writers (keep new readers out)
+#define RW_UPGRADING       0x20000000u  // An upgradable reader waits to upgrade
+#define RW_READERS_ASLEEP  0x40000000u  // Readers sleeping on word
+#define RW_WRITER_HELD     0x80000000u  // A writer holds the lock
+
+/* One reader indicator per cache line, so readers on different slots never
+ * write the same line */
+typedef struct {
+  _Alignas(64) atomic_int readers;
+} rw_slot_t;
+
+/* Cohort variant of the read-mostly engine (rw_init_cohort): one reader
+ * slot per NUMA node, and writers queue per node. The writer side is
+ * handed from writer to writer inside a node for up to max_batch turns
+ * before it goes to the next node waiting for it. */
+#define RW_COHORT_MAX_NODES 64
+#define RW_COHORT_BATCH     8   // Default max_batch
+typedef struct {
+  _Alignas(64) pthread_mutex_t local;  // Writers of this node queue here
+  atomic_int waiting;           // Blocking writers queued on local
+  int passed;                   // Writer side handed over within the node (under local)
+  int batch;                    // Handoffs in a row within the node (under local)
+  atomic_uint granted;          // Set when the node's turn comes (futex word)
+} rw_cohort_node_t;
+
+typedef struct {
+  int nnodes, ncpus;
+  int max_batch;
+  int held;                     // Some node owns the writer side (under rw->m)
+  int head, len;                // FIFO of nodes waiting for it (under rw->m)
+  int *queue;                   // nnodes entries
+  int *cpu_node;                // Node of each configured CPU
+  rw_cohort_node_t node[];
+} rw_cohort_t;
+
+/* Contention statistics for rwlock_t, compiled in with -DRW_STATS
+ * (make RW_STATS=1). Without it neither the counters nor the probes exist. */
+#define RW_HIST_BUCKETS 32   // Bucket b counts times in [2^b, 2^(b+1)) ns
+typedef struct {
+  unsigned long acquires;       // Successful acquires
+  unsigned long contended;      // ... of which had to wait
+  unsigned long failed;         // Try / timed acquires that gave up
+  int max_queue;                // Most threads waiting on this side at once
+  uint64_t wait_max_ns, hold_max_ns;
+  unsigned long wait_hist[RW_HIST_BUCKETS];
+  unsigned long hold_hist[RW_HIST_BUCKETS];
+} rw_side_stats_t;
+
+typedef struct {
+  rw_side_stats_t read, write;
+  unsigned long handoffs;       // Releases that passed the lock on to waiters
+} rw_stats_t;
+
+/* Declared in every build so that rwlock_t has one layout whatever
+ * RW_STATS is; only RW_STATS builds define and allocate it. */
+typedef struct rw_stats_block rw_stats_block_t;
+
+#ifdef RW_STATS
+/* Probes update relaxed atomics in one of RW_STATS_STRIPES stripes picked
+ * per thread, so they never take the lock's mutex and threads rarely share
+ * a cache line; rw_stats sums the stripes. */
+#define RW_STATS_STRIPES 8
+typedef struct {
+  atomic_ulong acquires, contended, failed;
+  _Atomic uint64_t wait_max_ns, hold_max_ns;
+  atomic_ulong wait_hist[RW_HIST_BUCKETS];
+  atomic_ulong hold_hist[RW_HIST_BUCKETS];
+} rw_side_counters_t;
+
+typedef struct {
+  _Alignas(64) rw_side_counters_t side[2];  // Read, write
+  atomic_ulong handoffs;
+} rw_stats_stripe_t;
+
+struct rw_stats_block {
+  rw_stats_stripe_t stripe[RW_STATS_STRIPES];
+  _Alignas(64) atomic_int queued[2];        // Threads waiting on each side right now
+  atomic_int max_queue[2];
+  uint64_t write_t0;                        // When the current writer got in
+};
+#endif
+
+/* Flat-combining publication slot (rw_combine): one per thread, picked
+ * like the percpu reader slots */
+#define RW_COMBINE_SLOTS 32   // Must fit the bits of combine_pending
+typedef struct {
+  _Alignas(64) atomic_uint state;   // Free, claimed, posted or done
+  void (*fn)(void *arg);
+  void *arg;
+} rw_combine_slot_t;
+
 /* Reader-Writer lock (students implement in readers_writers.c) */
 typedef struct {
   /* TODO: add semaphores/mutexes and counters */
   // Added the required fields here to implement writer-priority reader-writer lock
   pthread_mutex_t m;            // Protects shared variables
-  sem_t OKToWrite;              // Writer lock semaphore (binary: 0 or 1)
-  sem_t OKToRead;
+  sync_sem_t OKToWrite;         // Writer lock semaphore (binary: 0 or 1)
+  sync_sem_t OKToRead;
   int readers_active;           // Count of active readers
   int readers_waiting;          // Count of waiting readers
   int writers_waiting;          // Count of waiting writers
-  int writer_active            // Flag indicating if a writer is active
+  int writer_active;            // Flag indicating if a writer is active
+  rw_policy_t policy;
+  pthread_mutex_t upgrade_m;    // Held by the upgradable reader (rw_ulock)
+  int upgrade_pending;          // Upgradable reader waiting for the others to leave
+  sync_sem_t OKToUpgrade;
+
+  rw_mode_t mode;
+  /* Read-mostly engine: readers only touch their own slot; writers serialize
+   * on m, close the gate and wait for every slot to drain */
+  rw_slot_t *slots;
+  int nslots;                   // Power of two
+  atomic_uint gate;             // 0 open, 1 writer in, 2 writer in + readers asleep (futex word)
+  atomic_uint reader_exits;     // Bumped when a slot drains under a closed gate (futex word)
+  atomic_int writers_queued;    // Writers in or waiting for rw_wlock
+  rw_cohort_t *cohort;          // Cohort variant: slot i is node i's (m guards the node queue)
+
+  /* Single-word engine: acquire and release are one CAS when uncontended */
+  atomic_uint word;             // RW_* bits above (futex word for readers)
+  atomic_uint writer_seq;       // Bumped to hand off to a writer (futex word for writers)
+  int spin_max;                 // Cap on adaptive spinning, 0 on a single CPU
+  atomic_int spin_avg;          // Spin rounds that recently paid off, x8
+
+  /* Flat combining: writers post closures, one of them applies the batch */
+  pthread_mutex_t combine_m;    // Held by the combining thread
+  atomic_uint combine_pending;  // Bit per slot with a posted closure
+  atomic_uint combine_seq;      // Bumped after each batch (futex word)
+  _Atomic(rw_combine_slot_t*) combine;  // RW_COMBINE_SLOTS, allocated on first use
+
+  rw_stats_block_t *stats;      // Allocated by rw_init with RW_STATS, NULL without
 } rwlock_t;
 
-int  rw_init(rwlock_t *rw);
+int  rw_init(rwlock_t *rw);                            /* -1 only if RW_STATS can't allocate */
+int  rw_init_ex(rwlock_t *rw, rw_policy_t policy);
+int  rw_init_percpu(rwlock_t *rw);                     /* 0, or -1 on allocation failure */
+int  rw_init_futex(rwlock_t *rw);
+/* nnodes 0: the nodes listed under /sys/devices/system/node (one node if
+ * that is missing). nnodes > 0: the CPUs split into that many groups of
+ * consecutive CPUs, e.g. to try the lock on a single-socket box (a group
+ * may be empty and only hold threads placed with rw_cohort_set_node).
+ * 0, or -1 on allocation failure. */
+int  rw_init_cohort(rwlock_t *rw, int nnodes);
+/* Puts the calling thread on cohort node `node` (modulo the lock's node
+ * count) instead of its CPU's; -1 goes back to the topology. Only before
+ * the thread takes a cohort lock, since a reader leaves the slot it
+ * entered. */
+void rw_cohort_set_node(int node);
+/* "sem" (writer priority), "reader-pref", "phase-fair", "percpu", "futex",
+ * "cohort" or "cohort:<nodes>"; -1 if unknown */
+int  rw_init_engine(rwlock_t *rw, const char *engine);
 void rw_destroy(rwlock_t *rw);
 void rw_rlock(rwlock_t *rw);
 void rw_runlock(rwlock_t *rw);
 void rw_wlock(rwlock_t *rw);
 void rw_wunlock(rwlock_t *rw);
 
+/* Non-blocking / deadline-bounded acquires, as for bb_t: 0 on success, -1
+ * if the lock is busy or the absolute CLOCK_MONOTONIC deadline passed */
+int  rw_tryrlock(rwlock_t *rw);
+int  rw_trywlock(rwlock_t *rw);
+int  rw_rlock_timed(rwlock_t *rw, const struct timespec *deadline);
+int  rw_wlock_timed(rwlock_t *rw, const struct timespec *deadline);
+
+/* Write lock -> read lock without letting another writer in between */
+void rw_downgrade(rwlock_t *rw);
+
+/* Upgradable read: shared with plain readers but not with another
+ * upgradable reader, so rw_upgrade can turn it into the write lock in place
+ * once the plain readers have left. Release it with rw_uunlock, or with
+ * rw_wunlock after rw_upgrade succeeded. The percpu engine cannot upgrade
+ * in place: rw_upgrade returns -1 there and the read lock is still held. */
+void rw_ulock(rwlock_t *rw);
+void rw_uunlock(rwlock_t *rw);
+int  rw_upgrade(rwlock_t *rw);
+
+/* Counters since init or the last rw_stats_reset (which should run while
+ * the lock is idle). Without RW_STATS: a zeroed snapshot and -1. */
+int  rw_stats(rwlock_t *rw, rw_stats_t *out);
+void rw_stats_reset(rwlock_t *rw);
+/* Upper bound of the histogram bucket holding the pct-th percentile */
+uint64_t rw_hist_percentile(const unsigned long *hist, int pct);
+
+/* Flat-combining write: fn(arg) runs under the write lock, exactly once,
+ * before rw_combine returns. Writers that pile up post their closure in a
+ * per-thread slot and wait; whichever of them gets to combine takes the
+ * write lock once and applies every posted closure in that one section.
+ * Returns how many closures this call applied while combining (0 if
+ * another thread applied its closure). fn must not take rw itself. */
+int rw_combine(rwlock_t *rw, void (*fn)(void *arg), void *arg);
+
+/* ---------- Sequence lock ---------- */
+
+/* Optimistic reads of small snapshots: readers never write shared memory,
+ * they copy the data and retry if a writer got in meanwhile. Readers overlap
+ * writers, so the protected fields are read and written with (relaxed)
+ * atomics.
+ *   do { s = seq_read_begin(&sl); copy... } while (seq_read_retry(&sl, s)); */
+typedef struct {
+  atomic_uint seq;              // Odd while a writer is updating
+  pthread_mutex_t m;            // Serializes writers
+} seqlock_t;
+
+int      seq_init(seqlock_t *sl);
+void     seq_destroy(seqlock_t *sl);
+unsigned seq_read_begin(seqlock_t *sl);               /* waits out an active writer */
+bool     seq_read_retry(seqlock_t *sl, unsigned start); /* true if the copy may be torn */
+void     seq_write_lock(seqlock_t *sl);
+void     seq_write_unlock(seqlock_t *sl);
+
+/* ---------- RCU-style publication ---------- */
+
+/* Readers traverse a published structure without taking any lock. Writers
+ * build a new version, swap it in with rcu_publish and hand the old one to
+ * rcu_retire, which frees it once no reader can still be looking at it.
+ *   rcu_read_lock(); s = rcu_dereference(board); ...read *s...; rcu_read_unlock();
+ * A read section only stores the current epoch into the thread's own slot.
+ * Sections nest. rcu_synchronize waits for the readers that are inside a
+ * section when it is called, then frees what is safe; calling it from inside
+ * a read section deadlocks. p must be an _Atomic(T*) object. */
+#define rcu_dereference(p)  atomic_load_explicit(&(p), memory_order_acquire)
+#define rcu_publish(p, v)   atomic_exchange_explicit(&(p), (v), memory_order_acq_rel)
+
+void rcu_read_lock(void);
+void rcu_read_unlock(void);
+void rcu_retire(void *old, void (*free_fn)(void *));
+void rcu_synchronize(void);
+unsigned long rcu_pending(void);   /* retired versions not freed yet */
+
 /* ---------- Bounded Buffer for Producer-Consumer (Snacks) ---------- */
 
 /* Food tray structure */
 typedef struct {
   int tray_id;           // Unique tray identifier
-  char *food_name;       // Name of food on tray (dynamically allocated)
+  const char *food_name; // Name of food on tray (interned, not owned by the tray)
   int prepared_by;       // Cook who prepared it
 } food_tray_t;
 
+/* Engine behind a bb_t, chosen by the init function */
+typedef enum {
+  BB_MODE_LOCKED = 0,       // Semaphores + mutex (bb_init)
+  BB_MODE_SPSC,             // Lock-free single producer / single consumer (bb_init_spsc)
+  BB_MODE_MPMC,             // Lock-free multi producer / multi consumer (bb_init_mpmc)
+  BB_MODE_SHARDED,          // Per-shard locked rings, consumers steal (bb_init_sharded)
+  BB_MODE_PRIO              // Priority lanes sharing one capacity (bb_init_prio)
+} bb_mode_t;
+
+#define BB_CACHE_LINE 64
+
+/* MPMC slot: seq == pos when free for the producer claiming pos,
+ * seq == pos + 1 once filled for the consumer claiming pos */
+typedef struct {
+  atomic_ulong seq;
+  food_tray_t *tray;
+} bb_cell_t;
+
+/* Event count: lets a thread sleep until "something changed" without
+ * making the signalling side pay a syscall when nobody is asleep */
+typedef struct {
+  atomic_uint epoch;        // Futex word, bumped on every signal with waiters
+  atomic_uint waiters;      // Threads between prepare and wake-up
+} bb_event_t;
+
+/* Sharded engine: one locked sub-ring per shard, each owning cap of the
+ * buffer's slots (the caps add up to the bb_t capacity). */
+typedef struct {
+  _Alignas(BB_CACHE_LINE) pthread_mutex_t m;
+  food_tray_t **buf;        // Ring of mask + 1 slots
+  unsigned head, tail;      // Free-running, masked into buf
+  int cap;                  // Slots this shard owns
+  atomic_int count;         // tail - head, readable without m when scanning
+} bb_shard_t;
+
+/* Priority lane: FIFO ring plus queueing-latency histogram. Lane 0 is the
+ * most urgent; all lanes are protected by the bb_t mutex. */
+#define BB_LAT_BUCKETS 48   // Bucket b counts latencies in [2^b, 2^(b+1)) ns
+typedef struct {
+  food_tray_t **buf;        // Ring of cap slots (one lane may hold everything)
+  uint64_t *enq_ns;         // Enqueue time of each slot
+  int head, count;
+  int skipped;              // Takes that passed this lane over while non-empty
+  unsigned long taken;
+  uint64_t max_ns;
+  unsigned long hist[BB_LAT_BUCKETS];
+} bb_lane_t;
+
 /* Bounded buffer (students implement) */
 typedef struct {
   /* TODO: add buffer array, semaphores, mutex, and indices */
@@ -64,18 +561,117 @@ typedef struct {
   food_tray_t **buf;        // Dynamic buffer array to store food tray pointers
   int cap;                  // Capacity of the buffer
   int head, tail;           // Circular queue pointers (head for consumers, tail for producers)
-  sem_t empty;              // Semaphore counting empty slots (initialized to capacity)
-  sem_t full;               // Semaphore counting full slots (initialized to 0)
+  sync_sem_t empty;         // Semaphore counting empty slots (initialized to capacity)
+  sync_sem_t full;          // Semaphore counting full slots (initialized to 0)
   pthread_mutex_t m;        // Mutex to protect head/tail updates
+  bb_mode_t mode;           // Engine used by bb_put/bb_take
+
+  /* Lock-free ring state: free-running indices, masked into buf */
+  unsigned mask;            // Ring size - 1 (ring size is a power of two >= cap)
+  _Alignas(BB_CACHE_LINE) atomic_uint spsc_tail;   // Written by the producer only
+  unsigned spsc_head_cache;                        // Producer's last view of spsc_head
+  atomic_int spsc_putting;                         // Producer is inside a put (close handshake)
+  _Alignas(BB_CACHE_LINE) atomic_uint spsc_head;   // Written by the consumer only
+  unsigned spsc_tail_cache;                        // Consumer's last view of spsc_tail
+  _Alignas(BB_CACHE_LINE) atomic_uint spsc_parked; // Which side (if any) sleeps in futex wait
+
+  /* MPMC state: producers/consumers claim positions by CAS, slot = pos % cap */
+  bb_cell_t *cells;                                // Slot array (buf is unused)
+  _Alignas(BB_CACHE_LINE) atomic_ulong mpmc_tail;  // Next position to fill (| BB_MPMC_CLOSED)
+  _Alignas(BB_CACHE_LINE) atomic_ulong mpmc_head;  // Next position to drain
+  _Alignas(BB_CACHE_LINE) bb_event_t not_full;     // Producers parked on a full ring (also sharded,
+                                                   // and pooled actors on the locked engines)
+  bb_event_t not_empty;                            // Consumers parked on an empty ring (likewise)
+
+  /* Sharded state: a thread's home shard is its CPU modulo nshards */
+  bb_shard_t *shards;                              // nshards sub-rings (buf is unused)
+  int nshards;
+  atomic_ulong steals;                             // Takes served from a non-home shard
+
+  /* Priority state (under m) */
+  bb_lane_t *lanes;
+  int nlanes;
+  int age_limit;            // Skips before a waiting lane is served anyway (0 = strict)
+
+  /* Shutdown (bb_close) */
+  atomic_int closed;
+  int items;                // Locked engine: trays in buf (under m), tells a close token from a tray
+
+  /* Slow-path accounting, only touched when an operation has to wait */
+  _Alignas(BB_CACHE_LINE) atomic_int spin_avg;     // Recent spin rounds that paid off, x8
+  atomic_ulong waits_spun;                         // Waits that ended while spinning
+  atomic_ulong waits_parked;                       // Waits that went to sleep
+  atomic_ulong waits_timed_out;                    // Timed waits that hit their deadline
 } bb_t;
 
+/* Snapshot of how waits ended, for tuning the spin budget */
+typedef struct {
+  unsigned long spun;
+  unsigned long parked;
+  unsigned long timed_out;
+  int spin_budget;          // Rounds the next wait will spin before parking
+  unsigned long steals;     // Sharded engine: takes served from another shard
+} bb_wait_stats_t;
+
 int  bb_init(bb_t *q, int capacity);
+int  bb_init_spsc(bb_t *q, int capacity);  /* exactly one producer and one consumer thread */
+int  bb_init_mpmc(bb_t *q, int capacity);  /* any number of producers and consumers; capacity >= 2 */
+int  bb_init_sharded(bb_t *q, int capacity, int nshards);  /* nshards <= 0: one per online CPU; at most capacity */
+/* Priority lanes: bb_take always serves the most urgent non-empty lane
+ * unless a lower lane has been passed over age_limit times in a row
+ * (age_limit 0 = strict priority). bb_put and the other entry points use
+ * the least urgent lane. */
+int  bb_init_prio(bb_t *q, int capacity, int nlanes, int age_limit);
+int  bb_put_prio(bb_t *q, food_tray_t *tray, int lane);  /* blocks if full; -1 for a bad lane */
+
+/* Queueing latency (put to take) of one lane, from its histogram */
+typedef struct {
+  unsigned long taken;
+  uint64_t p50_ns, p99_ns, max_ns;
+} bb_lane_stats_t;
+int  bb_lane_stats(bb_t *q, int lane, bb_lane_stats_t *out);
+
+/* Engine by name ("locked", "spsc", "mpmc", "sharded" or "sharded:N" for
+ * N shards, "prio" for 3 strict lanes); -1 if unknown */
+int  bb_init_engine(bb_t *q, int capacity, const char *engine);
 void bb_destroy(bb_t *q);
-void bb_put(bb_t *q, food_tray_t *tray);   /* blocks if full */
+int  bb_put(bb_t *q, food_tray_t *tray);   /* blocks if full; -1 once closed */
 food_tray_t* bb_take(bb_t *q);             /* blocks if empty, returns tray to consume */
+int  bb_put_many(bb_t *q, food_tray_t **trays, int n);  /* blocks until all n are queued, returns count queued */
+int  bb_take_many(bb_t *q, food_tray_t **out, int max); /* blocks for >= 1, returns count taken */
+int  bb_count(bb_t *q);                    /* snapshot of trays buffered (racy while in use) */
+
+/* Shutdown. After bb_close, puts fail with -1 (the caller keeps the tray)
+ * and takes return what is still buffered, then NULL (bb_take_many: 0).
+ * Every blocked thread is woken. bb_drain blocks until the buffer is empty,
+ * e.g. before bb_destroy once consumers are known to be running. */
+void bb_close(bb_t *q);
+void bb_drain(bb_t *q);
+
+/* Non-blocking / deadline-bounded variants. Deadlines are absolute
+ * CLOCK_MONOTONIC times (see deadline_in_ms). Puts return 0 or -1 (full / timed out),
+ * takes return the tray or NULL (empty / timed out). */
+int  bb_try_put(bb_t *q, food_tray_t *tray);
+int  bb_put_timed(bb_t *q, food_tray_t *tray, const struct timespec *deadline);
+food_tray_t* bb_try_take(bb_t *q);
+food_tray_t* bb_take_timed(bb_t *q, const struct timespec *deadline);
+void bb_wait_stats(bb_t *q, bb_wait_stats_t *out);
 
-/* Helper functions for food trays */
+/* Helper functions for food trays (thin wrappers over the tray pool) */
 food_tray_t* create_food_tray(int tray_id, const char *food_name, int cook_id);
 void free_food_tray(food_tray_t *tray);
 
+/* Tray pool: each thread keeps two magazines of free trays; full and empty
+ * magazines are exchanged with a shared depot, so a tray freed on one thread
+ * is reused by another without going back to malloc. Trays are never
+ * returned to the system allocator. */
+#define TRAY_MAG_SIZE 32
+food_tray_t* tray_alloc(void);           /* uninitialized tray */
+void tray_release(food_tray_t *tray);
+unsigned long tray_pool_allocated(void); /* trays ever obtained from malloc */
+
+/* Returns the canonical copy of name; equal names share one pointer that
+ * stays valid for the life of the process */
+const char* intern_food_name(const char *name);
+
 #endif
@@ -1,12 +1,15 @@
 #define _XOPEN_SOURCE 700
 #include <unistd.h>
 #include "sync_utils.h"
+#include "bounded_buffer.h"
 #include <stdlib.h>
+#include <string.h>
 
 int usleep(unsigned int usec);
 
 /* Config */
 enum { NUM_ATTENDEES = 40, NUM_COOKS = 2, BUF_C = 8, SNACKS_PER_ATTENDEE = 1 };
+enum { RNG_COOKS = 100, RNG_ATTENDEES = 200 };   // PRNG stream numbers (rng_thread)
 
 /* Food names for variety */
 static const char* food_names[] = {
@@ -21,6 +24,7 @@ static pthread_mutex_t tray_counter_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static void* cook(void* arg) {
   long id = (long)arg;
+  rng_thread(RNG_COOKS + id);
   for (;;) {
     jitter_us(500, 5000);
     
@@ -30,10 +34,13 @@ static void* cook(void* arg) {
     pthread_mutex_unlock(&tray_counter_mutex);
     
     // Create a food tray with random food
-    const char* food = food_names[rand() % num_food_types];
+    const char* food = food_names[rng_below(num_food_types)];
     food_tray_t *tray = create_food_tray(tray_id, food, (int)id);
     
-    bb_put(&snack_queue, tray);
+    if (bb_put(&snack_queue, tray)) {   // queue closed: kitchen shuts down
+      free_food_tray(tray);
+      break;
+    }
     LOG("Kitchen#%ld produced tray #%d with %s", id, tray_id, food);
   }
   return NULL;
@@ -41,6 +48,7 @@ static void* cook(void* arg) {
 
 static void* attendee(void* arg) {
   long id = (long)arg;
+  rng_thread(RNG_ATTENDEES + id);
   for (int k = 0; k < SNACKS_PER_ATTENDEE; ++k) {
     food_tray_t *tray = bb_take(&snack_queue);
     LOG("Attendee#%ld took tray #%d with %s (prepared by Cook#%d)", 
@@ -56,17 +64,41 @@ static void* attendee(void* arg) {
 
 /* Public entry for main/test */
 int snacks_run(void) {
-  srand((unsigned)time(NULL));
-  if (bb_init(&snack_queue, BUF_C)) DIE("bb_init");
+  return snacks_run_engine("locked");
+}
+
+/* The snacks queue has several cooks and attendees, so every engine but
+ * the single-producer, single-consumer spsc ring */
+int snacks_engine_ok(const char *engine) {
+  return strcmp(engine, "locked") == 0 || strcmp(engine, "mpmc") == 0 ||
+         strcmp(engine, "prio") == 0 || strcmp(engine, "sharded") == 0 ||
+         (strncmp(engine, "sharded:", 8) == 0 && atoi(engine + 8) > 0);
+}
+
+/* Same run on another bb_t engine (see bb_init_engine); -1 for an engine
+ * snacks_engine_ok refuses */
+int snacks_run_engine(const char *engine) {
+  if (!snacks_engine_ok(engine)) {
+    fprintf(stderr, "snacks: engine %s can't take several producers and consumers "
+            "(use locked, mpmc, sharded[:N] or prio)\n", engine);
+    return -1;
+  }
+  if (bb_init_engine(&snack_queue, BUF_C, engine)) DIE("bb_init");
+  LOG("Snacks queue engine: %s", engine);
 
-  pthread_t people[NUM_ATTENDEES];
-  for (long i=0;i<NUM_COOKS;i++)   spawn(cook, (void*)i, "cook");
-  for (long i=0;i<NUM_ATTENDEES;i++) people[i] = spawn(attendee, (void*)i, "attendee");
+  task_t *cooks[NUM_COOKS], *people[NUM_ATTENDEES];
+  for (long i=0;i<NUM_COOKS;i++)   cooks[i] = actor_spawn(cook, (void*)i, "cook");
+  for (long i=0;i<NUM_ATTENDEES;i++) people[i] = actor_spawn(attendee, (void*)i, "attendee");
 
-  for (int i=0;i<NUM_ATTENDEES;i++) join(people[i]);
+  for (int i=0;i<NUM_ATTENDEES;i++) actor_join(people[i]);
 
-  /* In a full sim, cooks run forever; in the module demo we don't join them. */
-  LOG("Snacks module complete (all attendees served once).");
+  /* Everyone is served: close the queue so the cooks stop, then throw away
+   * whatever they had already put out. */
+  bb_close(&snack_queue);
+  for (int i=0;i<NUM_COOKS;i++) actor_join(cooks[i]);
+  int leftover = 0;
+  for (food_tray_t *t; (t = bb_take(&snack_queue)) != NULL; leftover++) free_food_tray(t);
+  LOG("Snacks module complete (all attendees served once, %d trays left over).", leftover);
   bb_destroy(&snack_queue);
   return 0;
 }
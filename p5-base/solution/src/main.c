@@ -1,21 +1,54 @@
 #include "modules.h"
 #include "sync_utils.h"
 #include "bounded_buffer.h"
+#include "readers_writers.h"
+#include <string.h>
 /* Prototypes from modules */
 int schedule_run(void);
 int snacks_run(void);
 
+/* Usage: conference_sim [snacks-engine [schedule-engine]]
+ *   snacks:   locked, mpmc, sharded[:N], prio (not spsc: there are several cooks)
+ *   schedule: sem, reader-pref, phase-fair, percpu, futex, seqlock, rcu, combine
+ * LOG_ASYNC=1 in the environment logs through per-thread rings to stdout,
+ * LOG_ASYNC=<path> to that file. Built with TRACE=1, TRACE_FILE=<path>
+ * records bb_t and rwlock_t events there (see trace_decode). SYNC_ACTORS=pool
+ * runs the attendees, cooks, readers and writers on a thread pool instead
+ * of a thread each. SYNC_AFFINITY places threads by name, e.g.
+ * SYNC_AFFINITY="cook=0;attendee=1" or SYNC_AFFINITY=scatter (see spawn). */
 int main(int argc, char** argv) {
-  (void)argc; (void)argv;
-  LOG("Conference Simulation start");
+  const char *engine = (argc > 1) ? argv[1] : "locked";
+  const char *board_engine = (argc > 2) ? argv[2] : "sem";
+  if (!snacks_engine_ok(engine)) {
+    fprintf(stderr, "usage: %s [locked|mpmc|sharded[:N]|prio [schedule-engine]]\n", argv[0]);
+    return 2;
+  }
+  const char *log_async = getenv("LOG_ASYNC");
+  if (log_async && log_async_start(strcmp(log_async, "1") ? log_async : NULL))
+    fprintf(stderr, "LOG_ASYNC: can't log to %s, logging directly\n", log_async);
+  const char *trace_file = getenv("TRACE_FILE");
+  if (trace_file && trace_start(trace_file))
+    fprintf(stderr, "TRACE_FILE: can't create %s, not tracing\n", trace_file);
+  const char *actors = getenv("SYNC_ACTORS");
+  pool_t *pool = actors && strcmp(actors, "pool") == 0 ? pool_create(0) : NULL;
+  if (pool) actors_use_pool(pool);
+  else if (actors && strcmp(actors, "threads") != 0)
+    fprintf(stderr, "SYNC_ACTORS: expected pool or threads, running a thread per actor\n");
+  LOG("Conference Simulation start (seed %llu, set SYNC_SEED to repeat)", (unsigned long long)rng_master());
 
   /* Run both simulations */
   LOG("=== Readers-Writers (Schedule Board) ===");
-  schedule_run();       /* readers-writers */
+  schedule_run_engine(board_engine);  /* readers-writers */
 
   LOG("=== Producer-Consumer (Snacks) ===");
-  snacks_run();         /* bounded buffer */
+  snacks_run_engine(engine);  /* bounded buffer */
 
   LOG("Conference Simulation complete");
+  if (pool) {
+    LOG("Actors ran on %d pooled workers", pool_workers(pool));
+    pool_destroy(pool);
+  }
+  trace_stop();
+  log_async_stop();
   return 0;
 }
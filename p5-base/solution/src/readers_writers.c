@@ -2,13 +2,50 @@
 #include <unistd.h>
 #include "readers_writers.h"
 #include "sync_utils.h"
+#include <limits.h>
+#include <string.h>
 
 int usleep(unsigned int usec);
+int pthread_mutex_clocklock(pthread_mutex_t *m, clockid_t clock, const struct timespec *abstime);
+int sched_getcpu(void);
 extern int rw_init(rwlock_t *rw);   /* in sync_utils.c: sets m,wlock, counters */
 extern void rw_destroy(rwlock_t *rw);
 
+/* How attendees and organizers share the board */
+typedef enum {
+  BOARD_RWLOCK = 0,   // rwlock_t around schedule_version
+  BOARD_SEQLOCK,      // Optimistic reads of schedule_version
+  BOARD_RCU,          // Copy-on-write schedule_t, lock-free traversal
+  BOARD_COMBINE       // rwlock_t, organizers' updates batched by rw_combine
+} board_mode_t;
+
+/* Published schedule for BOARD_RCU runs. Organizers rewrite a copy and
+ * stamp every session with the new version, so a reader can tell a torn
+ * snapshot from a consistent one. */
+#define NUM_SESSIONS 12
+#define NUM_ROOMS    4
+#define NUM_BOARD_READERS 8
+#define NUM_BOARD_WRITERS 2
+typedef struct {
+  int start_min;      // Minutes after the conference opens
+  int room;
+  int version;        // Schedule version this entry was written for
+  char title[24];
+} session_t;
+
+typedef struct {
+  int version;
+  session_t sessions[NUM_SESSIONS];
+} schedule_t;
+
+static board_mode_t board_mode;
 static rwlock_t board;
-static int schedule_version = 0;
+static seqlock_t board_seq;
+static _Atomic(schedule_t*) board_rcu;
+static pthread_mutex_t board_edit = PTHREAD_MUTEX_INITIALIZER;  // Serializes RCU organizers
+static atomic_int schedule_version = 0;
+static atomic_int read_retries;
+static atomic_int combined_batches;   // Write sections that applied several updates
 static int violation_count = 0;
 static int readers_in_cs = 0;
 static int writers_in_cs = 0;
@@ -21,43 +58,587 @@ int get_violation_count(void) {
   return violation_count;
 }
 
-void rw_rlock(rwlock_t *rw) {
+/* Small per-thread number, handed out round-robin: picks a thread's reader
+ * slot and its statistics stripe */
+static _Thread_local int my_index = -1;
+static atomic_int next_index;
+
+static int thread_index(void) {
+  if (my_index < 0) my_index = atomic_fetch_add_explicit(&next_index, 1, memory_order_relaxed);
+  return my_index;
+}
+
+/* ------- Contention statistics (RW_STATS) -------
+ * The public entry points at the end wrap the engines with these probes.
+ * Waits are measured from the call to the acquire; holds from the acquire
+ * to the release, writers in the stats block (one writer at a time), readers
+ * in a small per-thread stack of the read locks they hold. */
+#ifdef RW_STATS
+enum { RW_SIDE_READ, RW_SIDE_WRITE };
+enum { RW_STATS_NEST = 8 };
+
+static _Thread_local struct { rwlock_t *rw; uint64_t t0; } held_reads[RW_STATS_NEST];
+static _Thread_local int nheld_reads;
+
+static rw_stats_stripe_t* stats_stripe(rwlock_t *rw) {
+  return &rw->stats->stripe[thread_index() & (RW_STATS_STRIPES - 1)];
+}
+
+static void stats_max(_Atomic uint64_t *max, uint64_t v) {
+  uint64_t cur = atomic_load_explicit(max, memory_order_relaxed);
+  while (v > cur && !atomic_compare_exchange_weak_explicit(max, &cur, v, memory_order_relaxed,
+                                                           memory_order_relaxed))
+    ;
+}
+
+static void stats_hist(atomic_ulong *hist, uint64_t ns) {
+  int b = ns ? 63 - __builtin_clzll(ns) : 0;
+  atomic_fetch_add_explicit(&hist[b < RW_HIST_BUCKETS ? b : RW_HIST_BUCKETS - 1], 1,
+                            memory_order_relaxed);
+}
+
+static void stats_queue(rwlock_t *rw, int side, int delta) {
+  int q = atomic_fetch_add_explicit(&rw->stats->queued[side], delta, memory_order_relaxed) + delta;
+  int max = atomic_load_explicit(&rw->stats->max_queue[side], memory_order_relaxed);
+  while (q > max && !atomic_compare_exchange_weak_explicit(&rw->stats->max_queue[side], &max, q,
+                                                           memory_order_relaxed, memory_order_relaxed))
+    ;
+}
+
+static void stats_acquired(rwlock_t *rw, int side, uint64_t t0, bool contended) {
+  rw_side_counters_t *c = &stats_stripe(rw)->side[side];
+  uint64_t now = now_ns();
+  atomic_fetch_add_explicit(&c->acquires, 1, memory_order_relaxed);
+  if (contended) atomic_fetch_add_explicit(&c->contended, 1, memory_order_relaxed);
+  stats_hist(c->wait_hist, now - t0);
+  stats_max(&c->wait_max_ns, now - t0);
+  if (side == RW_SIDE_WRITE) {
+    rw->stats->write_t0 = now;
+  } else if (nheld_reads < RW_STATS_NEST) {
+    held_reads[nheld_reads].rw = rw;
+    held_reads[nheld_reads++].t0 = now;
+  }
+}
+
+static void stats_failed(rwlock_t *rw, int side) {
+  atomic_fetch_add_explicit(&stats_stripe(rw)->side[side].failed, 1, memory_order_relaxed);
+}
+
+/* Called just before the release; a read lock missing from the stack (nested
+ * too deeply) goes without a hold sample */
+static void stats_released(rwlock_t *rw, int side) {
+  uint64_t t0 = rw->stats->write_t0;
+  if (side == RW_SIDE_READ) {
+    int i = nheld_reads - 1;
+    while (i >= 0 && held_reads[i].rw != rw) i--;
+    if (i < 0) return;
+    t0 = held_reads[i].t0;
+    for (nheld_reads--; i < nheld_reads; i++) held_reads[i] = held_reads[i + 1];
+  }
+  rw_side_counters_t *c = &stats_stripe(rw)->side[side];
+  uint64_t hold = now_ns() - t0;
+  stats_hist(c->hold_hist, hold);
+  stats_max(&c->hold_max_ns, hold);
+}
+
+#define RW_STAT_HANDOFF(rw) \
+  atomic_fetch_add_explicit(&stats_stripe(rw)->handoffs, 1, memory_order_relaxed)
+#else
+#define RW_STAT_HANDOFF(rw) ((void)0)
+#endif
+
+/* ------- Read-mostly engine (rw_init_percpu) -------
+ * A reader announces itself in its slot and then checks the gate; a writer
+ * closes the gate and then scans the slots. Both sides are seq_cst, so
+ * either the reader sees the closed gate (and backs out) or the writer sees
+ * the reader's slot count (and waits for it). Writers still take priority:
+ * a closed gate turns new readers away, and the gate stays closed while
+ * more writers are queued. */
+
+/* ------- Cohort variant (rw_init_cohort) -------
+ * Same gate and slots, one slot per node. Instead of locking m, a writer
+ * takes its node's local mutex and then the node's turn at the writer
+ * side, which nodes get in FIFO order (queue under m). A releasing writer
+ * that sees blocking writers queued on its node keeps the turn and passes
+ * it to them, up to max_batch times in a row, so the lock's cache lines
+ * stay on one node for a while. */
+static _Thread_local int my_cpu = -1;    // CPU seen at first use, kept for the thread's life
+static _Thread_local int my_node = -1;   // rw_cohort_set_node override
+
+void rw_cohort_set_node(int node) {
+  my_node = node < 0 ? -1 : node;
+}
+
+static int cohort_node(rwlock_t *rw) {
+  rw_cohort_t *c = rw->cohort;
+  if (my_node >= 0) return my_node % c->nnodes;
+  if (my_cpu < 0) {
+    int cpu = sched_getcpu();
+    my_cpu = cpu < 0 ? 0 : cpu;
+  }
+  return c->cpu_node[my_cpu % c->ncpus];
+}
+
+static atomic_int* reader_slot(rwlock_t *rw) {
+  if (rw->cohort) return &rw->slots[cohort_node(rw)].readers;
+  return &rw->slots[thread_index() & (rw->nslots - 1)].readers;
+}
+
+static void cohort_unqueue(rw_cohort_t *c, int n) {
+  int i = 0;
+  while (i < c->len && c->queue[(c->head + i) % c->nnodes] != n) i++;
+  for (c->len--; i < c->len; i++)
+    c->queue[(c->head + i) % c->nnodes] = c->queue[(c->head + i + 1) % c->nnodes];
+}
+
+/* Node n's turn: at once if no node has it, else after the nodes queued
+ * ahead. A node whose writer gives up leaves the queue, unless the turn
+ * came in the meantime. */
+static int cohort_global_lock(rwlock_t *rw, int n, const struct timespec *deadline) {
+  rw_cohort_t *c = rw->cohort;
+  rw_cohort_node_t *node = &c->node[n];
+  pthread_mutex_lock(&rw->m);
+  if (!c->held) {
+    c->held = 1;
+    pthread_mutex_unlock(&rw->m);
+    return 0;
+  }
+  atomic_store(&node->granted, 0);
+  c->queue[(c->head + c->len++) % c->nnodes] = n;
+  pthread_mutex_unlock(&rw->m);
+  while (!atomic_load(&node->granted)) {
+    if (futex_wait(&node->granted, 0, deadline)) {
+      pthread_mutex_lock(&rw->m);
+      int granted = atomic_load(&node->granted);
+      if (!granted) cohort_unqueue(c, n);
+      pthread_mutex_unlock(&rw->m);
+      return granted ? 0 : -1;
+    }
+  }
+  return 0;
+}
+
+static void cohort_global_unlock(rwlock_t *rw) {
+  rw_cohort_t *c = rw->cohort;
+  pthread_mutex_lock(&rw->m);
+  if (c->len) {
+    rw_cohort_node_t *next = &c->node[c->queue[c->head]];
+    c->head = (c->head + 1) % c->nnodes;
+    c->len--;
+    atomic_store(&next->granted, 1);
+    futex_wake(&next->granted, 1);
+  } else {
+    c->held = 0;
+  }
+  pthread_mutex_unlock(&rw->m);
+}
+
+/* Only blocking writers count in waiting: a turn passed to a writer that
+ * gives up would be stranded on the node */
+static int cohort_enter(rwlock_t *rw, const struct timespec *deadline) {
+  int n = cohort_node(rw);
+  rw_cohort_node_t *node = &rw->cohort->node[n];
+  if (!deadline) {
+    atomic_fetch_add(&node->waiting, 1);
+    pthread_mutex_lock(&node->local);
+    atomic_fetch_sub(&node->waiting, 1);
+  } else if (pthread_mutex_clocklock(&node->local, CLOCK_MONOTONIC, deadline)) {
+    return -1;
+  }
+  if (node->passed) {
+    node->passed = 0;
+    return 0;
+  }
+  if (cohort_global_lock(rw, n, deadline) == 0) return 0;
+  pthread_mutex_unlock(&node->local);
+  return -1;
+}
+
+static int cohort_tryenter(rwlock_t *rw) {
+  rw_cohort_t *c = rw->cohort;
+  rw_cohort_node_t *node = &c->node[cohort_node(rw)];
+  if (pthread_mutex_trylock(&node->local)) return -1;
+  if (node->passed) {
+    node->passed = 0;
+    return 0;
+  }
+  pthread_mutex_lock(&rw->m);
+  int ok = !c->held;
+  if (ok) c->held = 1;
+  pthread_mutex_unlock(&rw->m);
+  if (!ok) pthread_mutex_unlock(&node->local);
+  return ok ? 0 : -1;
+}
+
+static void cohort_exit(rwlock_t *rw) {
+  rw_cohort_node_t *node = &rw->cohort->node[cohort_node(rw)];
+  if (atomic_load(&node->waiting) > 0 && node->batch < rw->cohort->max_batch) {
+    node->batch++;
+    node->passed = 1;
+  } else {
+    node->batch = 0;
+    cohort_global_unlock(rw);
+  }
+  pthread_mutex_unlock(&node->local);
+}
+
+/* The writer side: m, or the cohort's local mutex and turn */
+static int percpu_writer_enter(rwlock_t *rw, const struct timespec *deadline) {
+  if (rw->cohort) return cohort_enter(rw, deadline);
+  if (!deadline) return pthread_mutex_lock(&rw->m);
+  return pthread_mutex_clocklock(&rw->m, CLOCK_MONOTONIC, deadline) ? -1 : 0;
+}
+
+static void percpu_writer_exit(rwlock_t *rw) {
+  if (rw->cohort) cohort_exit(rw);
+  else pthread_mutex_unlock(&rw->m);
+}
+
+/* Leaves the slot; the reader that drains a slot under a closed gate wakes
+ * the writer scanning it */
+static void percpu_reader_exit(rwlock_t *rw, atomic_int *slot) {
+  if (atomic_fetch_sub(slot, 1) == 1 && atomic_load(&rw->gate) != 0) {
+    atomic_fetch_add(&rw->reader_exits, 1);
+    futex_wake(&rw->reader_exits, 1);
+  }
+}
+
+static int percpu_tryrlock(rwlock_t *rw) {
+  atomic_int *slot = reader_slot(rw);
+  atomic_fetch_add(slot, 1);
+  if (atomic_load(&rw->gate) == 0) return 0;
+  percpu_reader_exit(rw, slot);
+  return -1;
+}
+
+static int percpu_rlock(rwlock_t *rw, const struct timespec *deadline) {
+  while (percpu_tryrlock(rw)) {
+    /* Mark the gate as having sleepers (1 -> 2) and wait for it to open */
+    for (unsigned g; (g = atomic_load(&rw->gate)) != 0; ) {
+      if (g == 1 && !atomic_compare_exchange_strong(&rw->gate, &g, 2)) continue;
+      if (futex_wait(&rw->gate, 2, deadline)) return -1;
+    }
+  }
+  return 0;
+}
+
+static void percpu_wunlock(rwlock_t *rw) {
+  /* The last queued writer reopens the gate; otherwise the next writer
+   * inherits it closed and readers keep waiting */
+  if (atomic_fetch_sub(&rw->writers_queued, 1) > 1) {
+    RW_STAT_HANDOFF(rw);
+  } else if (atomic_exchange(&rw->gate, 0) == 2) {
+    RW_STAT_HANDOFF(rw);
+    futex_wake(&rw->gate, INT_MAX);
+  }
+  percpu_writer_exit(rw);
+}
+
+/* With the writer side held and counted in writers_queued: close the gate
+ * and wait for the slots to drain. On timeout the writer backs out as if it
+ * had released the lock. */
+static int percpu_drain(rwlock_t *rw, const struct timespec *deadline) {
+  unsigned open = 0;
+  atomic_compare_exchange_strong(&rw->gate, &open, 1);  // already closed if handed over
+  for (int i = 0; i < rw->nslots; i++) {
+    atomic_int *slot = &rw->slots[i].readers;
+    for (;;) {
+      unsigned seen = atomic_load(&rw->reader_exits);
+      if (atomic_load(slot) == 0) break;
+      if (futex_wait(&rw->reader_exits, seen, deadline)) {
+        percpu_wunlock(rw);
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+static int percpu_wlock(rwlock_t *rw, const struct timespec *deadline) {
+  if (!deadline) {
+    atomic_fetch_add(&rw->writers_queued, 1);
+    percpu_writer_enter(rw, NULL);
+  } else {
+    /* A timed writer queues only once it holds the writer side: giving up
+     * on it must not leave the gate closed for a writer that never comes */
+    if (percpu_writer_enter(rw, deadline)) return -1;
+    atomic_fetch_add(&rw->writers_queued, 1);
+  }
+  return percpu_drain(rw, deadline);
+}
+
+static int percpu_trywlock(rwlock_t *rw) {
+  if (rw->cohort ? cohort_tryenter(rw) : pthread_mutex_trylock(&rw->m)) return -1;
+  atomic_fetch_add(&rw->writers_queued, 1);
+  unsigned open = 0;
+  atomic_compare_exchange_strong(&rw->gate, &open, 1);
+  for (int i = 0; i < rw->nslots; i++) {
+    if (atomic_load(&rw->slots[i].readers)) {
+      percpu_wunlock(rw);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Entering our slot before releasing keeps the next writer out until we
+ * leave it */
+static void percpu_downgrade(rwlock_t *rw) {
+  atomic_fetch_add(reader_slot(rw), 1);
+  percpu_wunlock(rw);
+}
+
+/* ------- Single-word engine (rw_init_futex) -------
+ * Acquire and release are one CAS on rw->word when nobody waits (a reader
+ * release is one fetch_sub). After a failed attempt a thread spins for a
+ * short adaptive number of rounds, then sleeps: readers on word itself,
+ * after setting RW_READERS_ASLEEP, writers on writer_seq. Writer priority
+ * as in the semaphore engine: a queued writer keeps new readers out, and a
+ * releasing writer hands over to the next writer before waking readers. */
+#define RW_READERS_BLOCKED (RW_WRITER_HELD | RW_WRITERS_MASK | RW_UPGRADING)
+enum { RW_SPIN_SLACK = 10 };
+
+static int futex_spin_limit(rwlock_t *rw) {
+  if (!rw->spin_max) return 0;
+  int lim = 2 * (atomic_load_explicit(&rw->spin_avg, memory_order_relaxed) >> 3) + RW_SPIN_SLACK;
+  return lim > rw->spin_max ? rw->spin_max : lim;
+}
+
+/* Record how a wait ended: after 'rounds' of spinning, or parked (rounds = 0).
+ * spin_avg is kept x8 so it can decay to 0 (see spin_feedback for bb_t). */
+static void futex_spin_feedback(rwlock_t *rw, int rounds) {
+  int avg8 = atomic_load_explicit(&rw->spin_avg, memory_order_relaxed);
+  atomic_store_explicit(&rw->spin_avg, avg8 - (avg8 >> 3) + rounds, memory_order_relaxed);
+}
+
+static void wake_writer(rwlock_t *rw) {
+  RW_STAT_HANDOFF(rw);
+  atomic_fetch_add(&rw->writer_seq, 1);
+  futex_wake(&rw->writer_seq, 1);
+}
+
+static void wake_readers(rwlock_t *rw) {
+  RW_STAT_HANDOFF(rw);
+  futex_wake(&rw->word, INT_MAX);
+}
+
+static int futex_tryrlock(rwlock_t *rw) {
+  unsigned w = atomic_load_explicit(&rw->word, memory_order_relaxed);
+  while (!(w & RW_READERS_BLOCKED)) {
+    if (atomic_compare_exchange_weak_explicit(&rw->word, &w, w + 1,
+                                              memory_order_acquire, memory_order_relaxed))
+      return 0;
+  }
+  return -1;
+}
+
+static int futex_rlock(rwlock_t *rw, const struct timespec *deadline) {
+  unsigned w = atomic_load_explicit(&rw->word, memory_order_relaxed);
+  if (!(w & RW_READERS_BLOCKED) &&
+      atomic_compare_exchange_strong_explicit(&rw->word, &w, w + 1,
+                                              memory_order_acquire, memory_order_relaxed))
+    return 0;
+  int limit = futex_spin_limit(rw), spins = 0;
+  bool parked = false;
+  for (;;) {
+    if (!(w & RW_READERS_BLOCKED)) {
+      if (atomic_compare_exchange_weak(&rw->word, &w, w + 1)) break;
+      continue;
+    }
+    if (spins < limit) {
+      spins++;
+      cpu_relax();
+      w = atomic_load(&rw->word);
+      continue;
+    }
+    if (!(w & RW_READERS_ASLEEP) &&
+        !atomic_compare_exchange_weak(&rw->word, &w, w | RW_READERS_ASLEEP))
+      continue;
+    parked = true;
+    /* Timing out leaves RW_READERS_ASLEEP set: at worst a spurious wake-up */
+    if (futex_wait(&rw->word, w | RW_READERS_ASLEEP, deadline)) return -1;
+    w = atomic_load(&rw->word);
+  }
+  futex_spin_feedback(rw, parked ? 0 : spins);
+  return 0;
+}
+
+static void futex_runlock(rwlock_t *rw) {
+  unsigned old = atomic_fetch_sub_explicit(&rw->word, 1, memory_order_release);
+  if ((old & RW_READERS_MASK) == 2 && (old & RW_UPGRADING)) {
+    /* Only the upgrader is left. Writers sleep on writer_seq too, so wake
+     * them all rather than risk waking a writer instead of the upgrader. */
+    RW_STAT_HANDOFF(rw);
+    atomic_fetch_add(&rw->writer_seq, 1);
+    futex_wake(&rw->writer_seq, INT_MAX);
+  } else if ((old & RW_READERS_MASK) == 1 && (old & RW_WRITERS_MASK)) {
+    wake_writer(rw);
+  }
+}
+
+static int futex_trywlock(rwlock_t *rw) {
+  unsigned w = atomic_load_explicit(&rw->word, memory_order_relaxed);
+  if (!(w & ~RW_READERS_ASLEEP) &&
+      atomic_compare_exchange_strong_explicit(&rw->word, &w, w | RW_WRITER_HELD,
+                                              memory_order_acquire, memory_order_relaxed))
+    return 0;
+  return -1;
+}
+
+/* A timed-out writer leaves the queue. If it was the last one, readers it
+ * kept out are let in; if the lock is free, the wake-up it may have
+ * absorbed is passed on to the next queued writer. */
+static void futex_writer_withdraw(rwlock_t *rw) {
+  unsigned w = atomic_load(&rw->word), nw;
+  do {
+    nw = w - RW_WRITER_ONE;
+    if (!(nw & RW_READERS_BLOCKED)) nw &= ~RW_READERS_ASLEEP;
+  } while (!atomic_compare_exchange_weak(&rw->word, &w, nw));
+  if ((w & RW_READERS_ASLEEP) && !(nw & RW_READERS_ASLEEP)) wake_readers(rw);
+  if ((nw & RW_WRITERS_MASK) && !(nw & (RW_WRITER_HELD | RW_READERS_MASK))) wake_writer(rw);
+}
+
+static int futex_wlock(rwlock_t *rw, const struct timespec *deadline) {
+  if (futex_trywlock(rw) == 0) return 0;
+  /* Queue first: from here on no new reader gets in */
+  atomic_fetch_add(&rw->word, RW_WRITER_ONE);
+  int limit = futex_spin_limit(rw), spins = 0;
+  bool parked = false;
+  for (;;) {
+    unsigned seq = atomic_load(&rw->writer_seq);
+    unsigned w = atomic_load(&rw->word);
+    if (!(w & (RW_WRITER_HELD | RW_READERS_MASK))) {
+      if (atomic_compare_exchange_weak(&rw->word, &w, (w - RW_WRITER_ONE) | RW_WRITER_HELD)) break;
+      continue;
+    }
+    if (spins < limit) {
+      spins++;
+      cpu_relax();
+      continue;
+    }
+    parked = true;
+    if (futex_wait(&rw->writer_seq, seq, deadline)) {
+      futex_writer_withdraw(rw);
+      return -1;
+    }
+  }
+  futex_spin_feedback(rw, parked ? 0 : spins);
+  return 0;
+}
+
+static void futex_wunlock(rwlock_t *rw) {
+  unsigned w = RW_WRITER_HELD;
+  if (atomic_compare_exchange_strong_explicit(&rw->word, &w, 0,
+                                              memory_order_release, memory_order_relaxed))
+    return;
+  /* Readers stay asleep while another writer is queued */
+  unsigned nw;
+  do {
+    nw = w & ~RW_WRITER_HELD;
+    if (!(w & RW_WRITERS_MASK)) nw &= ~RW_READERS_ASLEEP;
+  } while (!atomic_compare_exchange_weak(&rw->word, &w, nw));
+  if (w & RW_WRITERS_MASK) wake_writer(rw);
+  else if (w & RW_READERS_ASLEEP) wake_readers(rw);
+}
+
+/* HELD -> one reader in a single CAS; sleeping readers join unless a
+ * writer is queued */
+static void futex_downgrade(rwlock_t *rw) {
+  unsigned w = atomic_load(&rw->word), nw;
+  do {
+    nw = (w & ~RW_WRITER_HELD) + 1;
+    if (!(nw & RW_WRITERS_MASK)) nw &= ~RW_READERS_ASLEEP;
+  } while (!atomic_compare_exchange_weak(&rw->word, &w, nw));
+  if ((w & RW_READERS_ASLEEP) && !(nw & RW_READERS_ASLEEP)) wake_readers(rw);
+}
+
+/* Called holding one read count (and upgrade_m). RW_UPGRADING keeps new
+ * readers out; writers cannot get in while our count is there, so the
+ * count turns into RW_WRITER_HELD once it is the only one left. */
+static void futex_upgrade(rwlock_t *rw) {
+  unsigned w = atomic_load(&rw->word);
+  for (;;) {
+    if ((w & RW_READERS_MASK) == 1) {
+      if (atomic_compare_exchange_weak(&rw->word, &w, ((w - 1) & ~RW_UPGRADING) | RW_WRITER_HELD))
+        return;
+      continue;
+    }
+    if (!(w & RW_UPGRADING) && !atomic_compare_exchange_weak(&rw->word, &w, w | RW_UPGRADING))
+      continue;
+    unsigned seq = atomic_load(&rw->writer_seq);
+    w = atomic_load(&rw->word);
+    if ((w & RW_READERS_MASK) != 1) {
+      futex_wait(&rw->writer_seq, seq, NULL);
+      w = atomic_load(&rw->word);
+    }
+  }
+}
+
+/* ------- Semaphore engine helpers (m held) ------- */
+/* Only reader priority lets readers pass a waiting writer; a pending
+ * upgrade keeps them out under every policy */
+static int sem_writers_ahead(rwlock_t *rw) {
+  return rw->writer_active + rw->upgrade_pending +
+         (rw->policy == RW_POLICY_READER ? 0 : rw->writers_waiting);
+}
+
+static void sem_admit_readers(rwlock_t *rw) {
+  if (rw->readers_waiting > 0) RW_STAT_HANDOFF(rw);
+  while (rw->readers_waiting > 0) {
+    rw->readers_waiting--;
+    rw->readers_active++;
+    sync_sem_post(&rw->OKToRead);
+  }
+}
+
+static void raw_rlock(rwlock_t *rw) {
     /* TODO: Implement reader lock (writer-priority)
      * - Block if a writer is waiting or active
      * - Increment reader count
      * - Use proper mutex locking
      */
     // (void)rw;  // Remove this when you implement the function
+    if (rw->mode == RW_MODE_PERCPU) { percpu_rlock(rw, NULL); return; }
+    if (rw->mode == RW_MODE_FUTEX) { futex_rlock(rw, NULL); return; }
     pthread_mutex_lock(&rw->m);
-    if(rw->writer_active + rw->writers_waiting == 0) {
+    if(sem_writers_ahead(rw) == 0) {
       rw->readers_active++;
-      sem_post(&rw->OKToRead);
+      sync_sem_post(&rw->OKToRead);
     }
     else {
       rw->readers_waiting++;
     }
     pthread_mutex_unlock(&rw->m);
-    sem_wait(&rw->OKToRead);
+    sync_sem_wait(&rw->OKToRead);
 }
 
-void rw_runlock(rwlock_t *rw) {
+static void raw_runlock(rwlock_t *rw) {
     /* TODO: Implement reader unlock
      * - Decrement reader count
      * - Signal waiting writers if this is the last reader
      * - Use proper mutex locking
      */
     // (void)rw;  // Remove this when you implement the function
+    if (rw->mode == RW_MODE_PERCPU) { percpu_reader_exit(rw, reader_slot(rw)); return; }
+    if (rw->mode == RW_MODE_FUTEX) { futex_runlock(rw); return; }
     pthread_mutex_lock(&rw->m);
     rw->readers_active--;
-    if(rw->readers_active == 0 && rw->writers_waiting > 0) {
+    if(rw->readers_active == 0 && rw->upgrade_pending) {
+      rw->upgrade_pending = 0;
+      rw->writer_active++;
+      RW_STAT_HANDOFF(rw);
+      sync_sem_post(&rw->OKToUpgrade);
+    }
+    else if(rw->readers_active == 0 && rw->writers_waiting > 0) {
       rw->writers_waiting--;
       rw->writer_active++;
-      sem_post(&rw->OKToWrite);
+      RW_STAT_HANDOFF(rw);
+      sync_sem_post(&rw->OKToWrite);
     }
     pthread_mutex_unlock(&rw->m);
 }
 
-void rw_wlock(rwlock_t *rw) {
+static void raw_wlock(rwlock_t *rw) {
     /* TODO: Implement writer lock (writer-priority)
      * - Increment writers_waiting to block new readers
      * - Wait until no readers or writers are active
@@ -65,46 +646,541 @@ void rw_wlock(rwlock_t *rw) {
      * - Use proper mutex locking and semaphores
      */
     // (void)rw;  // Remove this when you implement the function
+    if (rw->mode == RW_MODE_PERCPU) { percpu_wlock(rw, NULL); return; }
+    if (rw->mode == RW_MODE_FUTEX) { futex_wlock(rw, NULL); return; }
     pthread_mutex_lock(&rw->m);
     if(rw->writer_active + rw->writers_waiting + rw->readers_active == 0) {
       rw->writer_active++;
-      sem_post(&rw->OKToWrite);
+      sync_sem_post(&rw->OKToWrite);
     }
     else {
       rw->writers_waiting++;
     }
     pthread_mutex_unlock(&rw->m);
-    sem_wait(&rw->OKToWrite);
+    sync_sem_wait(&rw->OKToWrite);
 }
 
-void rw_wunlock(rwlock_t *rw) {
+static void raw_wunlock(rwlock_t *rw) {
     /* TODO: Implement writer unlock
      * - Clear writer_active flag
      * - Signal waiting writers if any
      * - Use proper mutex locking
      */
     // (void)rw;  // Remove this when you implement the function
+    if (rw->mode == RW_MODE_PERCPU) { percpu_wunlock(rw); return; }
+    if (rw->mode == RW_MODE_FUTEX) { futex_wunlock(rw); return; }
     pthread_mutex_lock(&rw->m);
     rw->writer_active--;
-    if(rw->writers_waiting > 0) {
+    /* Writer priority hands over to the next writer; reader priority and
+     * phase-fair start a reader phase for everyone who queued meanwhile */
+    if(rw->writers_waiting > 0 &&
+       (rw->policy == RW_POLICY_WRITER || rw->readers_waiting == 0)) {
       rw->writers_waiting--;
       rw->writer_active++;
-      sem_post(&rw->OKToWrite);
+      RW_STAT_HANDOFF(rw);
+      sync_sem_post(&rw->OKToWrite);
     }
     else {
-      while(rw->readers_waiting > 0) {
-        rw->readers_waiting--;
-        rw->readers_active++;
-        sem_post(&rw->OKToRead);
-      }
+      sem_admit_readers(rw);
     }
     pthread_mutex_unlock(&rw->m);
 }
 
+/* ------- Try, timed, downgrade and upgrade -------
+ * The semaphore engine grants these directly under m instead of the
+ * post-then-wait of rw_rlock / rw_wlock. A timed waiter that gives up
+ * re-checks under m: a token on its semaphore means it was granted after
+ * all (grants are interchangeable between waiters of one kind), otherwise
+ * it is still counted as waiting and withdraws. */
+static int sem_wait_grant(rwlock_t *rw, sync_sem_t *s, int *waiting,
+                          const struct timespec *deadline) {
+  if ((deadline ? sync_sem_clockwait(s, deadline) : sync_sem_wait(s)) == 0) return 0;
+  pthread_mutex_lock(&rw->m);
+  int rc = sync_sem_trywait(s);
+  if (rc) {
+    (*waiting)--;
+    /* A withdrawn writer may have been all that kept readers queued */
+    if (sem_writers_ahead(rw) == 0) sem_admit_readers(rw);
+  }
+  pthread_mutex_unlock(&rw->m);
+  return rc ? -1 : 0;
+}
+
+static int raw_tryrlock(rwlock_t *rw) {
+  if (rw->mode == RW_MODE_PERCPU) return percpu_tryrlock(rw);
+  if (rw->mode == RW_MODE_FUTEX) return futex_tryrlock(rw);
+  pthread_mutex_lock(&rw->m);
+  int ok = sem_writers_ahead(rw) == 0;
+  if (ok) rw->readers_active++;
+  pthread_mutex_unlock(&rw->m);
+  return ok ? 0 : -1;
+}
+
+static int raw_trywlock(rwlock_t *rw) {
+  if (rw->mode == RW_MODE_PERCPU) return percpu_trywlock(rw);
+  if (rw->mode == RW_MODE_FUTEX) return futex_trywlock(rw);
+  pthread_mutex_lock(&rw->m);
+  int ok = rw->writer_active + rw->writers_waiting + rw->readers_active == 0;
+  if (ok) rw->writer_active++;
+  pthread_mutex_unlock(&rw->m);
+  return ok ? 0 : -1;
+}
+
+static int raw_rlock_timed(rwlock_t *rw, const struct timespec *deadline) {
+  if (rw->mode == RW_MODE_PERCPU) return percpu_rlock(rw, deadline);
+  if (rw->mode == RW_MODE_FUTEX) return futex_rlock(rw, deadline);
+  pthread_mutex_lock(&rw->m);
+  if (sem_writers_ahead(rw) == 0) {
+    rw->readers_active++;
+    pthread_mutex_unlock(&rw->m);
+    return 0;
+  }
+  rw->readers_waiting++;
+  pthread_mutex_unlock(&rw->m);
+  return sem_wait_grant(rw, &rw->OKToRead, &rw->readers_waiting, deadline);
+}
+
+static int raw_wlock_timed(rwlock_t *rw, const struct timespec *deadline) {
+  if (rw->mode == RW_MODE_PERCPU) return percpu_wlock(rw, deadline);
+  if (rw->mode == RW_MODE_FUTEX) return futex_wlock(rw, deadline);
+  pthread_mutex_lock(&rw->m);
+  if (rw->writer_active + rw->writers_waiting + rw->readers_active == 0) {
+    rw->writer_active++;
+    pthread_mutex_unlock(&rw->m);
+    return 0;
+  }
+  rw->writers_waiting++;
+  pthread_mutex_unlock(&rw->m);
+  return sem_wait_grant(rw, &rw->OKToWrite, &rw->writers_waiting, deadline);
+}
+
+static void raw_downgrade(rwlock_t *rw) {
+  if (rw->mode == RW_MODE_PERCPU) { percpu_downgrade(rw); return; }
+  if (rw->mode == RW_MODE_FUTEX) { futex_downgrade(rw); return; }
+  pthread_mutex_lock(&rw->m);
+  rw->writer_active--;
+  rw->readers_active++;
+  /* Queued readers join us unless the policy keeps them behind a writer */
+  if (sem_writers_ahead(rw) == 0) sem_admit_readers(rw);
+  pthread_mutex_unlock(&rw->m);
+}
+
+static int raw_upgrade(rwlock_t *rw) {
+  /* A percpu writer holds m while it waits for the slots to drain, so an
+   * upgrader queueing on m would wait for itself */
+  if (rw->mode == RW_MODE_PERCPU) return -1;
+  if (rw->mode == RW_MODE_FUTEX) {
+    futex_upgrade(rw);
+  } else {
+    pthread_mutex_lock(&rw->m);
+    rw->readers_active--;
+    if (rw->readers_active == 0) {
+      rw->writer_active++;
+      pthread_mutex_unlock(&rw->m);
+    } else {
+      /* Ahead of queued writers: the last reader out hands over to us */
+      rw->upgrade_pending = 1;
+      pthread_mutex_unlock(&rw->m);
+      sync_sem_wait(&rw->OKToUpgrade);
+    }
+  }
+  pthread_mutex_unlock(&rw->upgrade_m);
+  return 0;
+}
+
+/* ------- Public entry points -------
+ * Without RW_STATS these go straight to the engines. With it, a blocking or
+ * timed acquire first tries without waiting; if that fails it counts as
+ * contended, and the thread as queued until it gets the lock or gives up.
+ * Either way, acquires and releases are traced (TRACE) once they are done. */
+#ifdef RW_STATS
+static void trace_acquired(rwlock_t *rw, int side, uint64_t t0) {
+  TRACE(side == RW_SIDE_WRITE ? TR_RW_WLOCK : TR_RW_RLOCK, rw, 0, t0);
+}
+
+static int stats_acquire(rwlock_t *rw, int side, const struct timespec *deadline) {
+  uint64_t t0 = now_ns();
+  bool write = side == RW_SIDE_WRITE;
+  int rc = write ? raw_trywlock(rw) : raw_tryrlock(rw);
+  bool contended = rc != 0;
+  if (contended) {
+    stats_queue(rw, side, 1);
+    if (deadline) {
+      rc = write ? raw_wlock_timed(rw, deadline) : raw_rlock_timed(rw, deadline);
+    } else {
+      if (write) raw_wlock(rw);
+      else raw_rlock(rw);
+      rc = 0;
+    }
+    stats_queue(rw, side, -1);
+  }
+  if (rc == 0) {
+    stats_acquired(rw, side, t0, contended);
+    trace_acquired(rw, side, t0);
+  } else {
+    stats_failed(rw, side);
+  }
+  return rc;
+}
+
+static int stats_try(rwlock_t *rw, int side) {
+  uint64_t t0 = now_ns();
+  int rc = side == RW_SIDE_WRITE ? raw_trywlock(rw) : raw_tryrlock(rw);
+  if (rc == 0) {
+    stats_acquired(rw, side, t0, false);
+    trace_acquired(rw, side, t0);
+  } else {
+    stats_failed(rw, side);
+  }
+  return rc;
+}
+
+void rw_rlock(rwlock_t *rw) { stats_acquire(rw, RW_SIDE_READ, NULL); }
+void rw_wlock(rwlock_t *rw) { stats_acquire(rw, RW_SIDE_WRITE, NULL); }
+int rw_rlock_timed(rwlock_t *rw, const struct timespec *deadline) {
+  return stats_acquire(rw, RW_SIDE_READ, deadline);
+}
+int rw_wlock_timed(rwlock_t *rw, const struct timespec *deadline) {
+  return stats_acquire(rw, RW_SIDE_WRITE, deadline);
+}
+int rw_tryrlock(rwlock_t *rw) { return stats_try(rw, RW_SIDE_READ); }
+int rw_trywlock(rwlock_t *rw) { return stats_try(rw, RW_SIDE_WRITE); }
+
+void rw_runlock(rwlock_t *rw) {
+  stats_released(rw, RW_SIDE_READ);
+  TRACE(TR_RW_RUNLOCK, rw, 0, 0);
+  raw_runlock(rw);
+}
+
+void rw_wunlock(rwlock_t *rw) {
+  stats_released(rw, RW_SIDE_WRITE);
+  TRACE(TR_RW_WUNLOCK, rw, 0, 0);
+  raw_wunlock(rw);
+}
+
+void rw_downgrade(rwlock_t *rw) {
+  stats_released(rw, RW_SIDE_WRITE);
+  TRACE(TR_RW_WUNLOCK, rw, 0, 0);
+  raw_downgrade(rw);
+  stats_acquired(rw, RW_SIDE_READ, now_ns(), false);
+  trace_acquired(rw, RW_SIDE_READ, 0);
+}
+
+/* The read hold runs until the upgrade completes */
+int rw_upgrade(rwlock_t *rw) {
+  uint64_t t0 = now_ns();
+  int rc = raw_upgrade(rw);
+  if (rc == 0) {
+    stats_released(rw, RW_SIDE_READ);
+    stats_acquired(rw, RW_SIDE_WRITE, t0, false);
+    TRACE(TR_RW_RUNLOCK, rw, 0, 0);
+    trace_acquired(rw, RW_SIDE_WRITE, t0);
+  }
+  return rc;
+}
+
+static void sum_side(rw_side_stats_t *out, rw_side_counters_t *c) {
+  out->acquires += atomic_load_explicit(&c->acquires, memory_order_relaxed);
+  out->contended += atomic_load_explicit(&c->contended, memory_order_relaxed);
+  out->failed += atomic_load_explicit(&c->failed, memory_order_relaxed);
+  uint64_t wait_max = atomic_load_explicit(&c->wait_max_ns, memory_order_relaxed);
+  uint64_t hold_max = atomic_load_explicit(&c->hold_max_ns, memory_order_relaxed);
+  if (wait_max > out->wait_max_ns) out->wait_max_ns = wait_max;
+  if (hold_max > out->hold_max_ns) out->hold_max_ns = hold_max;
+  for (int b = 0; b < RW_HIST_BUCKETS; b++) {
+    out->wait_hist[b] += atomic_load_explicit(&c->wait_hist[b], memory_order_relaxed);
+    out->hold_hist[b] += atomic_load_explicit(&c->hold_hist[b], memory_order_relaxed);
+  }
+}
+
+int rw_stats(rwlock_t *rw, rw_stats_t *out) {
+  memset(out, 0, sizeof(*out));
+  for (int i = 0; i < RW_STATS_STRIPES; i++) {
+    rw_stats_stripe_t *st = &rw->stats->stripe[i];
+    sum_side(&out->read, &st->side[RW_SIDE_READ]);
+    sum_side(&out->write, &st->side[RW_SIDE_WRITE]);
+    out->handoffs += atomic_load_explicit(&st->handoffs, memory_order_relaxed);
+  }
+  out->read.max_queue = atomic_load_explicit(&rw->stats->max_queue[RW_SIDE_READ], memory_order_relaxed);
+  out->write.max_queue = atomic_load_explicit(&rw->stats->max_queue[RW_SIDE_WRITE], memory_order_relaxed);
+  return 0;
+}
+
+void rw_stats_reset(rwlock_t *rw) {
+  memset(rw->stats, 0, sizeof(*rw->stats));
+}
+#else
+void rw_rlock(rwlock_t *rw) {
+  uint64_t t0 = TRACE_NOW();
+  raw_rlock(rw);
+  TRACE(TR_RW_RLOCK, rw, 0, t0);
+}
+
+void rw_runlock(rwlock_t *rw) {
+  TRACE(TR_RW_RUNLOCK, rw, 0, 0);
+  raw_runlock(rw);
+}
+
+void rw_wlock(rwlock_t *rw) {
+  uint64_t t0 = TRACE_NOW();
+  raw_wlock(rw);
+  TRACE(TR_RW_WLOCK, rw, 0, t0);
+}
+
+void rw_wunlock(rwlock_t *rw) {
+  TRACE(TR_RW_WUNLOCK, rw, 0, 0);
+  raw_wunlock(rw);
+}
+
+int rw_tryrlock(rwlock_t *rw) {
+  uint64_t t0 = TRACE_NOW();
+  if (raw_tryrlock(rw)) return -1;
+  TRACE(TR_RW_RLOCK, rw, 0, t0);
+  return 0;
+}
+
+int rw_trywlock(rwlock_t *rw) {
+  uint64_t t0 = TRACE_NOW();
+  if (raw_trywlock(rw)) return -1;
+  TRACE(TR_RW_WLOCK, rw, 0, t0);
+  return 0;
+}
+
+int rw_rlock_timed(rwlock_t *rw, const struct timespec *deadline) {
+  uint64_t t0 = TRACE_NOW();
+  if (raw_rlock_timed(rw, deadline)) return -1;
+  TRACE(TR_RW_RLOCK, rw, 0, t0);
+  return 0;
+}
+
+int rw_wlock_timed(rwlock_t *rw, const struct timespec *deadline) {
+  uint64_t t0 = TRACE_NOW();
+  if (raw_wlock_timed(rw, deadline)) return -1;
+  TRACE(TR_RW_WLOCK, rw, 0, t0);
+  return 0;
+}
+
+void rw_downgrade(rwlock_t *rw) {
+  TRACE(TR_RW_WUNLOCK, rw, 0, 0);
+  raw_downgrade(rw);
+  TRACE(TR_RW_RLOCK, rw, 0, 0);
+}
+
+int rw_upgrade(rwlock_t *rw) {
+  uint64_t t0 = TRACE_NOW();
+  if (raw_upgrade(rw)) return -1;
+  TRACE(TR_RW_RUNLOCK, rw, 0, 0);
+  TRACE(TR_RW_WLOCK, rw, 0, t0);
+  return 0;
+}
+
+int rw_stats(rwlock_t *rw, rw_stats_t *out) {
+  (void)rw;
+  memset(out, 0, sizeof(*out));
+  return -1;
+}
+
+void rw_stats_reset(rwlock_t *rw) {
+  (void)rw;
+}
+#endif
+
+/* upgrade_m makes the upgradable reader unique, so two readers can never
+ * both wait for the other to leave */
+void rw_ulock(rwlock_t *rw) {
+  pthread_mutex_lock(&rw->upgrade_m);
+  rw_rlock(rw);
+}
+
+void rw_uunlock(rwlock_t *rw) {
+  rw_runlock(rw);
+  pthread_mutex_unlock(&rw->upgrade_m);
+}
+
+uint64_t rw_hist_percentile(const unsigned long *hist, int pct) {
+  unsigned long total = 0, seen = 0;
+  for (int b = 0; b < RW_HIST_BUCKETS; b++) total += hist[b];
+  if (!total) return 0;
+  unsigned long rank = (total * pct + 99) / 100;
+  for (int b = 0; b < RW_HIST_BUCKETS; b++) {
+    seen += hist[b];
+    if (seen >= rank) return (2ULL << b) - 1;   /* bucket upper bound */
+  }
+  return (2ULL << (RW_HIST_BUCKETS - 1)) - 1;
+}
+
+/* ------- Flat combining (rw_combine) -------
+ * A slot goes free -> claimed (owner fills in the closure) -> posted (bit
+ * set in combine_pending) -> done (applied by the combiner) -> free again
+ * once the owner has seen it. The combiner is whoever wins combine_m; the
+ * others sleep on combine_seq, which moves after every batch. */
+enum { COMBINE_FREE, COMBINE_CLAIMED, COMBINE_POSTED, COMBINE_DONE };
+enum { RW_COMBINE_ROUNDS = 4 };   // Rescans for closures posted during a batch
+
+static rw_combine_slot_t* combine_slots(rwlock_t *rw) {
+  rw_combine_slot_t *slots = atomic_load_explicit(&rw->combine, memory_order_acquire);
+  if (slots) return slots;
+  void *mem;
+  if (posix_memalign(&mem, _Alignof(rw_combine_slot_t), RW_COMBINE_SLOTS * sizeof(rw_combine_slot_t)))
+    return NULL;
+  slots = mem;
+  for (int i = 0; i < RW_COMBINE_SLOTS; i++) atomic_init(&slots[i].state, COMBINE_FREE);
+  rw_combine_slot_t *installed = NULL;
+  if (!atomic_compare_exchange_strong_explicit(&rw->combine, &installed, slots,
+                                               memory_order_acq_rel, memory_order_acquire)) {
+    free(slots);
+    slots = installed;
+  }
+  return slots;
+}
+
+/* One write section for everything posted so far; returns how many ran */
+static int combine_batch(rwlock_t *rw, rw_combine_slot_t *slots) {
+  int applied = 0;
+  rw_wlock(rw);
+  for (int round = 0; round < RW_COMBINE_ROUNDS; round++) {
+    unsigned bits = atomic_exchange(&rw->combine_pending, 0);
+    if (!bits) break;
+    for (; bits; bits &= bits - 1) {
+      rw_combine_slot_t *s = &slots[__builtin_ctz(bits)];
+      s->fn(s->arg);
+      atomic_store_explicit(&s->state, COMBINE_DONE, memory_order_release);
+      applied++;
+    }
+  }
+  rw_wunlock(rw);
+  return applied;
+}
+
+int rw_combine(rwlock_t *rw, void (*fn)(void *arg), void *arg) {
+  rw_combine_slot_t *slots = combine_slots(rw);
+  int i = thread_index() & (RW_COMBINE_SLOTS - 1);
+  unsigned expected = COMBINE_FREE;
+  if (!slots || !atomic_compare_exchange_strong(&slots[i].state, &expected, COMBINE_CLAIMED)) {
+    /* No slot to post in (allocation failed, or more threads than slots) */
+    rw_wlock(rw);
+    fn(arg);
+    rw_wunlock(rw);
+    return 1;
+  }
+  rw_combine_slot_t *mine = &slots[i];
+  mine->fn = fn;
+  mine->arg = arg;
+  atomic_store_explicit(&mine->state, COMBINE_POSTED, memory_order_release);
+  atomic_fetch_or(&rw->combine_pending, 1u << i);
+
+  int applied = 0;
+  for (;;) {
+    unsigned seq = atomic_load(&rw->combine_seq);
+    if (atomic_load_explicit(&mine->state, memory_order_acquire) == COMBINE_DONE) break;
+    if (pthread_mutex_trylock(&rw->combine_m) == 0) {
+      applied += combine_batch(rw, slots);
+      pthread_mutex_unlock(&rw->combine_m);
+      /* After the unlock, so a waiter that lost the trylock to us either
+       * sees its closure done or gets to combine next */
+      atomic_fetch_add(&rw->combine_seq, 1);
+      futex_wake(&rw->combine_seq, INT_MAX);
+      continue;
+    }
+    futex_wait(&rw->combine_seq, seq, NULL);
+  }
+  atomic_store_explicit(&mine->state, COMBINE_FREE, memory_order_relaxed);
+  return applied;
+}
+
+/* Optimistic read: copy the version, retry if an organizer got in.
+ * Returns the retries, which the reader adds up and publishes once. */
+static int read_seqlock(long id) {
+  unsigned s;
+  int v, tries = 0;
+  for (;; tries++) {
+    s = seq_read_begin(&board_seq);
+    v = atomic_load_explicit(&schedule_version, memory_order_relaxed);
+    if (!seq_read_retry(&board_seq, s)) break;
+  }
+  LOG("Attendee#%ld reads schedule v%d", id, v);
+  jitter_us(200, 800);
+  return tries;
+}
+
+/* Only the bump is in the write section: readers retry until it ends */
+static void update_seqlock(long id) {
+  seq_write_lock(&board_seq);
+  int v = ++schedule_version;
+  seq_write_unlock(&board_seq);
+  LOG("Organizer#%ld updates schedule to v%d", id, v);
+  jitter_us(200, 800);
+}
+
+/* Walk the published schedule without a lock; it stays valid until
+ * rcu_read_unlock even if an organizer replaces it meanwhile */
+static void read_rcu(long id) {
+  rcu_read_lock();
+  schedule_t *s = rcu_dereference(board_rcu);
+  int torn = 0, first = INT_MAX;
+  for (int i = 0; i < NUM_SESSIONS; i++) {
+    if (s->sessions[i].version != s->version) torn = 1;
+    if (s->sessions[i].start_min < first) first = s->sessions[i].start_min;
+  }
+  LOG("Attendee#%ld reads schedule v%d (first session at +%d min)", id, s->version, first);
+  jitter_us(200, 800);
+  rcu_read_unlock();
+  if (torn) {
+    pthread_mutex_lock(&instrumentation_mutex);
+    violation_count++;
+    pthread_mutex_unlock(&instrumentation_mutex);
+  }
+}
+
+/* Copy, edit, publish; the old version is freed once no attendee holds it */
+static void update_rcu(long id) {
+  pthread_mutex_lock(&board_edit);
+  pthread_mutex_lock(&instrumentation_mutex);
+  writers_in_cs++;
+  if (writers_in_cs > 1) violation_count++;
+  pthread_mutex_unlock(&instrumentation_mutex);
+  schedule_t *old = atomic_load_explicit(&board_rcu, memory_order_relaxed);
+  schedule_t *s = malloc(sizeof(*s));
+  if (!s) DIE("malloc schedule");
+  *s = *old;
+  int v = ++schedule_version;
+  s->version = v;
+  session_t *moved = &s->sessions[v % NUM_SESSIONS];
+  moved->start_min += 30;
+  moved->room = (moved->room + 1) % NUM_ROOMS;
+  for (int i = 0; i < NUM_SESSIONS; i++) s->sessions[i].version = v;
+  rcu_publish(board_rcu, s);
+  LOG("Organizer#%ld updates schedule to v%d (%s moved to room %d)", id, v, moved->title, moved->room);
+  jitter_us(200, 800);
+  pthread_mutex_lock(&instrumentation_mutex);
+  writers_in_cs--;
+  pthread_mutex_unlock(&instrumentation_mutex);
+  pthread_mutex_unlock(&board_edit);
+  rcu_retire(old, free);
+}
+
+static schedule_t* initial_schedule(void) {
+  schedule_t *s = malloc(sizeof(*s));
+  if (!s) DIE("malloc schedule");
+  s->version = schedule_version;
+  for (int i = 0; i < NUM_SESSIONS; i++) {
+    session_t *e = &s->sessions[i];
+    e->start_min = 60 * (i / NUM_ROOMS);
+    e->room = i % NUM_ROOMS;
+    e->version = s->version;
+    snprintf(e->title, sizeof(e->title), "Session %d", i + 1);
+  }
+  return s;
+}
+
 static void* reader(void* arg) {
   long id = (long)arg;
+  int retries = 0;
+  rng_thread(id);
   for (int k=0;k<5;k++) {
     jitter_us(500, 4000);
+    if (board_mode == BOARD_SEQLOCK) { retries += read_seqlock(id); continue; }
+    if (board_mode == BOARD_RCU) { read_rcu(id); continue; }
     rw_rlock(&board);
     pthread_mutex_lock(&instrumentation_mutex);
     readers_in_cs++;
@@ -118,37 +1194,85 @@ static void* reader(void* arg) {
     pthread_mutex_unlock(&instrumentation_mutex);
     rw_runlock(&board);
   }
+  if (retries) atomic_fetch_add(&read_retries, retries);
   return NULL;
 }
 
+/* One organizer update, run with the board write-locked; under
+ * BOARD_COMBINE possibly by another organizer, as part of its batch */
+static void update_board(void *arg) {
+  long id = (long)arg;
+  pthread_mutex_lock(&instrumentation_mutex);
+  writers_in_cs++;
+  if (writers_in_cs > 1 || readers_in_cs > 0) violation_count++;
+  pthread_mutex_unlock(&instrumentation_mutex);
+  int v = ++schedule_version;
+  LOG("Organizer#%ld updates schedule to v%d", id, v);
+  jitter_us(200, 800);
+  pthread_mutex_lock(&instrumentation_mutex);
+  writers_in_cs--;
+  pthread_mutex_unlock(&instrumentation_mutex);
+}
+
 static void* writer(void* arg) {
   long id = (long)arg;
+  rng_thread(NUM_BOARD_READERS + id);
   for (int k=0;k<3;k++) {
     jitter_us(2000, 6000);
+    if (board_mode == BOARD_RCU) { update_rcu(id); continue; }
+    if (board_mode == BOARD_SEQLOCK) { update_seqlock(id); continue; }
+    if (board_mode == BOARD_COMBINE) {
+      if (rw_combine(&board, update_board, arg) > 1) atomic_fetch_add(&combined_batches, 1);
+      continue;
+    }
     rw_wlock(&board);
-    pthread_mutex_lock(&instrumentation_mutex);
-    writers_in_cs++;
-    if (writers_in_cs > 1 || readers_in_cs > 0) violation_count++;
-    pthread_mutex_unlock(&instrumentation_mutex);
-    schedule_version++;
-    LOG("Organizer#%ld updates schedule to v%d", id, schedule_version);
-    jitter_us(200, 800);
-    pthread_mutex_lock(&instrumentation_mutex);
-    writers_in_cs--;
-    pthread_mutex_unlock(&instrumentation_mutex);
+    update_board(arg);
     rw_wunlock(&board);
   }
   return NULL;
 }
 
 int schedule_run(void) {
-  rw_init(&board);
-  pthread_t readers[8], writers[2];
-  for (long i=0;i<8;i++) readers[i] = spawn(reader, (void*)i, "reader");
-  for (long i=0;i<2;i++) writers[i] = spawn(writer, (void*)i, "writer");
-  for (int i=0;i<8;i++) join(readers[i]);
-  for (int i=0;i<2;i++) join(writers[i]);
-  rw_destroy(&board);
+  return schedule_run_engine("sem");
+}
+
+/* Same run on another rwlock_t engine (see rw_init_engine), or lock-free
+ * readers: "seqlock" (optimistic copy of the version) or "rcu" (traversal
+ * of a copy-on-write schedule_t), or "combine" (default engine, organizers
+ * go through rw_combine) */
+int schedule_run_engine(const char *engine) {
+  if (strcmp(engine, "combine") == 0) {
+    board_mode = BOARD_COMBINE;
+    if (rw_init(&board)) DIE("rw_init");
+  } else if (strcmp(engine, "seqlock") == 0) {
+    board_mode = BOARD_SEQLOCK;
+    seq_init(&board_seq);
+  } else if (strcmp(engine, "rcu") == 0) {
+    board_mode = BOARD_RCU;
+    atomic_store(&board_rcu, initial_schedule());
+  } else {
+    board_mode = BOARD_RWLOCK;
+    if (rw_init_engine(&board, engine)) DIE("rw_init");
+  }
+  LOG("Schedule board engine: %s", engine);
+
+  task_t *readers[NUM_BOARD_READERS], *writers[NUM_BOARD_WRITERS];
+  for (long i=0;i<NUM_BOARD_READERS;i++) readers[i] = actor_spawn(reader, (void*)i, "reader");
+  for (long i=0;i<NUM_BOARD_WRITERS;i++) writers[i] = actor_spawn(writer, (void*)i, "writer");
+  for (int i=0;i<NUM_BOARD_READERS;i++) actor_join(readers[i]);
+  for (int i=0;i<NUM_BOARD_WRITERS;i++) actor_join(writers[i]);
+  if (board_mode == BOARD_SEQLOCK) {
+    LOG("Schedule reads retried after a concurrent update: %d", atomic_load(&read_retries));
+    seq_destroy(&board_seq);
+  } else if (board_mode == BOARD_RCU) {
+    LOG("Old schedule versions still waiting for readers: %lu", rcu_pending());
+    rcu_synchronize();
+    free(rcu_publish(board_rcu, NULL));
+  } else {
+    if (board_mode == BOARD_COMBINE)
+      LOG("Write sections that applied several organizers' updates: %d", atomic_load(&combined_batches));
+    rw_destroy(&board);
+  }
   LOG("Schedule (readers–writers) complete.");
   return 0;
 }
@@ -1,77 +1,2769 @@
 #define _XOPEN_SOURCE 700
 #include <unistd.h>
 #include "sync_utils.h"
-#include <sys/time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <errno.h>
+#include <limits.h>
 #include <string.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
 
 int usleep(unsigned int usec);
+long syscall(long number, ...);
+uint64_t mono_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+struct timespec deadline_in_ms(int ms) {
+  uint64_t ns = mono_ns() + (int64_t)ms * 1000000;
+  return (struct timespec){ .tv_sec = ns / 1000000000ULL, .tv_nsec = ns % 1000000000ULL };
+}
+
 uint64_t now_ms(void) {
-  struct timeval tv; gettimeofday(&tv, NULL);
-  return (uint64_t)tv.tv_sec * 1000ULL + tv.tv_usec / 1000ULL;
+  return now_ns() / 1000000ULL;
+}
+
+/* ------- TSC clock (now_ns_use_tsc) -------
+ * The CPU must report an invariant TSC (constant rate, ticking in deep
+ * C-states). The rate is measured against CLOCK_MONOTONIC over two
+ * consecutive windows, which must agree: a TSC that drifts, or a VM that
+ * steals time mid-window, leaves now_ns on CLOCK_MONOTONIC. */
+#define TSC_WINDOW_MS  10
+#define TSC_TOLERANCE  1000   // Windows must agree to 1/TSC_TOLERANCE
+
+now_tsc_t now_tsc;
+
+#if defined(__x86_64__)
+static bool tsc_invariant(void) {
+  unsigned a, b, c, d;
+  if (!__get_cpuid(0x80000000, &a, &b, &c, &d) || a < 0x80000007) return false;
+  __get_cpuid(0x80000007, &a, &b, &c, &d);
+  return d & (1u << 8);
+}
+
+/* The TSC read between two clock reads that are closest together */
+static void tsc_sample(uint64_t *ns, uint64_t *tsc) {
+  uint64_t best = UINT64_MAX;
+  for (int i = 0; i < 5; i++) {
+    uint64_t a = mono_ns(), t = __builtin_ia32_rdtsc(), b = mono_ns();
+    if (b - a < best) {
+      best = b - a;
+      *ns = a + (b - a) / 2;
+      *tsc = t;
+    }
+  }
+}
+#endif
+
+int now_ns_use_tsc(bool on) {
+  if (!on) {
+    atomic_store(&now_tsc.on, 0);
+    return 0;
+  }
+#if defined(__x86_64__)
+  if (!tsc_invariant()) return -1;
+  uint64_t ns[3], tsc[3];
+  for (int i = 0; i < 3; i++) {
+    if (i) usleep(TSC_WINDOW_MS * 1000);
+    tsc_sample(&ns[i], &tsc[i]);
+  }
+  double r1 = (double)(tsc[1] - tsc[0]) / (ns[1] - ns[0]);
+  double r2 = (double)(tsc[2] - tsc[1]) / (ns[2] - ns[1]);
+  if (r1 <= 0 || (r1 > r2 ? r1 - r2 : r2 - r1) * TSC_TOLERANCE > r1) return -1;
+  atomic_store(&now_tsc.on, 0);
+  now_tsc.mult = (uint64_t)(((unsigned __int128)(ns[2] - ns[0]) << 32) / (tsc[2] - tsc[0]));
+  now_tsc.base_tsc = tsc[2];
+  now_tsc.base_ns = ns[2];
+  atomic_store_explicit(&now_tsc.on, 1, memory_order_release);
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+__attribute__((constructor)) static void now_ns_init(void) {
+  const char *clock = getenv("SYNC_CLOCK");
+  if (clock && strcmp(clock, "tsc") == 0 && now_ns_use_tsc(true))
+    fprintf(stderr, "SYNC_CLOCK=tsc: no steady invariant TSC, using CLOCK_MONOTONIC\n");
+}
+
+/* ------- Thread names and CPU placement ------- */
+/* The CPUs we may run on are read once (the process mask at first use)
+ * and ordered for compact and scatter by the package and core ids in
+ * sysfs. A thread pins itself before running fn, so it never runs on
+ * another CPU first. */
+#define AFFINITY_MAX_CPUS  1024
+#define AFFINITY_MAX_NAMES 32       // Names with their own count and policy
+#define AFFINITY_LIST_MAX  64       // CPUs in an explicit list
+#define THREAD_NAME_MAX    16       // Kernel limit, with the NUL
+
+enum { PLACE_NONE, PLACE_COMPACT, PLACE_SCATTER, PLACE_LIST };
+
+typedef struct {
+  int mode;                         // PLACE_*
+  int ncpus;                        // PLACE_LIST
+  short cpu[AFFINITY_LIST_MAX];
+} placement_t;
+
+typedef struct {
+  char name[THREAD_NAME_MAX];
+  int next;                         // k of the next thread spawned under it
+  bool own;                         // Has its own policy
+  placement_t place;
+} spawn_name_t;
+
+typedef struct {
+  thread_fn fn;
+  void *arg;
+  char name[THREAD_NAME_MAX];
+  int cpu;                          // -1: not pinned
+} spawn_start_t;
+
+int pthread_setname_np(pthread_t thread, const char *name);
+
+static spawn_name_t spawn_names[AFFINITY_MAX_NAMES];   // Under spawn_m
+static int spawn_nnames;
+static placement_t place_default;
+static pthread_mutex_t spawn_m = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t cpus_once = PTHREAD_ONCE_INIT;
+static unsigned long cpus_allowed[AFFINITY_MAX_CPUS / (8 * sizeof(long))];
+static short cpus_compact[AFFINITY_MAX_CPUS], cpus_scatter[AFFINITY_MAX_CPUS];
+static int cpus_n;
+
+typedef struct {
+  int cpu, package, core;
+  int sibling;                      // Rank among the allowed CPUs of its core
+  int core_rank;                    // Rank of its core within the package
+} cpu_place_t;
+
+static bool cpu_allowed(int cpu) {
+  return cpu >= 0 && cpu < AFFINITY_MAX_CPUS &&
+         (cpus_allowed[cpu / (8 * sizeof(long))] >> (cpu % (8 * sizeof(long))) & 1);
+}
+
+static int cpu_topology(int cpu, const char *what) {
+  char path[96];
+  int id = -1;
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, what);
+  FILE *f = fopen(path, "r");
+  if (f) {
+    if (fscanf(f, "%d", &id) != 1) id = -1;
+    fclose(f);
+  }
+  return id;
+}
+
+static int by_compact(const void *a, const void *b) {
+  const cpu_place_t *x = a, *y = b;
+  if (x->package != y->package) return x->package - y->package;
+  if (x->core != y->core) return x->core - y->core;
+  return x->cpu - y->cpu;
+}
+
+static int by_scatter(const void *a, const void *b) {
+  const cpu_place_t *x = a, *y = b;
+  if (x->sibling != y->sibling) return x->sibling - y->sibling;
+  if (x->core_rank != y->core_rank) return x->core_rank - y->core_rank;
+  if (x->package != y->package) return x->package - y->package;
+  return x->cpu - y->cpu;
+}
+
+static void cpus_setup(void) {
+  static cpu_place_t p[AFFINITY_MAX_CPUS];
+  if (syscall(SYS_sched_getaffinity, 0, sizeof(cpus_allowed), cpus_allowed) < 0) {
+    cpus_allowed[0] = 1;            // Can't tell: CPU 0 only
+  }
+  for (int cpu = 0; cpu < AFFINITY_MAX_CPUS; cpu++) {
+    if (!cpu_allowed(cpu)) continue;
+    int package = cpu_topology(cpu, "physical_package_id"), core = cpu_topology(cpu, "core_id");
+    p[cpus_n++] = (cpu_place_t){ cpu, package < 0 ? 0 : package, core < 0 ? cpu : core, 0, 0 };
+  }
+  for (int i = 0; i < cpus_n; i++) {
+    for (int j = 0; j < cpus_n; j++)
+      p[i].sibling += p[j].package == p[i].package && p[j].core == p[i].core && p[j].cpu < p[i].cpu;
+  }
+  /* Each smaller core of the package counted once, through its first sibling */
+  for (int i = 0; i < cpus_n; i++) {
+    for (int j = 0; j < cpus_n; j++)
+      p[i].core_rank += p[j].package == p[i].package && p[j].core < p[i].core && p[j].sibling == 0;
+  }
+  qsort(p, cpus_n, sizeof(p[0]), by_compact);
+  for (int i = 0; i < cpus_n; i++) cpus_compact[i] = p[i].cpu;
+  qsort(p, cpus_n, sizeof(p[0]), by_scatter);
+  for (int i = 0; i < cpus_n; i++) cpus_scatter[i] = p[i].cpu;
+}
+
+static int placement_parse(placement_t *p, const char *s) {
+  pthread_once(&cpus_once, cpus_setup);
+  memset(p, 0, sizeof(*p));
+  if (strcmp(s, "none") == 0) return 0;
+  if (strcmp(s, "compact") == 0) {
+    p->mode = PLACE_COMPACT;
+    return 0;
+  }
+  if (strcmp(s, "scatter") == 0) {
+    p->mode = PLACE_SCATTER;
+    return 0;
+  }
+  p->mode = PLACE_LIST;
+  for (;;) {
+    char *end;
+    long lo = strtol(s, &end, 10), hi = lo;
+    if (end == s) return -1;
+    if (*end == '-') {
+      s = end + 1;
+      hi = strtol(s, &end, 10);
+      if (end == s || hi < lo) return -1;
+    }
+    for (long cpu = lo; cpu <= hi; cpu++) {
+      if (!cpu_allowed(cpu) || p->ncpus == AFFINITY_LIST_MAX) return -1;
+      p->cpu[p->ncpus++] = cpu;
+    }
+    if (*end == '\0') return 0;
+    if (*end != ',') return -1;
+    s = end + 1;
+  }
+}
+
+static int placement_cpu(const placement_t *p, int k) {
+  switch (p->mode) {
+  case PLACE_COMPACT: return cpus_compact[k % cpus_n];
+  case PLACE_SCATTER: return cpus_scatter[k % cpus_n];
+  case PLACE_LIST:    return p->cpu[k % p->ncpus];
+  default:            return -1;
+  }
+}
+
+/* Under spawn_m; NULL once the table is full */
+static spawn_name_t* spawn_name(const char *name, bool add) {
+  for (int i = 0; i < spawn_nnames; i++) {
+    if (strncmp(spawn_names[i].name, name, THREAD_NAME_MAX - 1) == 0) return &spawn_names[i];
+  }
+  if (!add || spawn_nnames == AFFINITY_MAX_NAMES) return NULL;
+  spawn_name_t *n = &spawn_names[spawn_nnames++];
+  snprintf(n->name, sizeof(n->name), "%s", name);
+  return n;
+}
+
+int affinity_set(const char *name, const char *policy) {
+  placement_t p;
+  if (placement_parse(&p, policy)) return -1;
+  pthread_mutex_lock(&spawn_m);
+  spawn_name_t *n = name ? spawn_name(name, true) : NULL;
+  if (n) {
+    n->place = p;
+    n->own = true;
+    n->next = 0;
+  } else if (!name) {
+    place_default = p;
+  }
+  pthread_mutex_unlock(&spawn_m);
+  return name && !n ? -1 : 0;
+}
+
+int affinity_config(const char *spec) {
+  char buf[512], *save, *item;
+  if (snprintf(buf, sizeof(buf), "%s", spec) >= (int)sizeof(buf)) return -1;
+  for (item = strtok_r(buf, ";", &save); item; item = strtok_r(NULL, ";", &save)) {
+    char *eq = strchr(item, '=');
+    if (eq) *eq = '\0';
+    if (affinity_set(eq ? item : NULL, eq ? eq + 1 : item)) return -1;
+  }
+  return 0;
+}
+
+int affinity_cpu(const char *name, int k) {
+  pthread_mutex_lock(&spawn_m);
+  spawn_name_t *n = spawn_name(name, false);
+  int cpu = placement_cpu(n && n->own ? &n->place : &place_default, k);
+  pthread_mutex_unlock(&spawn_m);
+  return cpu;
+}
+
+__attribute__((constructor)) static void affinity_init(void) {
+  const char *spec = getenv("SYNC_AFFINITY");
+  if (spec && *spec && affinity_config(spec))
+    fprintf(stderr, "SYNC_AFFINITY=%s: bad policy or CPU not allowed, placement partly applied\n", spec);
+}
+
+static void* spawn_main(void *arg) {
+  spawn_start_t s = *(spawn_start_t*)arg;
+  free(arg);
+  pthread_setname_np(pthread_self(), s.name);
+  if (s.cpu >= 0) {
+    unsigned long mask[AFFINITY_MAX_CPUS / (8 * sizeof(long))] = { 0 };
+    mask[s.cpu / (8 * sizeof(long))] = 1UL << (s.cpu % (8 * sizeof(long)));
+    syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask);
+  }
+  return s.fn(s.arg);
+}
+
+/* pthread_create under spawn's naming and placement */
+static int spawn_thread(pthread_t *t, const pthread_attr_t *attr, thread_fn fn, void *arg, const char *name) {
+  spawn_start_t *s = malloc(sizeof(*s));
+  if (!s) return -1;
+  if (!name) name = "thread";
+  pthread_mutex_lock(&spawn_m);
+  spawn_name_t *n = spawn_name(name, true);
+  int k = n ? n->next++ : 0;
+  s->cpu = placement_cpu(n && n->own ? &n->place : &place_default, k);
+  pthread_mutex_unlock(&spawn_m);
+  s->fn = fn;
+  s->arg = arg;
+  char suffix[THREAD_NAME_MAX];
+  int len = snprintf(suffix, sizeof(suffix), "-%d", k);
+  int keep = strlen(name) < (size_t)(THREAD_NAME_MAX - 1 - len) ? (int)strlen(name) : THREAD_NAME_MAX - 1 - len;
+  memcpy(s->name, name, keep);
+  memcpy(s->name + keep, suffix, len + 1);
+  if (pthread_create(t, attr, spawn_main, s)) {
+    free(s);
+    return -1;
+  }
+  return 0;
+}
+
+pthread_t spawn(thread_fn fn, void *arg, const char *name) {
+  pthread_t t;
+  if (spawn_thread(&t, NULL, fn, arg, name)) DIE("pthread_create");
+  return t;
+}
+void join(pthread_t t) { if (pthread_join(t, NULL)) DIE("pthread_join"); }
+
+/* ------- Per-thread PRNG ------- */
+/* splitmix64 expands (master seed, stream) into the 256-bit xoshiro state;
+ * rng_gen tells a thread that rng_seed ran since it last seeded */
+static _Atomic uint64_t rng_master_seed = RNG_DEFAULT_SEED;
+static atomic_uint rng_gen;
+static atomic_ulong rng_streams;            // Streams handed out so far
+typedef struct {
+  uint64_t s[4];
+  unsigned gen;
+  int64_t stream;                           // -1 until picked or handed out
+  bool seeded;
+} rng_state_t;
+static _Thread_local rng_state_t rng = { .stream = -1 };
+
+static uint64_t splitmix64(uint64_t *x) {
+  uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+static inline uint64_t rotl64(uint64_t x, int k) {
+  return (x << k) | (x >> (64 - k));
+}
+
+void rng_seed(uint64_t master) {
+  atomic_store(&rng_master_seed, master);
+  atomic_fetch_add(&rng_gen, 1);
+}
+
+uint64_t rng_master(void) {
+  return atomic_load(&rng_master_seed);
+}
+
+void rng_thread(int stream) {
+  rng.stream = stream < 0 ? -1 : stream;
+  rng.seeded = false;
+}
+
+uint64_t rng_next(void) {
+  uint64_t *s = rng.s;
+  unsigned gen = atomic_load_explicit(&rng_gen, memory_order_relaxed);
+  if (!rng.seeded || rng.gen != gen) {
+    if (rng.stream < 0)
+      rng.stream = (int64_t)(RNG_AUTO_STREAMS + atomic_fetch_add_explicit(&rng_streams, 1, memory_order_relaxed));
+    uint64_t n = (uint64_t)rng.stream, x = rng_master() ^ splitmix64(&n);
+    for (int i = 0; i < 4; i++) s[i] = splitmix64(&x);
+    rng.gen = gen;
+    rng.seeded = true;
+  }
+  uint64_t result = rotl64(s[1] * 5, 7) * 9, t = s[1] << 17;
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rotl64(s[3], 45);
+  return result;
+}
+
+/* Multiply-shift on the high half: no division, bias below 2^-32 */
+uint32_t rng_below(uint32_t n) {
+  return (uint32_t)(((rng_next() >> 32) * n) >> 32);
+}
+
+__attribute__((constructor)) static void rng_init(void) {
+  const char *seed = getenv("SYNC_SEED");
+  if (seed && *seed) rng_seed(strtoull(seed, NULL, 0));
+}
+
+void jitter_us(int min_us, int max_us) {
+  int span = (max_us > min_us) ? (max_us - min_us) : 1;
+  usleep(min_us + rng_below(span));
+}
+
+/* ------- Futex helpers ------- */
+int futex_wait(atomic_uint *word, unsigned val, const struct timespec *deadline) {
+  if (syscall(SYS_futex, word, FUTEX_WAIT_BITSET_PRIVATE, val, deadline, NULL,
+              FUTEX_BITSET_MATCH_ANY) == -1 && errno == ETIMEDOUT)
+    return -1;
+  return 0;
+}
+
+void futex_wake(atomic_uint *word, int n) {
+  syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+/* ------- Asynchronous logging ------- */
+/* Each thread owns a single-producer ring of formatted lines; the drainer
+ * (the flusher thread, or log_flush) is its only consumer, serialized by
+ * log_drain_m. A thread only makes a syscall when its ring is half full
+ * (kicking the flusher) or full (sleeping on tail until it is drained). */
+#define LOG_RING_SLOTS 256     // Lines per thread
+#define LOG_FLUSH_MS   50      // Flusher period when nobody kicks it
+#define LOG_BATCH      65536   // Bytes per fwrite
+
+typedef struct {
+  uint64_t ns;                 // now_ns at the call, for merging rings
+  unsigned len;
+  char text[LOG_LINE_MAX];
+} log_line_t;
+
+typedef struct log_ring {
+  _Alignas(64) atomic_uint head;   // Next line to fill (owner)
+  _Alignas(64) atomic_uint tail;   // Next line to write out (drainer); the owner sleeps on it when full
+  atomic_int stalled;              // Owner is sleeping on tail
+  atomic_int writing;              // Owner saw log_on and has not published its line yet
+  atomic_int dead;                 // Owner exited: freed once drained
+  unsigned pos, end;               // Drainer's cursor and snapshot of head
+  struct log_ring *next;
+  log_line_t line[LOG_RING_SLOTS];
+} log_ring_t;
+
+static atomic_int log_on;
+static atomic_int log_stopping;
+static atomic_uint log_kick;                 // Flusher sleeps on it
+static pthread_t log_flusher;
+static FILE *log_out;                        // Under log_drain_m; NULL is stdout
+static log_ring_t *log_rings;                // Under log_m (new rings go in front)
+static pthread_mutex_t log_m = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t log_drain_m = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t log_key;                // Marks a thread's ring dead at exit
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+static _Thread_local log_ring_t *my_ring;
+static char log_batch[LOG_BATCH];            // Under log_drain_m
+
+static void log_ring_exit(void *ring) {
+  atomic_store(&((log_ring_t*)ring)->dead, 1);
+}
+
+static void log_setup(void) {
+  pthread_key_create(&log_key, log_ring_exit);
+  atexit(log_async_stop);
+}
+
+static log_ring_t* log_ring(void) {
+  if (my_ring) return my_ring;
+  void *mem;
+  if (posix_memalign(&mem, _Alignof(log_ring_t), sizeof(log_ring_t))) return NULL;
+  log_ring_t *r = mem;
+  memset(r, 0, sizeof(*r));
+  pthread_mutex_lock(&log_m);
+  r->next = log_rings;
+  log_rings = r;
+  pthread_mutex_unlock(&log_m);
+  pthread_setspecific(log_key, r);
+  return my_ring = r;
+}
+
+static void log_kick_flusher(void) {
+  atomic_fetch_add(&log_kick, 1);
+  futex_wake(&log_kick, 1);
+}
+
+void log_printf(const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  log_ring_t *r = atomic_load_explicit(&log_on, memory_order_acquire) ? log_ring() : NULL;
+  /* writing before the second look at log_on, as log_async_stop clears
+   * log_on before checking writing: one of the two sees the other */
+  if (r) {
+    atomic_store(&r->writing, 1);
+    if (!atomic_load(&log_on)) {
+      atomic_store(&r->writing, 0);
+      r = NULL;
+    }
+  }
+  if (!r) {
+    vfprintf(stdout, fmt, ap);
+    fflush(stdout);
+    va_end(ap);
+    return;
+  }
+  uint64_t ns = now_ns();
+  unsigned h = atomic_load_explicit(&r->head, memory_order_relaxed);
+  while (h - atomic_load(&r->tail) == LOG_RING_SLOTS) {
+    /* Full: with the flusher gone (log_async_stop racing) drain it here */
+    if (!atomic_load(&log_on)) {
+      log_flush();
+      continue;
+    }
+    /* stalled before re-reading tail, as the drainer stores tail before
+     * reading stalled: one of the two sees the other */
+    atomic_store(&r->stalled, 1);
+    log_kick_flusher();
+    unsigned t = atomic_load(&r->tail);
+    if (h - t == LOG_RING_SLOTS) futex_wait(&r->tail, t, NULL);
+    atomic_store(&r->stalled, 0);
+  }
+  log_line_t *l = &r->line[h % LOG_RING_SLOTS];
+  int n = vsnprintf(l->text, LOG_LINE_MAX, fmt, ap);
+  va_end(ap);
+  if (n < 0) n = 0;
+  if (n >= LOG_LINE_MAX) {
+    n = LOG_LINE_MAX - 1;
+    l->text[n - 1] = '\n';
+  }
+  l->len = n;
+  l->ns = ns;
+  atomic_store_explicit(&r->head, h + 1, memory_order_release);
+  atomic_store_explicit(&r->writing, 0, memory_order_release);
+  if (h + 1 - atomic_load_explicit(&r->tail, memory_order_relaxed) == LOG_RING_SLOTS / 2)
+    log_kick_flusher();
+}
+
+/* Writes out what every ring holds now, oldest line first across rings,
+ * then frees the rings of exited threads that are drained */
+void log_flush(void) {
+  pthread_mutex_lock(&log_drain_m);
+  FILE *out = log_out ? log_out : stdout;
+  pthread_mutex_lock(&log_m);
+  log_ring_t *first = log_rings;
+  pthread_mutex_unlock(&log_m);
+  for (log_ring_t *r = first; r; r = r->next) {
+    r->pos = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    r->end = atomic_load_explicit(&r->head, memory_order_acquire);
+  }
+  size_t used = 0;
+  for (;;) {
+    log_ring_t *next = NULL;
+    for (log_ring_t *r = first; r; r = r->next) {
+      if (r->pos != r->end &&
+          (!next || r->line[r->pos % LOG_RING_SLOTS].ns < next->line[next->pos % LOG_RING_SLOTS].ns))
+        next = r;
+    }
+    if (!next) break;
+    log_line_t *l = &next->line[next->pos++ % LOG_RING_SLOTS];
+    if (used + l->len > LOG_BATCH) {
+      fwrite(log_batch, 1, used, out);
+      used = 0;
+    }
+    memcpy(log_batch + used, l->text, l->len);
+    used += l->len;
+  }
+  fwrite(log_batch, 1, used, out);
+  fflush(out);
+  for (log_ring_t *r = first; r; r = r->next) {
+    if (r->pos == atomic_load_explicit(&r->tail, memory_order_relaxed)) continue;
+    atomic_store(&r->tail, r->pos);
+    if (atomic_load(&r->stalled)) futex_wake(&r->tail, 1);
+  }
+  pthread_mutex_lock(&log_m);
+  for (log_ring_t **p = &log_rings; *p; ) {
+    log_ring_t *r = *p;
+    if (atomic_load(&r->dead) && atomic_load(&r->tail) == atomic_load(&r->head)) {
+      *p = r->next;
+      free(r);
+    } else {
+      p = &r->next;
+    }
+  }
+  pthread_mutex_unlock(&log_m);
+  pthread_mutex_unlock(&log_drain_m);
+}
+
+static void* log_flusher_main(void *arg) {
+  (void)arg;
+  while (!atomic_load(&log_stopping)) {
+    /* seen before draining: a kick during the drain means drain again */
+    unsigned seen = atomic_load(&log_kick);
+    log_flush();
+    struct timespec deadline = deadline_in_ms(LOG_FLUSH_MS);
+    if (!atomic_load(&log_stopping)) futex_wait(&log_kick, seen, &deadline);
+  }
+  return NULL;
+}
+
+int log_async_start(const char *path) {
+  pthread_once(&log_once, log_setup);
+  if (atomic_load(&log_on)) return -1;
+  FILE *out = stdout;
+  if (path && !(out = fopen(path, "w"))) return -1;
+  fflush(stdout);   // Direct writes so far come first
+  pthread_mutex_lock(&log_drain_m);
+  log_out = out;
+  pthread_mutex_unlock(&log_drain_m);
+  atomic_store(&log_stopping, 0);
+  if (pthread_create(&log_flusher, NULL, log_flusher_main, NULL)) {
+    if (out != stdout) fclose(out);
+    log_out = NULL;
+    return -1;
+  }
+  atomic_store_explicit(&log_on, 1, memory_order_release);
+  return 0;
+}
+
+/* Some thread saw log_on before log_async_stop cleared it and may still
+ * publish a line into its ring */
+static bool log_writers_busy(void) {
+  bool busy = false;
+  pthread_mutex_lock(&log_m);
+  for (log_ring_t *r = log_rings; r && !busy; r = r->next) busy = atomic_load(&r->writing);
+  pthread_mutex_unlock(&log_m);
+  return busy;
+}
+
+void log_async_stop(void) {
+  if (!atomic_exchange(&log_on, 0)) return;
+  atomic_store(&log_stopping, 1);
+  log_kick_flusher();
+  pthread_join(log_flusher, NULL);
+  /* Drain until no writer is left in flight (draining also wakes one
+   * stalled on a full ring); every later LOG writes directly */
+  for (;;) {
+    bool busy = log_writers_busy();
+    log_flush();
+    if (!busy) break;
+    sched_yield();
+  }
+  pthread_mutex_lock(&log_drain_m);
+  if (log_out != stdout) fclose(log_out);
+  log_out = NULL;
+  pthread_mutex_unlock(&log_drain_m);
+}
+
+/* ------- Thread pool (work-stealing deques) ------- */
+/* Deques are Chase-Lev rings of fixed size: the owner pushes and pops at
+ * bottom without a CAS unless it races a thief for the last task; a full
+ * deque overflows into the shared queue. pending counts tasks queued and
+ * not yet taken: an idle worker announces itself in sleepers before its
+ * last look at pending and a submitter reads sleepers after bumping
+ * pending, so one of the two sees the other.
+ *
+ * Pooled actors run on fibers, each on a stack of its own. One that waits
+ * in park_wait (bb_t waits without a deadline, joins) parks: the fiber is
+ * switched out, its worker goes back to the pool, and park_wake queues it
+ * again, maybe for another worker. An actor blocked anywhere else keeps its
+ * worker, and may wait for actors that are only queued, so a worker is held
+ * for each actor from spawn until it parks or returns: spare counts the
+ * live workers nobody holds, and a spawn or wake-up that finds none adds a
+ * worker. Workers above the number asked for retire after POOL_RETIRE_MS
+ * idle; their slots are reused by the next worker added. */
+#define POOL_DEQUE_SLOTS 1024       // Power of two
+#define POOL_RETIRE_MS 100
+#define POOL_GROW_YIELDS 8          // Let holders park before adding a worker
+
+enum { TASK_QUEUED, TASK_DONE, TASK_WAITED };   // task_t.state
+enum { FIBER_RUNNING, FIBER_PARKING, FIBER_PARKED, FIBER_WOKEN };   // fiber_t.state
+enum { WORKER_RUNNING, WORKER_RETIRED, WORKER_EMPTY };   // pool_worker_t.state
+
+/* A pooled actor's stack and where it left off, from its first run until
+ * it returns. The stack follows the struct in the same block. */
+typedef struct {
+  ucontext_t ctx;
+  rng_state_t rng;              // The actor's draws, kept apart from its workers'
+  atomic_uint state;            // FIBER_*
+  atomic_uint *word;            // Parked on it (see park_wait)
+  task_t *next;                 // Park bucket link
+  bool finished;
+} fiber_t;
+
+struct task {
+  thread_fn fn;
+  void *arg;
+  void *result;
+  atomic_uint state;            // TASK_*; waiters sleep on it (see park_wait)
+  bool threaded;                // Actor on its own thread (joined, not waited)
+  pool_t *pool;                 // Pooled actor: the pool it runs on
+  bool held;                    // Pooled actor: counted out of pool->spare
+  fiber_t *fiber;               // Pooled actor, once it has run
+  pthread_t thread;
+  task_t *next;                 // Shared queue link
+};
+
+typedef struct {
+  _Alignas(64) atomic_long top;          // Thieves take here
+  _Alignas(64) atomic_long bottom;       // Owner pushes and pops here
+  _Atomic(task_t*) slot[POOL_DEQUE_SLOTS];
+} pool_deque_t;
+
+typedef struct {
+  pool_deque_t dq;
+  pool_t *pool;
+  pthread_t thread;
+  int state;                    // WORKER_*, under pool->m
+  ucontext_t home;              // Where the fiber it runs switches back to
+} pool_worker_t;
+
+struct pool {
+  pool_worker_t *worker[POOL_MAX_WORKERS];   // First nworkers published
+  atomic_int nworkers;          // Slots, retired workers' included
+  int base;                     // Workers asked for; only those above retire
+  atomic_int live;              // Workers not retired
+  atomic_int spare;             // Live workers no actor holds
+  atomic_int pending;           // Tasks queued, not yet taken
+  atomic_int sleepers;          // Idle workers on their way into futex_wait
+  atomic_uint wake;             // Idle workers sleep on it (futex word)
+  atomic_int stopping;
+  atomic_int shared;            // Tasks in the shared queue
+  pthread_mutex_t m;            // Shared queue; adding and retiring workers
+  task_t *head, *tail;
+};
+
+static _Thread_local pool_worker_t *pool_self;
+static _Thread_local task_t *fiber_self;   // Pooled actor running on this worker
+static _Atomic(pool_t*) actor_pool;
+
+static int deque_push(pool_deque_t *dq, task_t *t) {
+  long b = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+  long top = atomic_load_explicit(&dq->top, memory_order_acquire);
+  if (b - top >= POOL_DEQUE_SLOTS) return -1;
+  atomic_store_explicit(&dq->slot[b & (POOL_DEQUE_SLOTS - 1)], t, memory_order_relaxed);
+  atomic_store_explicit(&dq->bottom, b + 1, memory_order_release);
+  return 0;
+}
+
+static task_t* deque_pop(pool_deque_t *dq) {
+  long b = atomic_load_explicit(&dq->bottom, memory_order_relaxed) - 1;
+  atomic_store_explicit(&dq->bottom, b, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  long top = atomic_load_explicit(&dq->top, memory_order_relaxed);
+  if (top > b) {
+    atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+    return NULL;
+  }
+  task_t *t = atomic_load_explicit(&dq->slot[b & (POOL_DEQUE_SLOTS - 1)], memory_order_relaxed);
+  if (top == b) {
+    /* Last one: a thief may be taking it too */
+    if (!atomic_compare_exchange_strong_explicit(&dq->top, &top, top + 1,
+                                                 memory_order_seq_cst, memory_order_relaxed))
+      t = NULL;
+    atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+  }
+  return t;
+}
+
+static task_t* deque_steal(pool_deque_t *dq) {
+  long top = atomic_load_explicit(&dq->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  long b = atomic_load_explicit(&dq->bottom, memory_order_acquire);
+  if (top >= b) return NULL;
+  task_t *t = atomic_load_explicit(&dq->slot[top & (POOL_DEQUE_SLOTS - 1)], memory_order_relaxed);
+  if (!atomic_compare_exchange_strong_explicit(&dq->top, &top, top + 1,
+                                               memory_order_seq_cst, memory_order_relaxed))
+    return NULL;
+  return t;
+}
+
+/* Own deque, then the shared queue, then the other workers' deques from a
+ * random one on */
+static task_t* pool_take(pool_t *p) {
+  pool_worker_t *self = pool_self && pool_self->pool == p ? pool_self : NULL;
+  task_t *t = self ? deque_pop(&self->dq) : NULL;
+  if (!t && atomic_load_explicit(&p->shared, memory_order_relaxed) > 0) {
+    pthread_mutex_lock(&p->m);
+    if ((t = p->head) != NULL) {
+      if (!(p->head = t->next)) p->tail = NULL;
+      atomic_fetch_sub(&p->shared, 1);
+    }
+    pthread_mutex_unlock(&p->m);
+  }
+  int n = atomic_load_explicit(&p->nworkers, memory_order_acquire);
+  for (int i = 0, v = n > 1 ? rng_below(n) : 0; !t && i < n; i++, v = (v + 1) % n) {
+    if (p->worker[v] != self) t = deque_steal(&p->worker[v]->dq);
+  }
+  if (t) atomic_fetch_sub(&p->pending, 1);
+  return t;
+}
+
+static void pool_kick(pool_t *p) {
+  atomic_fetch_add(&p->wake, 1);
+  futex_wake(&p->wake, 1);
+}
+
+/* shared: past the caller's own deque, so that it won't pop t next */
+static void pool_push(pool_t *p, task_t *t, bool shared) {
+  if (shared || !pool_self || pool_self->pool != p || deque_push(&pool_self->dq, t)) {
+    t->next = NULL;
+    pthread_mutex_lock(&p->m);
+    if (p->tail) p->tail->next = t;
+    else p->head = t;
+    p->tail = t;
+    atomic_fetch_add(&p->shared, 1);
+    pthread_mutex_unlock(&p->m);
+  }
+  atomic_fetch_add(&p->pending, 1);
+  if (atomic_load(&p->sleepers) > 0) pool_kick(p);
+}
+
+static void pool_enqueue(pool_t *p, task_t *t) {
+  pool_push(p, t, false);
+}
+
+static void* pool_worker_main(void *arg);
+
+/* Under p->m: starts a worker, in a retired worker's slot if there is one,
+ * and counts it spare. -1 at POOL_MAX_WORKERS or if the thread can't be
+ * created. */
+static int pool_add_worker(pool_t *p) {
+  int n = atomic_load(&p->nworkers), i = 0;
+  while (i < n && p->worker[i]->state == WORKER_RUNNING) i++;
+  pool_worker_t *w;
+  if (i < n) {
+    w = p->worker[i];
+    if (w->state == WORKER_RETIRED) pthread_join(w->thread, NULL);   /* on its way out */
+    w->state = WORKER_EMPTY;
+  } else {
+    if (n == POOL_MAX_WORKERS) return -1;
+    void *mem;
+    if (posix_memalign(&mem, _Alignof(pool_worker_t), sizeof(pool_worker_t))) return -1;
+    w = mem;
+    memset(w, 0, sizeof(*w));
+    w->pool = p;
+    w->state = WORKER_EMPTY;
+    p->worker[n] = w;
+    atomic_store_explicit(&p->nworkers, n + 1, memory_order_release);
+  }
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, POOL_STACK_BYTES);
+  int rc = spawn_thread(&w->thread, &attr, pool_worker_main, w, "pool");
+  pthread_attr_destroy(&attr);
+  if (rc) {
+    if (i == n) {
+      /* Nobody can have stolen from an empty deque that never ran */
+      atomic_store(&p->nworkers, n);
+      free(w);
+    }
+    return -1;
+  }
+  w->state = WORKER_RUNNING;
+  atomic_fetch_add(&p->live, 1);
+  atomic_fetch_add(&p->spare, 1);
+  return 0;
+}
+
+static bool pool_take_spare(pool_t *p) {
+  int s = atomic_load(&p->spare);
+  while (s > 0) {
+    if (atomic_compare_exchange_weak(&p->spare, &s, s - 1)) return true;
+  }
+  return false;
+}
+
+/* Holds a worker for an actor about to be queued. With none spare it
+ * yields first, as holders that are about to park hand theirs back, then
+ * adds one; false at POOL_MAX_WORKERS. */
+static bool pool_hold_worker(pool_t *p) {
+  for (int i = 0; i < POOL_GROW_YIELDS; i++) {
+    if (pool_take_spare(p)) return true;
+    sched_yield();
+  }
+  bool ok = true;
+  pthread_mutex_lock(&p->m);
+  while (!pool_take_spare(p)) {
+    if (pool_add_worker(p)) {
+      ok = false;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&p->m);
+  return ok;
+}
+
+/* An idle worker above p->base leaves if nothing is queued and it isn't
+ * held. A push racing with us may have kicked us rather than another
+ * sleeper, so pass that on. */
+static bool pool_retire(pool_t *p, pool_worker_t *self) {
+  bool out = false;
+  pthread_mutex_lock(&p->m);
+  if (atomic_load(&p->live) > p->base && !atomic_load(&p->pending) &&
+      !atomic_load(&p->stopping) && pool_take_spare(p)) {
+    atomic_fetch_sub(&p->live, 1);
+    self->state = WORKER_RETIRED;
+    out = true;
+  }
+  pthread_mutex_unlock(&p->m);
+  if (out) {
+    atomic_fetch_sub(&p->sleepers, 1);
+    if (atomic_load(&p->pending) > 0) pool_kick(p);
+  }
+  return out;
+}
+
+/* ------- Parking ------- */
+/* Fibers parked on a futex word hang off the bucket its address hashes to.
+ * A parker counts itself in parked before it looks at the word under the
+ * bucket lock, and a waker changes the word before it reads parked, so
+ * one of the two sees the other and wakers skip the lock while nobody is
+ * parked. */
+#define PARK_BUCKETS 64
+
+typedef struct {
+  pthread_mutex_t m;
+  task_t *head;
+} park_bucket_t;
+
+static park_bucket_t park_table[PARK_BUCKETS];
+static atomic_int parked;
+
+__attribute__((constructor)) static void park_init(void) {
+  for (int i = 0; i < PARK_BUCKETS; i++) pthread_mutex_init(&park_table[i].m, NULL);
+}
+
+static park_bucket_t* park_bucket(atomic_uint *word) {
+  uintptr_t a = (uintptr_t)word;
+  return &park_table[((a >> 2) ^ (a >> 9)) % PARK_BUCKETS];
+}
+
+/* A fiber may go on on another thread after it parks: nothing may keep a
+ * thread-local address across the switch, so the functions here that read
+ * one are never inlined into their callers. */
+__attribute__((noinline)) static task_t* fiber_current(void) {
+  return fiber_self;
+}
+
+__attribute__((noinline)) static void fiber_leave(fiber_t *f) {
+  swapcontext(&f->ctx, &pool_self->home);
+}
+
+/* futex_wait in which a pooled actor parks instead of blocking its worker.
+ * Outside one, or with a deadline, it is futex_wait. */
+__attribute__((noinline)) static int park_wait(atomic_uint *word, unsigned val,
+                                               const struct timespec *deadline) {
+  task_t *t = deadline ? NULL : fiber_current();
+  if (!t) return futex_wait(word, val, deadline);
+  fiber_t *f = t->fiber;
+  park_bucket_t *b = park_bucket(word);
+  atomic_fetch_add(&parked, 1);
+  pthread_mutex_lock(&b->m);
+  if (atomic_load(word) != val) {
+    pthread_mutex_unlock(&b->m);
+    atomic_fetch_sub(&parked, 1);
+    return 0;
+  }
+  f->word = word;
+  f->next = b->head;
+  b->head = t;
+  atomic_store(&f->state, FIBER_PARKING);
+  pthread_mutex_unlock(&b->m);
+  fiber_leave(f);
+  return 0;
+}
+
+/* The worker has switched away from t, so it may run anywhere now; if
+ * it hasn't yet, it sees FIBER_WOKEN and switches straight back. A wake-up
+ * past POOL_MAX_WORKERS goes on the queue unheld. */
+static void fiber_unpark(task_t *t) {
+  if (atomic_exchange(&t->fiber->state, FIBER_WOKEN) == FIBER_PARKING) return;
+  t->held = pool_hold_worker(t->pool);
+  pool_enqueue(t->pool, t);
+}
+
+/* futex_wake that also wakes up to n actors parked on word */
+__attribute__((noinline)) static void park_wake(atomic_uint *word, int n) {
+  futex_wake(word, n);
+  atomic_thread_fence(memory_order_seq_cst);
+  if (!atomic_load_explicit(&parked, memory_order_relaxed)) return;
+  park_bucket_t *b = park_bucket(word);
+  task_t *woken = NULL;
+  pthread_mutex_lock(&b->m);
+  for (task_t **pp = &b->head; *pp && n > 0; ) {
+    task_t *t = *pp;
+    if (t->fiber->word != word) {
+      pp = &t->fiber->next;
+      continue;
+    }
+    *pp = t->fiber->next;
+    t->fiber->next = woken;
+    woken = t;
+    n--;
+    atomic_fetch_sub(&parked, 1);
+  }
+  pthread_mutex_unlock(&b->m);
+  while (woken) {
+    task_t *t = woken;
+    woken = t->fiber->next;
+    fiber_unpark(t);
+  }
+}
+
+static void task_finished(task_t *t) {
+  if (atomic_exchange(&t->state, TASK_DONE) == TASK_WAITED) park_wake(&t->state, INT_MAX);
+}
+
+static void task_run(task_t *t) {
+  t->result = t->fn(t->arg);
+  task_finished(t);
+}
+
+/* Entered on the actor's own stack the first time its worker switches to it */
+static void fiber_main(void) {
+  task_t *t = fiber_current();
+  t->result = t->fn(t->arg);
+  t->fiber->finished = true;
+  fiber_leave(t->fiber);
+}
+
+/* Runs a pooled actor on this worker until it parks or returns. The
+ * actor's draws come from its own rng state, not the worker's. */
+static void actor_run(pool_worker_t *self, task_t *t) {
+  fiber_t *f = t->fiber;
+  if (!f) {
+    void *mem;
+    if (posix_memalign(&mem, 64, sizeof(fiber_t) + ACTOR_STACK_BYTES)) DIE("actor stack");
+    f = t->fiber = mem;
+    memset(f, 0, sizeof(*f));
+    f->rng.stream = -1;
+    if (getcontext(&f->ctx)) DIE("getcontext");
+    f->ctx.uc_stack.ss_sp = f + 1;
+    f->ctx.uc_stack.ss_size = ACTOR_STACK_BYTES;
+    f->ctx.uc_link = NULL;
+    makecontext(&f->ctx, fiber_main, 0);
+  }
+  for (;;) {
+    atomic_store(&f->state, FIBER_RUNNING);
+    rng_state_t own = rng;
+    rng = f->rng;
+    fiber_self = t;
+    swapcontext(&self->home, &f->ctx);
+    fiber_self = NULL;
+    f->rng = rng;
+    rng = own;
+    if (f->finished) break;
+    /* Parking: once it is PARKED a waker may hold a worker for it again */
+    bool held = t->held;
+    t->held = false;
+    unsigned s = FIBER_PARKING;
+    if (atomic_compare_exchange_strong(&f->state, &s, FIBER_PARKED)) {
+      if (held) atomic_fetch_add(&t->pool->spare, 1);
+      return;
+    }
+    t->held = held;             /* woken before it was off its stack: run it on */
+  }
+  free(f);
+  t->fiber = NULL;
+  if (t->held) atomic_fetch_add(&t->pool->spare, 1);
+  task_finished(t);
+}
+
+static void* pool_worker_main(void *arg) {
+  pool_worker_t *self = arg;
+  pool_t *p = self->pool;
+  pool_self = self;
+  for (;;) {
+    task_t *t = pool_take(p);
+    if (t) {
+      if (t->pool) actor_run(self, t);
+      else task_run(t);
+      continue;
+    }
+    unsigned seen = atomic_load(&p->wake);
+    atomic_fetch_add(&p->sleepers, 1);
+    int pending = atomic_load(&p->pending);
+    if (pending == 0 && atomic_load(&p->stopping)) {
+      atomic_fetch_sub(&p->sleepers, 1);
+      break;
+    }
+    if (pending) {
+      cpu_relax();              // Being pushed or taken by someone else right now
+    } else if (atomic_load(&p->live) <= p->base) {
+      futex_wait(&p->wake, seen, NULL);
+    } else {
+      struct timespec deadline = deadline_in_ms(POOL_RETIRE_MS);
+      if (futex_wait(&p->wake, seen, &deadline) && pool_retire(p, self)) break;
+    }
+    atomic_fetch_sub(&p->sleepers, 1);
+  }
+  return NULL;
+}
+
+pool_t* pool_create(int workers) {
+  if (workers <= 0) workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (workers > POOL_MAX_WORKERS) workers = POOL_MAX_WORKERS;
+  pool_t *p = calloc(1, sizeof(*p));
+  if (!p) return NULL;
+  p->base = workers;
+  pthread_mutex_init(&p->m, NULL);
+  pthread_mutex_lock(&p->m);
+  for (int i = 0; i < workers; i++) {
+    if (pool_add_worker(p)) {
+      pthread_mutex_unlock(&p->m);
+      pool_destroy(p);
+      return NULL;
+    }
+  }
+  pthread_mutex_unlock(&p->m);
+  return p;
+}
+
+void pool_destroy(pool_t *p) {
+  if (!p) return;
+  pool_t *expect = p;
+  atomic_compare_exchange_strong(&actor_pool, &expect, NULL);
+  atomic_store(&p->stopping, 1);
+  atomic_fetch_add(&p->wake, 1);
+  futex_wake(&p->wake, INT_MAX);
+  pthread_mutex_lock(&p->m);    /* no worker retires past this */
+  pthread_mutex_unlock(&p->m);
+  /* Joined workers may still be robbed until the last one is out */
+  int n = atomic_load(&p->nworkers);
+  for (int i = 0; i < n; i++) {
+    if (p->worker[i]->state != WORKER_EMPTY) pthread_join(p->worker[i]->thread, NULL);
+  }
+  for (int i = 0; i < n; i++) free(p->worker[i]);
+  pthread_mutex_destroy(&p->m);
+  free(p);
+}
+
+static task_t* task_new(thread_fn fn, void *arg) {
+  task_t *t = calloc(1, sizeof(*t));
+  if (!t) return NULL;
+  t->fn = fn;
+  t->arg = arg;
+  return t;
+}
+
+task_t* pool_submit(pool_t *p, thread_fn fn, void *arg) {
+  task_t *t = task_new(fn, arg);
+  if (t) pool_enqueue(p, t);
+  return t;
+}
+
+bool task_done(task_t *t) {
+  return atomic_load(&t->state) == TASK_DONE;
+}
+
+/* Puts back the actors a helper took and set aside (p may be NULL if
+ * there are none) */
+static void pool_push_skipped(pool_t *p, task_t **skipped) {
+  while (*skipped) {
+    task_t *t = *skipped;
+    *skipped = t->next;
+    pool_push(p, t, true);
+  }
+}
+
+/* help: run other tasks of the pool we work for while t isn't done. Not
+ * actors: one may wait for what the task we are in only does after this
+ * wait, and it holds a worker of its own anyway. They go back on the shared
+ * queue once there is nothing else to run. An actor parks instead of
+ * helping, which would run the tasks on its small stack. */
+static void* task_finish(task_t *t, bool help) {
+  pool_t *p = help && pool_self && !fiber_current() ? pool_self->pool : NULL;
+  task_t *skipped = NULL;
+  for (;;) {
+    unsigned s = atomic_load(&t->state);
+    if (s == TASK_DONE) break;
+    task_t *other = p ? pool_take(p) : NULL;
+    if (other && other->pool) {
+      other->next = skipped;
+      skipped = other;
+      continue;
+    }
+    if (other) {
+      task_run(other);
+      continue;
+    }
+    if (skipped) pool_push_skipped(p, &skipped);
+    if (s == TASK_QUEUED && !atomic_compare_exchange_strong(&t->state, &s, TASK_WAITED)) continue;
+    park_wait(&t->state, TASK_WAITED, NULL);
+  }
+  pool_push_skipped(p, &skipped);
+  void *result = t->result;
+  free(t);
+  return result;
+}
+
+void* task_wait(task_t *t) {
+  return task_finish(t, true);
+}
+
+int pool_workers(pool_t *p) {
+  return atomic_load(&p->live);
+}
+
+void actors_use_pool(pool_t *p) {
+  atomic_store(&actor_pool, p);
+}
+
+static void* actor_thread(void *arg) {
+  task_run(arg);
+  return NULL;
+}
+
+task_t* actor_spawn(thread_fn fn, void *arg, const char *name) {
+  task_t *t = task_new(fn, arg);
+  if (!t) DIE("actor_spawn");
+  pool_t *p = atomic_load(&actor_pool);
+  if (p && !pool_hold_worker(p)) p = NULL;   /* no worker to spare: give the actor a thread */
+  if (p) {
+    t->pool = p;
+    t->held = true;
+    pool_enqueue(p, t);
+  } else {
+    t->threaded = true;
+    t->thread = spawn(actor_thread, t, name);
+  }
+  return t;
+}
+
+void* actor_join(task_t *t) {
+  if (!t->threaded) return task_finish(t, false);
+  join(t->thread);
+  void *result = t->result;
+  free(t);
+  return result;
+}
+
+/* ------- Binary event tracing ------- */
+/* A thread claims the next TRACE_CHUNK_BYTES of the file (trace_m grows the
+ * file and maps the chunk) and fills it with records; its previous chunk is
+ * unmapped, and the unused tail of a chunk stays zero (TR_NONE). trace_gen
+ * moves at every stop, so a chunk left over from an earlier trace is never
+ * written to again. */
+#define TRACE_CHUNK_RECORDS (TRACE_CHUNK_BYTES / sizeof(trace_record_t))
+
+atomic_int trace_on;
+static atomic_uint trace_gen;
+static pthread_mutex_t trace_m = PTHREAD_MUTEX_INITIALIZER;
+static int trace_fd = -1;
+static off_t trace_size;                // Under trace_m
+static void **trace_maps;               // Each thread's current chunk, under trace_m
+static int trace_nmaps, trace_cap;
+static _Thread_local trace_record_t *tr_next;
+static _Thread_local unsigned tr_left, tr_gen;
+static _Thread_local int tr_slot;       // Index in trace_maps
+static _Thread_local uint32_t tr_tid;
+
+static int trace_chunk(void) {
+  void *p = MAP_FAILED, *old = NULL;
+  pthread_mutex_lock(&trace_m);
+  unsigned gen = atomic_load(&trace_gen);
+  bool slot = tr_gen == gen && tr_next;
+  if (!slot && trace_nmaps == trace_cap) {
+    int cap = trace_cap ? 2 * trace_cap : 16;
+    void **maps = realloc(trace_maps, cap * sizeof(void*));
+    if (maps) {
+      trace_maps = maps;
+      trace_cap = cap;
+    }
+  }
+  if (atomic_load(&trace_on) && (slot || trace_nmaps < trace_cap) &&
+      ftruncate(trace_fd, trace_size + TRACE_CHUNK_BYTES) == 0)
+    p = mmap(NULL, TRACE_CHUNK_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, trace_fd, trace_size);
+  if (p != MAP_FAILED) {
+    trace_size += TRACE_CHUNK_BYTES;
+    if (slot) old = trace_maps[tr_slot];
+    else tr_slot = trace_nmaps++;
+    trace_maps[tr_slot] = p;
+  }
+  pthread_mutex_unlock(&trace_m);
+  if (p == MAP_FAILED) return -1;
+  if (old) munmap(old, TRACE_CHUNK_BYTES);
+  if (!tr_tid) tr_tid = (uint32_t)syscall(SYS_gettid);
+  tr_next = p;
+  tr_left = TRACE_CHUNK_RECORDS;
+  tr_gen = gen;
+  return 0;
+}
+
+/* No locks or formatting unless the chunk is used up */
+void trace_record(int event, const void *obj, uint32_t arg, uint64_t t0) {
+  if ((tr_gen != atomic_load_explicit(&trace_gen, memory_order_relaxed) || !tr_left) && trace_chunk())
+    return;
+  uint64_t now = now_ns();
+  uint64_t wait = t0 ? now - t0 : 0;
+  trace_record_t *r = tr_next++;
+  tr_left--;
+  r->ns = now;
+  r->obj = (uintptr_t)obj;
+  r->tid = tr_tid;
+  r->arg = arg;
+  r->wait_ns = wait > UINT32_MAX ? UINT32_MAX : (uint32_t)wait;
+  r->event = event;
+}
+
+int trace_start(const char *path) {
+  trace_header_t h = { .record_size = sizeof(trace_record_t), .chunk_bytes = TRACE_CHUNK_BYTES };
+  memcpy(h.magic, TRACE_MAGIC, sizeof(h.magic));
+  pthread_mutex_lock(&trace_m);
+  int fd = atomic_load(&trace_on) ? -1 : open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd >= 0 && (ftruncate(fd, TRACE_CHUNK_BYTES) || pwrite(fd, &h, sizeof(h), 0) != sizeof(h))) {
+    close(fd);
+    fd = -1;
+  }
+  if (fd >= 0) {
+    trace_fd = fd;
+    trace_size = TRACE_CHUNK_BYTES;
+    trace_nmaps = 0;
+    atomic_store(&trace_on, 1);
+  }
+  pthread_mutex_unlock(&trace_m);
+  return fd >= 0 ? 0 : -1;
+}
+
+void trace_stop(void) {
+  pthread_mutex_lock(&trace_m);
+  if (atomic_exchange(&trace_on, 0)) {
+    atomic_fetch_add(&trace_gen, 1);
+    for (int i = 0; i < trace_nmaps; i++) munmap(trace_maps[i], TRACE_CHUNK_BYTES);
+    trace_nmaps = 0;
+    close(trace_fd);
+    trace_fd = -1;
+  }
+  pthread_mutex_unlock(&trace_m);
+}
+
+static const char *trace_names[TR_EVENTS] = {
+  "none", "bb_put", "bb_take", "bb_put_many", "bb_take_many",
+  "rw_rlock", "rw_runlock", "rw_wlock", "rw_wunlock",
+};
+
+static int trace_cmp(const void *a, const void *b) {
+  const trace_record_t *x = a, *y = b;
+  if (x->ns != y->ns) return x->ns < y->ns ? -1 : 1;
+  return (x->tid > y->tid) - (x->tid < y->tid);
+}
+
+/* One Chrome event; ts and dur in microseconds from base */
+static void trace_chrome_event(FILE *out, const trace_record_t *r, uint64_t base, bool *first) {
+  const char *name = trace_names[r->event];
+  bool write = r->event == TR_RW_WLOCK || r->event == TR_RW_WUNLOCK;
+  double ts = (r->ns - base) / 1e3;
+  fprintf(out, "%s\n", *first ? "" : ",");
+  *first = false;
+  switch (r->event) {
+  case TR_BB_PUT:
+  case TR_BB_TAKE:
+  case TR_BB_PUT_MANY:
+  case TR_BB_TAKE_MANY:
+    fprintf(out, "{\"name\":\"%s\",\"cat\":\"bb\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,"
+            "\"args\":{\"bb\":\"%#llx\",\"%s\":%u,\"wait_us\":%.3f}}", name, ts, r->tid,
+            (unsigned long long)r->obj, r->event <= TR_BB_TAKE ? "tray" : "trays", r->arg,
+            r->wait_ns / 1e3);
+    break;
+  case TR_RW_RLOCK:
+  case TR_RW_WLOCK:
+    if (r->wait_ns)
+      fprintf(out, "{\"name\":\"wait %s\",\"cat\":\"rw\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+              "\"pid\":1,\"tid\":%u,\"args\":{\"rw\":\"%#llx\"}},\n", write ? "write" : "read",
+              ts - r->wait_ns / 1e3, r->wait_ns / 1e3, r->tid, (unsigned long long)r->obj);
+    fprintf(out, "{\"name\":\"%s\",\"cat\":\"rw\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,"
+            "\"args\":{\"rw\":\"%#llx\"}}", write ? "write" : "read", ts, r->tid,
+            (unsigned long long)r->obj);
+    break;
+  default:
+    fprintf(out, "{\"name\":\"%s\",\"cat\":\"rw\",\"ph\":\"E\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}",
+            write ? "write" : "read", ts, r->tid);
+    break;
+  }
+}
+
+int trace_decode(const char *path, FILE *out, bool chrome) {
+  trace_header_t h;
+  FILE *f = fopen(path, "rb");
+  if (!f) return -1;
+  if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, TRACE_MAGIC, sizeof(h.magic)) ||
+      h.record_size != sizeof(trace_record_t) || h.chunk_bytes != TRACE_CHUNK_BYTES ||
+      fseek(f, 0, SEEK_END)) {
+    fclose(f);
+    return -1;
+  }
+  long size = ftell(f);
+  size_t cap = size > TRACE_CHUNK_BYTES ? (size - TRACE_CHUNK_BYTES) / sizeof(trace_record_t) : 0;
+  trace_record_t *recs = malloc(cap ? cap * sizeof(trace_record_t) : 1);
+  size_t n = 0;
+  fseek(f, TRACE_CHUNK_BYTES, SEEK_SET);
+  for (size_t i = 0; recs && i < cap && fread(&recs[n], sizeof(trace_record_t), 1, f) == 1; i++) {
+    if (recs[n].event != TR_NONE && recs[n].event < TR_EVENTS) n++;
+  }
+  fclose(f);
+  if (!recs) return -1;
+  qsort(recs, n, sizeof(trace_record_t), trace_cmp);
+
+  /* Time 0 is the earliest wait start */
+  uint64_t base = n ? recs[0].ns : 0;
+  for (size_t i = 0; i < n; i++)
+    if (recs[i].ns - recs[i].wait_ns < base) base = recs[i].ns - recs[i].wait_ns;
+  if (chrome) {
+    bool first = true;
+    fprintf(out, "{\"traceEvents\":[");
+    for (size_t i = 0; i < n; i++) trace_chrome_event(out, &recs[i], base, &first);
+    fprintf(out, "\n],\"displayTimeUnit\":\"ns\"}\n");
+  } else {
+    for (size_t i = 0; i < n; i++) {
+      trace_record_t *r = &recs[i];
+      fprintf(out, "%14.3f us  tid %-7u %-12s %#llx", (r->ns - base) / 1e3, r->tid,
+              trace_names[r->event], (unsigned long long)r->obj);
+      if (r->event == TR_BB_PUT || r->event == TR_BB_TAKE) fprintf(out, "  tray %u", r->arg);
+      else if (r->event == TR_BB_PUT_MANY || r->event == TR_BB_TAKE_MANY) fprintf(out, "  %u trays", r->arg);
+      if (r->wait_ns) fprintf(out, "  waited %.3f us", r->wait_ns / 1e3);
+      fputc('\n', out);
+    }
+  }
+  free(recs);
+  return 0;
+}
+
+/* ------- Futex-backed counting semaphore ------- */
+/* Waiters register in s->waiters before sleeping on s->value == 0; posters
+ * bump value first and only then look at waiters (both seq_cst), so either
+ * the poster sees the waiter or the waiter sees the unit. Every waiter waits
+ * for the same condition, so waking one per posted unit is enough. */
+int fsem_init(fsem_t *s, unsigned value) {
+  atomic_init(&s->value, value);
+  atomic_init(&s->waiters, 0);
+  return 0;
+}
+
+void fsem_destroy(fsem_t *s) {
+  (void)s;
+}
+
+int fsem_trywait_many(fsem_t *s, unsigned max) {
+  unsigned v = atomic_load_explicit(&s->value, memory_order_relaxed);
+  while (v > 0 && max > 0) {
+    unsigned k = v < max ? v : max;
+    if (atomic_compare_exchange_weak_explicit(&s->value, &v, v - k,
+                                              memory_order_acquire, memory_order_relaxed))
+      return (int)k;
+  }
+  return 0;
+}
+
+int fsem_trywait(fsem_t *s) {
+  if (fsem_trywait_many(s, 1)) return 0;
+  errno = EAGAIN;
+  return -1;
+}
+
+int fsem_clockwait(fsem_t *s, const struct timespec *deadline) {
+  if (fsem_trywait_many(s, 1)) return 0;
+  int rc = 0;
+  atomic_fetch_add(&s->waiters, 1);
+  while (!fsem_trywait_many(s, 1)) {
+    /* Timed out, but a unit posted meanwhile is still ours (exactly one) */
+    if (futex_wait(&s->value, 0, deadline)) {
+      if (fsem_trywait_many(s, 1)) break;
+      errno = ETIMEDOUT;
+      rc = -1;
+      break;
+    }
+  }
+  atomic_fetch_sub(&s->waiters, 1);
+  return rc;
+}
+
+int fsem_wait(fsem_t *s) {
+  return fsem_clockwait(s, NULL);
+}
+
+int fsem_post_many(fsem_t *s, unsigned n) {
+  if (n == 0) return 0;
+  atomic_fetch_add(&s->value, n);
+  if (atomic_load(&s->waiters))
+    futex_wake(&s->value, n > INT_MAX ? INT_MAX : (int)n);
+  return 0;
+}
+
+int fsem_post(fsem_t *s) {
+  return fsem_post_many(s, 1);
+}
+
+int fsem_getvalue(fsem_t *s, int *value) {
+  *value = (int)atomic_load_explicit(&s->value, memory_order_relaxed);
+  return 0;
+}
+
+/* sem_t counterparts of the batch operations (no native wait-for-N) */
+int psem_trywait_many(sem_t *s, unsigned max) {
+  unsigned k = 0;
+  while (k < max && sem_trywait(s) == 0) k++;
+  return (int)k;
+}
+
+int psem_post_many(sem_t *s, unsigned n) {
+  for (unsigned i = 0; i < n; i++)
+    if (sem_post(s)) return -1;
+  return 0;
+}
+
+/* ------- Reader-Writer Lock: initialization and cleanup ------- */
+int rw_init(rwlock_t *rw) {
+  /* TODO: Initialize all fields in rwlock_t structure
+   * - Initialize mutex
+   * - Initialize semaphores
+   * - Set initial counter values
+   */
+  // (void)rw;  // Remove this when you implement the function
+  pthread_mutex_init(&rw->m, NULL);
+  sync_sem_init(&rw->OKToRead, 0);
+  sync_sem_init(&rw->OKToWrite, 0);
+  rw->readers_active = 0;
+  rw->readers_waiting = 0;
+  rw->writer_active = 0;
+  rw->writers_waiting = 0;
+  rw->policy = RW_POLICY_WRITER;
+  pthread_mutex_init(&rw->upgrade_m, NULL);
+  rw->upgrade_pending = 0;
+  sync_sem_init(&rw->OKToUpgrade, 0);
+  rw->mode = RW_MODE_SEM;
+  rw->slots = NULL;
+  rw->nslots = 0;
+  atomic_init(&rw->gate, 0);
+  atomic_init(&rw->reader_exits, 0);
+  atomic_init(&rw->writers_queued, 0);
+  rw->cohort = NULL;
+  atomic_init(&rw->word, 0);
+  atomic_init(&rw->writer_seq, 0);
+  rw->spin_max = 0;
+  atomic_init(&rw->spin_avg, 0);
+  pthread_mutex_init(&rw->combine_m, NULL);
+  atomic_init(&rw->combine_pending, 0);
+  atomic_init(&rw->combine_seq, 0);
+  atomic_init(&rw->combine, NULL);
+  rw->stats = NULL;
+#ifdef RW_STATS
+  void *mem;
+  if (posix_memalign(&mem, _Alignof(rw_stats_block_t), sizeof(rw_stats_block_t))) return -1;
+  rw->stats = memset(mem, 0, sizeof(rw_stats_block_t));
+#endif
+  return 0;
+}
+
+int rw_init_ex(rwlock_t *rw, rw_policy_t policy) {
+  if ((unsigned)policy > RW_POLICY_PHASE_FAIR || rw_init(rw)) return -1;
+  rw->policy = policy;
+  return 0;
+}
+
+/* Read-mostly engine. Readers are spread over a few slots per CPU (each
+ * thread keeps one slot for its lifetime), so the read side costs one
+ * uncontended atomic add on the reader's own cache line; writers pay for a
+ * scan of all slots. */
+enum { RW_SLOTS_PER_CPU = 4, RW_SLOTS_MAX = 256 };
+
+int rw_init_percpu(rwlock_t *rw) {
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  if (ncpu < 1) ncpu = 1;
+  int n = 1;
+  while (n < ncpu * RW_SLOTS_PER_CPU && n < RW_SLOTS_MAX) n <<= 1;
+  void *mem;
+  if (posix_memalign(&mem, sizeof(rw_slot_t), n * sizeof(rw_slot_t))) return -1;
+  if (rw_init(rw)) {
+    free(mem);
+    return -1;
+  }
+  rw->slots = mem;
+  for (int i = 0; i < n; i++) atomic_init(&rw->slots[i].readers, 0);
+  rw->nslots = n;
+  rw->mode = RW_MODE_PERCPU;
+  return 0;
+}
+
+/* Single-word engine. Spinning is only allowed where the lock holder can
+ * run at the same time. */
+enum { RW_SPIN_MAX = 1000 };
+
+int rw_init_futex(rwlock_t *rw) {
+  if (rw_init(rw)) return -1;
+  rw->spin_max = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? RW_SPIN_MAX : 0;
+  rw->mode = RW_MODE_FUTEX;
+  return 0;
+}
+
+/* Cohort variant. Node ids are handed out densely in /sys order, skipping
+ * memory-only nodes; CPUs the node lists don't mention go to node 0. */
+static int sys_cpu_nodes(int *cpu_node, int ncpus) {
+  int nnodes = 0;
+  for (int d = 0; d < RW_COHORT_MAX_NODES * 4 && nnodes < RW_COHORT_MAX_NODES; d++) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", d);
+    FILE *f = fopen(path, "r");
+    if (!f) continue;
+    int lo, hi, c, cpus = 0;
+    while (fscanf(f, "%d", &lo) == 1) {           /* e.g. "0-3,8-11" */
+      hi = lo;
+      if ((c = fgetc(f)) == '-' && fscanf(f, "%d", &hi) == 1) c = fgetc(f);
+      for (int cpu = lo; cpu <= hi; cpu++) {
+        if (cpu >= 0 && cpu < ncpus) cpu_node[cpu] = nnodes;
+        cpus++;
+      }
+      if (c != ',') break;
+    }
+    fclose(f);
+    if (cpus) nnodes++;
+  }
+  return nnodes;
+}
+
+int rw_init_cohort(rwlock_t *rw, int nnodes) {
+  long ncpus = sysconf(_SC_NPROCESSORS_CONF);
+  if (ncpus < 1) ncpus = 1;
+  int *map = calloc(ncpus + RW_COHORT_MAX_NODES, sizeof(int));
+  if (!map) return -1;
+  if (nnodes > 0) {
+    if (nnodes > RW_COHORT_MAX_NODES) nnodes = RW_COHORT_MAX_NODES;
+    for (int cpu = 0; cpu < ncpus; cpu++) map[cpu] = cpu * nnodes / ncpus;
+  } else if ((nnodes = sys_cpu_nodes(map, ncpus)) == 0) {
+    nnodes = 1;
+  }
+  void *slots, *mem;
+  size_t size = sizeof(rw_cohort_t) + nnodes * sizeof(rw_cohort_node_t);
+  if (posix_memalign(&slots, sizeof(rw_slot_t), nnodes * sizeof(rw_slot_t))) slots = NULL;
+  if (posix_memalign(&mem, _Alignof(rw_cohort_t), size)) mem = NULL;
+  if (!slots || !mem || rw_init(rw)) {
+    free(mem);
+    free(slots);
+    free(map);
+    return -1;
+  }
+  rw_cohort_t *c = memset(mem, 0, size);
+  c->nnodes = nnodes;
+  c->ncpus = ncpus;
+  c->max_batch = RW_COHORT_BATCH;
+  c->cpu_node = map;
+  c->queue = map + ncpus;
+  for (int i = 0; i < nnodes; i++) {
+    pthread_mutex_init(&c->node[i].local, NULL);
+    atomic_init(&c->node[i].waiting, 0);
+    atomic_init(&c->node[i].granted, 0);
+  }
+  rw->slots = slots;
+  for (int i = 0; i < nnodes; i++) atomic_init(&rw->slots[i].readers, 0);
+  rw->nslots = nnodes;
+  rw->cohort = c;
+  rw->mode = RW_MODE_PERCPU;
+  return 0;
+}
+
+int rw_init_engine(rwlock_t *rw, const char *engine) {
+  if (!engine || strcmp(engine, "sem") == 0) return rw_init(rw);
+  if (strcmp(engine, "reader-pref") == 0) return rw_init_ex(rw, RW_POLICY_READER);
+  if (strcmp(engine, "phase-fair") == 0) return rw_init_ex(rw, RW_POLICY_PHASE_FAIR);
+  if (strcmp(engine, "percpu") == 0) return rw_init_percpu(rw);
+  if (strcmp(engine, "futex") == 0) return rw_init_futex(rw);
+  if (strcmp(engine, "cohort") == 0) return rw_init_cohort(rw, 0);
+  if (strncmp(engine, "cohort:", 7) == 0 && atoi(engine + 7) > 0)
+    return rw_init_cohort(rw, atoi(engine + 7));
+  return -1;
+}
+
+void rw_destroy(rwlock_t *rw) {
+  /* TODO: Clean up resources
+   * - Destroy mutex
+   * - Destroy semaphores
+   */
+  // (void)rw;  // Remove this when you implement the function
+  pthread_mutex_destroy(&rw->m);
+  sync_sem_destroy(&rw->OKToRead);
+  sync_sem_destroy(&rw->OKToWrite);
+  sync_sem_destroy(&rw->OKToUpgrade);
+  pthread_mutex_destroy(&rw->upgrade_m);
+  free(rw->slots);
+  rw->slots = NULL;
+  if (rw->cohort) {
+    for (int i = 0; i < rw->cohort->nnodes; i++) pthread_mutex_destroy(&rw->cohort->node[i].local);
+    free(rw->cohort->cpu_node);
+    free(rw->cohort);
+    rw->cohort = NULL;
+  }
+  pthread_mutex_destroy(&rw->combine_m);
+  free(atomic_exchange(&rw->combine, NULL));
+  free(rw->stats);
+  rw->stats = NULL;
+}
+/* RW lock functions are implemented in readers_writers.c */
+
+/* ------- Sequence lock ------- */
+/* A writer makes seq odd, updates, and makes it even again. The fences
+ * order the relaxed data accesses against the counter on both sides. */
+enum { SEQ_SPIN = 100 };
+
+int seq_init(seqlock_t *sl) {
+  atomic_init(&sl->seq, 0);
+  return pthread_mutex_init(&sl->m, NULL) ? -1 : 0;
+}
+
+void seq_destroy(seqlock_t *sl) {
+  pthread_mutex_destroy(&sl->m);
+}
+
+unsigned seq_read_begin(seqlock_t *sl) {
+  unsigned s;
+  for (int i = 0; (s = atomic_load_explicit(&sl->seq, memory_order_acquire)) & 1; i++) {
+    if (i < SEQ_SPIN) cpu_relax();
+    else sched_yield();
+  }
+  return s;
+}
+
+bool seq_read_retry(seqlock_t *sl, unsigned start) {
+  atomic_thread_fence(memory_order_acquire);
+  return atomic_load_explicit(&sl->seq, memory_order_relaxed) != start;
+}
+
+void seq_write_lock(seqlock_t *sl) {
+  pthread_mutex_lock(&sl->m);
+  unsigned s = atomic_load_explicit(&sl->seq, memory_order_relaxed);
+  atomic_store_explicit(&sl->seq, s + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+}
+
+void seq_write_unlock(seqlock_t *sl) {
+  unsigned s = atomic_load_explicit(&sl->seq, memory_order_relaxed);
+  atomic_store_explicit(&sl->seq, s + 1, memory_order_release);
+  pthread_mutex_unlock(&sl->m);
+}
+
+/* ------- RCU-style publication ------- */
+/* Every thread that reads gets a record in an append-only registry (reused
+ * once the thread exits). rcu_read_lock announces the current epoch in it,
+ * rcu_read_unlock clears it. rcu_retire tags an old version with the epoch
+ * and advances the epoch; a version is freed once no reader announces an
+ * epoch at or below its tag. A reader that announces a stale epoch after
+ * the scan is harmless: the publish came before the scan, and the seq_cst
+ * fences on both sides make that reader see the new version. */
+typedef struct rcu_reader {
+  _Alignas(BB_CACHE_LINE) atomic_ulong epoch;  // 0 while outside a read section
+  atomic_int in_use;
+  struct rcu_reader *next;
+} rcu_reader_t;
+
+typedef struct rcu_retired {
+  struct rcu_retired *next;
+  void *ptr;
+  void (*free_fn)(void *);
+  unsigned long epoch;
+} rcu_retired_t;
+
+static atomic_ulong rcu_epoch = 1;
+static _Atomic(rcu_reader_t*) rcu_readers;
+static pthread_mutex_t rcu_m = PTHREAD_MUTEX_INITIALIZER;  // Protects the retired list
+static rcu_retired_t *rcu_retired;
+static unsigned long rcu_npending;
+static pthread_key_t rcu_key;
+static pthread_once_t rcu_once = PTHREAD_ONCE_INIT;
+static _Thread_local rcu_reader_t *rcu_self;
+static _Thread_local int rcu_depth;
+
+static void rcu_thread_exit(void *arg) {
+  rcu_reader_t *r = arg;
+  atomic_store(&r->epoch, 0);
+  atomic_store(&r->in_use, 0);
+}
+
+static void rcu_key_create(void) {
+  if (pthread_key_create(&rcu_key, rcu_thread_exit)) DIE("pthread_key_create");
+}
+
+static rcu_reader_t* rcu_register(void) {
+  pthread_once(&rcu_once, rcu_key_create);
+  rcu_reader_t *r;
+  for (r = atomic_load(&rcu_readers); r; r = r->next) {
+    int unused = 0;
+    if (atomic_compare_exchange_strong(&r->in_use, &unused, 1)) break;
+  }
+  if (!r) {
+    void *mem;
+    if (posix_memalign(&mem, BB_CACHE_LINE, sizeof(rcu_reader_t))) DIE("rcu reader");
+    r = mem;
+    atomic_init(&r->epoch, 0);
+    atomic_init(&r->in_use, 1);
+    r->next = atomic_load(&rcu_readers);
+    while (!atomic_compare_exchange_weak(&rcu_readers, &r->next, r)) ;
+  }
+  pthread_setspecific(rcu_key, r);
+  return rcu_self = r;
+}
+
+void rcu_read_lock(void) {
+  if (rcu_depth++) return;
+  rcu_reader_t *r = rcu_self ? rcu_self : rcu_register();
+  atomic_store_explicit(&r->epoch, atomic_load_explicit(&rcu_epoch, memory_order_relaxed),
+                        memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);  // announce before reading the structure
+}
+
+void rcu_read_unlock(void) {
+  if (--rcu_depth) return;
+  atomic_store_explicit(&rcu_self->epoch, 0, memory_order_release);
+}
+
+/* Oldest epoch a reader may still be in; ULONG_MAX if nobody is reading */
+static unsigned long rcu_min_epoch(void) {
+  atomic_thread_fence(memory_order_seq_cst);
+  unsigned long min = ULONG_MAX;
+  for (rcu_reader_t *r = atomic_load(&rcu_readers); r; r = r->next) {
+    unsigned long e = atomic_load_explicit(&r->epoch, memory_order_acquire);
+    if (e && e < min) min = e;
+  }
+  return min;
+}
+
+/* Unlinks the versions no reader can still hold; caller holds rcu_m */
+static rcu_retired_t* rcu_collect(void) {
+  unsigned long min = rcu_min_epoch();
+  rcu_retired_t *done = NULL, **pp = &rcu_retired;
+  while (*pp) {
+    rcu_retired_t *n = *pp;
+    if (n->epoch < min) {
+      *pp = n->next;
+      n->next = done;
+      done = n;
+      rcu_npending--;
+    } else {
+      pp = &n->next;
+    }
+  }
+  return done;
+}
+
+static void rcu_free_list(rcu_retired_t *n) {
+  while (n) {
+    rcu_retired_t *next = n->next;
+    n->free_fn(n->ptr);
+    free(n);
+    n = next;
+  }
+}
+
+void rcu_retire(void *old, void (*free_fn)(void *)) {
+  if (!old) return;
+  rcu_retired_t *n = malloc(sizeof(*n));
+  if (!n) DIE("malloc rcu_retired");
+  n->ptr = old;
+  n->free_fn = free_fn;
+  pthread_mutex_lock(&rcu_m);
+  n->epoch = atomic_fetch_add(&rcu_epoch, 1);
+  n->next = rcu_retired;
+  rcu_retired = n;
+  rcu_npending++;
+  rcu_retired_t *done = rcu_collect();
+  pthread_mutex_unlock(&rcu_m);
+  rcu_free_list(done);
+}
+
+void rcu_synchronize(void) {
+  unsigned long target = atomic_fetch_add(&rcu_epoch, 1);
+  for (unsigned us = 50; rcu_min_epoch() <= target; us = us < 1000 ? 2 * us : 1000) usleep(us);
+  pthread_mutex_lock(&rcu_m);
+  rcu_retired_t *done = rcu_collect();
+  pthread_mutex_unlock(&rcu_m);
+  rcu_free_list(done);
+}
+
+unsigned long rcu_pending(void) {
+  pthread_mutex_lock(&rcu_m);
+  unsigned long n = rcu_npending;
+  pthread_mutex_unlock(&rcu_m);
+  return n;
+}
+
+/* ------- Food name interning ------- */
+/* Append-only list: lookups walk it without a lock, inserts are serialized
+ * and publish the new head with release ordering. */
+typedef struct name_node {
+  struct name_node *next;
+  char name[];
+} name_node_t;
+
+static _Atomic(name_node_t*) interned_names;
+static pthread_mutex_t intern_m = PTHREAD_MUTEX_INITIALIZER;
+
+static const char* intern_lookup(name_node_t *n, const char *name) {
+  for (; n; n = n->next)
+    if (n->name == name || strcmp(n->name, name) == 0) return n->name;
+  return NULL;
+}
+
+const char* intern_food_name(const char *name) {
+  if (!name) return NULL;
+  const char *found = intern_lookup(atomic_load_explicit(&interned_names, memory_order_acquire), name);
+  if (found) return found;
+
+  pthread_mutex_lock(&intern_m);
+  name_node_t *head = atomic_load_explicit(&interned_names, memory_order_relaxed);
+  found = intern_lookup(head, name);
+  if (!found) {
+    size_t len = strlen(name) + 1;
+    name_node_t *n = malloc(sizeof(*n) + len);
+    if (!n) DIE("malloc food_name");
+    memcpy(n->name, name, len);
+    n->next = head;
+    atomic_store_explicit(&interned_names, n, memory_order_release);
+    found = n->name;
+  }
+  pthread_mutex_unlock(&intern_m);
+  return found;
+}
+
+/* ------- Tray pool (per-thread magazines + shared depot) ------- */
+typedef struct tray_mag {
+  struct tray_mag *next;    // Depot list link
+  int n;                    // Trays held
+  food_tray_t *t[TRAY_MAG_SIZE];
+} tray_mag_t;
+
+typedef struct {
+  tray_mag_t *loaded;       // Magazine alloc/free work on
+  tray_mag_t *prev;         // Swapped with loaded before touching the depot
+} tray_cache_t;
+
+static struct {
+  pthread_mutex_t m;
+  tray_mag_t *full;         // Magazines with at least one tray
+  tray_mag_t *empty;        // Magazines with no trays
+} depot = { PTHREAD_MUTEX_INITIALIZER, NULL, NULL };
+
+static _Thread_local tray_cache_t tray_cache;
+static pthread_key_t tray_cache_key;
+static pthread_once_t tray_cache_once = PTHREAD_ONCE_INIT;
+static atomic_ulong trays_allocated;
+
+static tray_mag_t* mag_new(void) {
+  tray_mag_t *m = calloc(1, sizeof(*m));
+  if (!m) DIE("calloc tray magazine");
+  return m;
 }
 
-pthread_t spawn(thread_fn fn, void *arg, const char *name) {
-  (void)name; /* name useful for extended logging */
-  pthread_t t;
-  if (pthread_create(&t, NULL, fn, arg)) DIE("pthread_create");
-  return t;
+static void depot_push(tray_mag_t *m) {
+  tray_mag_t **list = m->n ? &depot.full : &depot.empty;
+  m->next = *list;
+  *list = m;
 }
-void join(pthread_t t) { if (pthread_join(t, NULL)) DIE("pthread_join"); }
 
-void jitter_us(int min_us, int max_us) {
-  int span = (max_us > min_us) ? (max_us - min_us) : 1;
-  int d = min_us + (rand() % span);
-  usleep(d);
+/* Alloc side: trade an empty magazine for a full one, or NULL (and keep
+ * the empty one) if the depot has none */
+static tray_mag_t* depot_get_full(tray_mag_t *empty) {
+  pthread_mutex_lock(&depot.m);
+  tray_mag_t *got = depot.full;
+  if (got) {
+    depot.full = got->next;
+    depot_push(empty);
+  }
+  pthread_mutex_unlock(&depot.m);
+  return got;
 }
 
-/* ------- Reader-Writer Lock: initialization and cleanup ------- */
-int rw_init(rwlock_t *rw) {
-  /* TODO: Initialize all fields in rwlock_t structure
-   * - Initialize mutex
-   * - Initialize semaphores
-   * - Set initial counter values
-   */
-  // (void)rw;  // Remove this when you implement the function
-  pthread_mutex_init(&rw->m, NULL);
-  sem_init(&rw->OKToRead, 0, 0);
-  sem_init(&rw->OKToWrite, 0, 0);
-  rw->readers_active = 0;
-  rw->readers_waiting = 0;
-  rw->writer_active = 0;
-  rw->writers_waiting = 0;
-  return 0;
+/* Free side: park a full magazine and get an empty one back */
+static tray_mag_t* depot_put_full(tray_mag_t *full) {
+  pthread_mutex_lock(&depot.m);
+  depot_push(full);
+  tray_mag_t *got = depot.empty;
+  if (got) depot.empty = got->next;
+  pthread_mutex_unlock(&depot.m);
+  return got ? got : mag_new();
 }
 
-void rw_destroy(rwlock_t *rw) {
-  /* TODO: Clean up resources
-   * - Destroy mutex
-   * - Destroy semaphores
-   */
-  // (void)rw;  // Remove this when you implement the function
-  pthread_mutex_destroy(&rw->m);
-  sem_destroy(&rw->OKToRead);
-  sem_destroy(&rw->OKToWrite);
+/* Thread exit: return both magazines so their trays are not stranded */
+static void tray_cache_exit(void *arg) {
+  tray_cache_t *c = arg;
+  pthread_mutex_lock(&depot.m);
+  depot_push(c->loaded);
+  depot_push(c->prev);
+  pthread_mutex_unlock(&depot.m);
+  c->loaded = c->prev = NULL;
 }
-/* RW lock functions are implemented in readers_writers.c */
 
-/* ------- Food Tray Helper Functions ------- */
-food_tray_t* create_food_tray(int tray_id, const char *food_name, int cook_id) {
+static void tray_cache_key_init(void) {
+  if (pthread_key_create(&tray_cache_key, tray_cache_exit)) DIE("pthread_key_create");
+}
+
+static tray_cache_t* tray_cache_get(void) {
+  tray_cache_t *c = &tray_cache;
+  if (!c->loaded) {
+    pthread_once(&tray_cache_once, tray_cache_key_init);
+    c->loaded = mag_new();
+    c->prev = mag_new();
+    pthread_setspecific(tray_cache_key, c);
+  }
+  return c;
+}
+
+food_tray_t* tray_alloc(void) {
+  tray_cache_t *c = tray_cache_get();
+  if (c->loaded->n == 0) {
+    tray_mag_t *t = c->loaded; c->loaded = c->prev; c->prev = t;
+    if (c->loaded->n == 0) {
+      tray_mag_t *full = depot_get_full(c->loaded);
+      if (full) c->loaded = full;
+    }
+  }
+  if (c->loaded->n > 0) return c->loaded->t[--c->loaded->n];
+
   food_tray_t *tray = malloc(sizeof(food_tray_t));
   if (!tray) DIE("malloc food_tray");
+  atomic_fetch_add_explicit(&trays_allocated, 1, memory_order_relaxed);
+  return tray;
+}
+
+void tray_release(food_tray_t *tray) {
+  if (!tray) return;
+  tray_cache_t *c = tray_cache_get();
+  if (c->loaded->n == TRAY_MAG_SIZE) {
+    tray_mag_t *t = c->loaded; c->loaded = c->prev; c->prev = t;
+    if (c->loaded->n == TRAY_MAG_SIZE) {
+      c->loaded = depot_put_full(c->loaded);
+    }
+  }
+  c->loaded->t[c->loaded->n++] = tray;
+}
+
+unsigned long tray_pool_allocated(void) {
+  return atomic_load_explicit(&trays_allocated, memory_order_relaxed);
+}
+
+/* ------- Food Tray Helper Functions ------- */
+food_tray_t* create_food_tray(int tray_id, const char *food_name, int cook_id) {
+  food_tray_t *tray = tray_alloc();
   
   tray->tray_id = tray_id;
-  tray->food_name = strdup(food_name);
-  if (!tray->food_name) DIE("strdup food_name");
+  tray->food_name = intern_food_name(food_name);
   tray->prepared_by = cook_id;
   
   return tray;
 }
 
 void free_food_tray(food_tray_t *tray) {
-  if (tray) {
-    free(tray->food_name);
-    free(tray);
+  tray_release(tray);
+}
+
+/* ------- Bounded Buffer: waiting (spin, then park) ------- */
+/* Every engine waits the same way: poll for a short, adaptive number of
+ * rounds, then sleep (sem_t for the locked engine, futex for the lock-free
+ * ones). The spin budget follows the recent number of rounds that actually
+ * paid off (2x average + slack, like glibc's adaptive mutex) and decays when
+ * waits end up parking anyway. Waits only reach this code after the
+ * immediate attempt failed, so the counters cost nothing on the fast path.
+ * Deadlines are absolute CLOCK_MONOTONIC times; NULL waits forever. */
+enum { BB_SPIN_MAX = 1000, BB_SPIN_SLACK = 10 };
+
+/* Spinning only helps if the thread we wait for can run meanwhile */
+static bool spinning_useful(void) {
+  static atomic_int ncpu;
+  int n = atomic_load_explicit(&ncpu, memory_order_relaxed);
+  if (n == 0) {
+    n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1) n = 1;
+    atomic_store_explicit(&ncpu, n, memory_order_relaxed);
+  }
+  return n > 1;
+}
+
+static int spin_limit(bb_t *q) {
+  if (!spinning_useful()) return 0;
+  int lim = 2 * (atomic_load_explicit(&q->spin_avg, memory_order_relaxed) >> 3) + BB_SPIN_SLACK;
+  return lim > BB_SPIN_MAX ? BB_SPIN_MAX : lim;
+}
+
+/* Record how a wait ended: after 'rounds' of spinning, or parked (rounds = 0).
+ * spin_avg keeps 8 times the average so that it decays all the way to 0
+ * (avg += (rounds - avg) / 8 in whole rounds would stop at 7). */
+static void spin_feedback(bb_t *q, int rounds) {
+  int avg8 = atomic_load_explicit(&q->spin_avg, memory_order_relaxed);
+  atomic_store_explicit(&q->spin_avg, avg8 - (avg8 >> 3) + rounds, memory_order_relaxed);
+  atomic_fetch_add_explicit(rounds ? &q->waits_spun : &q->waits_parked, 1, memory_order_relaxed);
+}
+
+/* Wait and shutdown state shared by every engine's init */
+static void bb_wait_init(bb_t *q) {
+  atomic_init(&q->closed, 0);
+  atomic_init(&q->spin_avg, 0);
+  atomic_init(&q->waits_spun, 0);
+  atomic_init(&q->waits_parked, 0);
+  atomic_init(&q->waits_timed_out, 0);
+  atomic_init(&q->not_full.epoch, 0);
+  atomic_init(&q->not_full.waiters, 0);
+  atomic_init(&q->not_empty.epoch, 0);
+  atomic_init(&q->not_empty.waiters, 0);
+}
+
+/* Event counts (bb_event_t): a waiter prepares, re-checks its condition
+ * and waits for the epoch to move; signalling costs a fence and a load
+ * while nobody waits. */
+static unsigned ev_prepare(bb_event_t *ev) {
+  atomic_fetch_add(&ev->waiters, 1);
+  return atomic_load(&ev->epoch);
+}
+
+static void ev_cancel(bb_event_t *ev) {
+  atomic_fetch_sub(&ev->waiters, 1);
+}
+
+static int ev_wait(bb_event_t *ev, unsigned key, const struct timespec *deadline) {
+  int rc = park_wait(&ev->epoch, key, deadline);
+  atomic_fetch_sub(&ev->waiters, 1);
+  return rc;
+}
+
+/* Wakes n parked threads or actors. One per slot handed over is enough:
+ * a wakee re-reads the position word and claims whatever is next, and a
+ * claimer that finds the following slot ready too passes the wake on (see
+ * mpmc_claim), so slots published out of order still reach a sleeper. */
+static void ev_signal(bb_event_t *ev, int n) {
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&ev->waiters, memory_order_relaxed)) {
+    atomic_fetch_add(&ev->epoch, 1);
+    park_wake(&ev->epoch, n);
+  }
+}
+
+/* The event posters of *s signal: a pooled actor can't park in sem_wait */
+static bb_event_t* sem_event(bb_t *q, sync_sem_t *s) {
+  return s == &q->full ? &q->not_empty : &q->not_full;
+}
+
+/* Locked engine: posts n units of *s */
+static void sem_give(bb_t *q, sync_sem_t *s, int n) {
+  if (n == 1) sync_sem_post(s);
+  else sync_sem_post_many(s, n);
+  ev_signal(sem_event(q, s), n);
+}
+
+/* Locked engine: take one unit of *s. Returns -1 if !block or the deadline
+ * passed before a unit became available. */
+static int sem_acquire(bb_t *q, sync_sem_t *s, bool block, const struct timespec *deadline) {
+  if (sync_sem_trywait(s) == 0) return 0;
+  if (!block) return -1;
+  int limit = spin_limit(q);
+  for (int i = 1; i <= limit; i++) {
+    int v = 0;
+    cpu_relax();
+    if (sync_sem_getvalue(s, &v) == 0 && v > 0 && sync_sem_trywait(s) == 0) {
+      spin_feedback(q, i);
+      return 0;
+    }
+  }
+  spin_feedback(q, 0);
+  if (!deadline && fiber_current()) {
+    bb_event_t *ev = sem_event(q, s);
+    for (;;) {
+      unsigned key = ev_prepare(ev);
+      if (sync_sem_trywait(s) == 0) {
+        ev_cancel(ev);
+        return 0;
+      }
+      ev_wait(ev, key, NULL);
+    }
+  }
+  int rc;
+  do {
+    rc = deadline ? sync_sem_clockwait(s, deadline) : sync_sem_wait(s);
+  } while (rc == -1 && errno == EINTR);
+  if (rc == 0) return 0;
+  atomic_fetch_add_explicit(&q->waits_timed_out, 1, memory_order_relaxed);
+  return -1;
+}
+
+/* ------- Bounded Buffer: lock-free SPSC ring ------- */
+/* One producer owns spsc_tail, one consumer owns spsc_head; each side only
+ * reads the other's index when its cached copy says the ring is full/empty.
+ * A side that runs out of work spins, then parks on the other side's index
+ * (park_wait), announcing itself in spsc_parked so the wake syscall is only
+ * issued when someone is actually asleep. */
+#define BB_PARKED_CONSUMER 1u
+#define BB_PARKED_PRODUCER 2u
+
+/* Once closed, the producer stops waiting at once; the consumer only once
+ * no put is in flight, so it cannot miss a tray published during close. */
+static bool spsc_closed_for(bb_t *q, unsigned me) {
+  if (!atomic_load(&q->closed)) return false;
+  return me == BB_PARKED_PRODUCER || !atomic_load(&q->spsc_putting);
+}
+
+/* Wait until *word moves away from 'seen' or the queue is closed for this
+ * side. Returns -1 on timeout. */
+static int spsc_wait(bb_t *q, atomic_uint *word, unsigned seen, unsigned me,
+                     const struct timespec *deadline) {
+  int limit = spin_limit(q);
+  for (int i = 1; i <= limit; i++) {
+    cpu_relax();
+    if (atomic_load_explicit(word, memory_order_acquire) != seen || spsc_closed_for(q, me)) {
+      spin_feedback(q, i);
+      return 0;
+    }
+  }
+  spin_feedback(q, 0);
+  int rc = 0;
+  atomic_fetch_or(&q->spsc_parked, me);
+  while (atomic_load(word) == seen && !spsc_closed_for(q, me)) {
+    if (park_wait(word, seen, deadline) && atomic_load(word) == seen) {
+      atomic_fetch_add_explicit(&q->waits_timed_out, 1, memory_order_relaxed);
+      rc = -1;
+      break;
+    }
+  }
+  atomic_fetch_and(&q->spsc_parked, ~me);
+  return rc;
+}
+
+/* Called after publishing *word; wakes the other side only if it parked. */
+static void spsc_wake(bb_t *q, atomic_uint *word, unsigned other) {
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&q->spsc_parked, memory_order_relaxed) & other)
+    park_wake(word, 1);
+}
+
+/* Closing does not move the index the other side sleeps on, so a single
+ * wake could land just before it goes to sleep; keep waking until it has
+ * left the wait (it rechecks spsc_closed_for every time it wakes). */
+static void spsc_kick(bb_t *q, atomic_uint *word, unsigned other) {
+  while (atomic_load(&q->spsc_parked) & other) {
+    park_wake(word, 1);
+    sched_yield();
+  }
+}
+
+/* Ends a put: a put that failed because of close may be what a draining
+ * consumer is waiting on. */
+static void spsc_put_done(bb_t *q) {
+  atomic_store_explicit(&q->spsc_putting, 0, memory_order_release);
+  if (atomic_load_explicit(&q->closed, memory_order_relaxed))
+    spsc_kick(q, &q->spsc_tail, BB_PARKED_CONSUMER);
+}
+
+static int spsc_put(bb_t *q, food_tray_t *tray, bool block, const struct timespec *deadline) {
+  atomic_store(&q->spsc_putting, 1);
+  unsigned t = atomic_load_explicit(&q->spsc_tail, memory_order_relaxed);
+  while (!atomic_load(&q->closed)) {
+    if (t - q->spsc_head_cache < (unsigned)q->cap) {
+      q->buf[t & q->mask] = tray;
+      atomic_store_explicit(&q->spsc_tail, t + 1, memory_order_release);
+      spsc_put_done(q);
+      spsc_wake(q, &q->spsc_tail, BB_PARKED_CONSUMER);
+      return 0;
+    }
+    q->spsc_head_cache = atomic_load_explicit(&q->spsc_head, memory_order_acquire);
+    if (t - q->spsc_head_cache < (unsigned)q->cap) continue;
+    if (!block || spsc_wait(q, &q->spsc_head, q->spsc_head_cache, BB_PARKED_PRODUCER, deadline))
+      break;
+  }
+  spsc_put_done(q);
+  return -1;
+}
+
+static food_tray_t* spsc_take(bb_t *q, bool block, const struct timespec *deadline) {
+  unsigned h = atomic_load_explicit(&q->spsc_head, memory_order_relaxed);
+  while (q->spsc_tail_cache == h) {
+    q->spsc_tail_cache = atomic_load_explicit(&q->spsc_tail, memory_order_acquire);
+    if (q->spsc_tail_cache != h) break;
+    if (spsc_closed_for(q, BB_PARKED_CONSUMER)) {
+      /* no put in flight: one more look decides between a tray and drained */
+      q->spsc_tail_cache = atomic_load_explicit(&q->spsc_tail, memory_order_acquire);
+      if (q->spsc_tail_cache != h) break;
+      return NULL;
+    }
+    if (!block || spsc_wait(q, &q->spsc_tail, h, BB_PARKED_CONSUMER, deadline))
+      return NULL;
+  }
+  food_tray_t *tray = q->buf[h & q->mask];
+  atomic_store_explicit(&q->spsc_head, h + 1, memory_order_release);
+  spsc_wake(q, &q->spsc_head, BB_PARKED_PRODUCER);
+  return tray;
+}
+
+/* Batched variants publish the whole chunk with a single index store. */
+static int spsc_put_many(bb_t *q, food_tray_t **trays, int n) {
+  int queued = 0;
+  atomic_store(&q->spsc_putting, 1);
+  unsigned t = atomic_load_explicit(&q->spsc_tail, memory_order_relaxed);
+  while (n > 0 && !atomic_load(&q->closed)) {
+    unsigned room = (unsigned)q->cap - (t - q->spsc_head_cache);
+    if (room < (unsigned)n) {
+      q->spsc_head_cache = atomic_load_explicit(&q->spsc_head, memory_order_acquire);
+      room = (unsigned)q->cap - (t - q->spsc_head_cache);
+      if (room == 0) {
+        spsc_wait(q, &q->spsc_head, q->spsc_head_cache, BB_PARKED_PRODUCER, NULL);
+        continue;
+      }
+    }
+    unsigned k = room < (unsigned)n ? room : (unsigned)n;
+    for (unsigned i = 0; i < k; i++) q->buf[(t + i) & q->mask] = trays[i];
+    t += k;
+    atomic_store_explicit(&q->spsc_tail, t, memory_order_release);
+    spsc_wake(q, &q->spsc_tail, BB_PARKED_CONSUMER);
+    trays += k;
+    n -= (int)k;
+    queued += (int)k;
+  }
+  spsc_put_done(q);
+  return queued;
+}
+
+static int spsc_take_many(bb_t *q, food_tray_t **out, int max) {
+  unsigned h = atomic_load_explicit(&q->spsc_head, memory_order_relaxed);
+  unsigned avail = q->spsc_tail_cache - h;
+  while (avail < (unsigned)max) {
+    q->spsc_tail_cache = atomic_load_explicit(&q->spsc_tail, memory_order_acquire);
+    avail = q->spsc_tail_cache - h;
+    if (avail > 0) break;
+    if (spsc_closed_for(q, BB_PARKED_CONSUMER)) {
+      q->spsc_tail_cache = atomic_load_explicit(&q->spsc_tail, memory_order_acquire);
+      avail = q->spsc_tail_cache - h;
+      if (avail > 0) break;
+      return 0;
+    }
+    spsc_wait(q, &q->spsc_tail, h, BB_PARKED_CONSUMER, NULL);
+  }
+  unsigned k = avail < (unsigned)max ? avail : (unsigned)max;
+  for (unsigned i = 0; i < k; i++) out[i] = q->buf[(h + i) & q->mask];
+  atomic_store_explicit(&q->spsc_head, h + k, memory_order_release);
+  spsc_wake(q, &q->spsc_head, BB_PARKED_PRODUCER);
+  return (int)k;
+}
+
+static void spsc_close(bb_t *q) {
+  atomic_store(&q->closed, 1);
+  spsc_kick(q, &q->spsc_head, BB_PARKED_PRODUCER);
+  spsc_kick(q, &q->spsc_tail, BB_PARKED_CONSUMER);
+}
+
+int bb_init_spsc(bb_t *q, int capacity) {
+  if (capacity <= 0) return -1;
+  unsigned ring = 1;
+  while (ring < (unsigned)capacity) ring <<= 1;
+  q->buf = calloc(ring, sizeof(food_tray_t*));
+  if (!q->buf) return -1;
+  q->cap = capacity;
+  q->mask = ring - 1;
+  q->mode = BB_MODE_SPSC;
+  q->head = q->tail = 0;
+  atomic_init(&q->spsc_tail, 0);
+  atomic_init(&q->spsc_head, 0);
+  atomic_init(&q->spsc_parked, 0);
+  atomic_init(&q->spsc_putting, 0);
+  q->spsc_head_cache = 0;
+  q->spsc_tail_cache = 0;
+  q->cells = NULL;
+  bb_wait_init(q);
+  return 0;
+}
+
+/* ------- Bounded Buffer: lock-free MPMC ring ------- */
+/* Bounded queue with per-slot sequence numbers: a producer may claim
+ * position pos (CAS on mpmc_tail) once slot pos % cap has seq == pos, and a
+ * consumer may claim pos (CAS on mpmc_head) once seq == pos + 1. Positions
+ * are 64-bit and never wrap in practice, so any capacity works. Threads only
+ * park when the slot they need is still owned by the other side, i.e. the
+ * ring is really full or empty. */
+
+/* bb_close sets this bit in mpmc_tail: producer CASes fail from then on,
+ * and positions at or beyond the closed tail will never be filled. */
+#define BB_MPMC_CLOSED (1UL << 63)
+
+/* Consumer waiting for pos: true once no producer can fill it any more */
+static bool mpmc_drained(bb_t *q, unsigned long pos) {
+  unsigned long t = atomic_load(&q->mpmc_tail);
+  return (t & BB_MPMC_CLOSED) && pos >= (t & ~BB_MPMC_CLOSED);
+}
+
+/* Claim the next position on 'pos_word' whose slot has seq == pos + ready.
+ * Returns the slot (*claimed receives the position), or NULL if the slot is
+ * still held by the other side and we may not wait (!block), the deadline
+ * passed or the queue is closed (producers) / closed and drained
+ * (consumers). */
+static bb_cell_t* mpmc_claim(bb_t *q, atomic_ulong *pos_word, unsigned long ready,
+                             bb_event_t *ev, unsigned long *claimed,
+                             bool block, const struct timespec *deadline) {
+  int spins = 0, limit = -1;
+  bool parked = false;
+  unsigned long pos = atomic_load_explicit(pos_word, memory_order_relaxed);
+  for (;;) {
+    if (pos & BB_MPMC_CLOSED) return NULL;   /* only mpmc_tail carries the bit */
+    bb_cell_t *c = &q->cells[pos % (unsigned long)q->cap];
+    long diff = (long)(atomic_load_explicit(&c->seq, memory_order_acquire) - (pos + ready));
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(pos_word, &pos, pos + 1,
+                                                memory_order_relaxed, memory_order_relaxed)) {
+        if (spins && !parked) spin_feedback(q, spins);
+        /* The next slot is ready as well: its wake may have gone to a
+         * sleeper that found ours not ready yet and parked again */
+        bb_cell_t *next = &q->cells[(pos + 1) % (unsigned long)q->cap];
+        if (atomic_load_explicit(&next->seq, memory_order_relaxed) == pos + 1 + ready &&
+            atomic_load_explicit(&ev->waiters, memory_order_relaxed))
+          ev_signal(ev, 1);
+        *claimed = pos;
+        return c;
+      }
+    } else if (diff > 0) {
+      pos = atomic_load_explicit(pos_word, memory_order_relaxed);   /* lost the race */
+    } else if (!block || (ready && mpmc_drained(q, pos))) {
+      return NULL;
+    } else {
+      if (limit < 0) limit = spin_limit(q);
+      if (spins < limit) {
+        spins++;
+        cpu_relax();
+        pos = atomic_load_explicit(pos_word, memory_order_relaxed);
+        continue;
+      }
+      if (!parked) {
+        spin_feedback(q, 0);
+        parked = true;
+      }
+      /* Slot still held by the other side: park until it hands one over */
+      unsigned key = ev_prepare(ev);
+      if ((long)(atomic_load(&c->seq) - (pos + ready)) < 0 &&
+          atomic_load(pos_word) == pos && !(ready && mpmc_drained(q, pos))) {
+        if (ev_wait(ev, key, deadline)) {
+          atomic_fetch_add_explicit(&q->waits_timed_out, 1, memory_order_relaxed);
+          return NULL;
+        }
+      } else {
+        ev_cancel(ev);
+      }
+      pos = atomic_load_explicit(pos_word, memory_order_relaxed);
+    }
+  }
+}
+
+static int mpmc_put(bb_t *q, food_tray_t *tray, bool block, const struct timespec *deadline) {
+  unsigned long pos;
+  bb_cell_t *c = mpmc_claim(q, &q->mpmc_tail, 0, &q->not_full, &pos, block, deadline);
+  if (!c) return -1;
+  c->tray = tray;
+  atomic_store_explicit(&c->seq, pos + 1, memory_order_release);
+  ev_signal(&q->not_empty, 1);
+  return 0;
+}
+
+static food_tray_t* mpmc_take(bb_t *q, bool block, const struct timespec *deadline) {
+  unsigned long pos;
+  bb_cell_t *c = mpmc_claim(q, &q->mpmc_head, 1, &q->not_empty, &pos, block, deadline);
+  if (!c) return NULL;
+  food_tray_t *tray = c->tray;
+  atomic_store_explicit(&c->seq, pos + q->cap, memory_order_release);
+  ev_signal(&q->not_full, 1);
+  return tray;
+}
+
+int bb_init_mpmc(bb_t *q, int capacity) {
+  /* With one cell a filled slot (seq pos + 1) looks free to the producer
+   * of pos + 1, which would overwrite it */
+  if (capacity < 2) return -1;
+  q->cells = calloc(capacity, sizeof(bb_cell_t));
+  if (!q->cells) return -1;
+  for (int i = 0; i < capacity; i++) atomic_init(&q->cells[i].seq, (unsigned long)i);
+  q->buf = NULL;
+  q->cap = capacity;
+  q->mode = BB_MODE_MPMC;
+  q->head = q->tail = 0;
+  atomic_init(&q->mpmc_tail, 0);
+  atomic_init(&q->mpmc_head, 0);
+  bb_wait_init(q);
+  return 0;
+}
+
+/* ------- Bounded Buffer: sharded engine ------- */
+/* The capacity is split between the shards, and each shard counts its own
+ * slots and items under its lock, so a put or take that its home shard can
+ * serve touches no state shared with the other shards. A thread's home is
+ * the shard of the CPU it runs on. Producers fill home first and only then
+ * look for room in the following shards; consumers drain home first and
+ * then steal. Threads that find every shard full (empty) spin, then park
+ * on not_full (not_empty), which is only written when someone sleeps
+ * there. Order is FIFO per shard only. bb_close sets closed while holding
+ * every shard lock, so a consumer that saw closed before a pass over all
+ * shards under their locks knows the queue is drained. */
+int sched_getcpu(void);
+static _Thread_local int shard_thread = -1;
+static atomic_uint shard_thread_next;
+
+static int shard_home_index(bb_t *q) {
+  int cpu = sched_getcpu();
+  if (cpu >= 0) return cpu % q->nshards;
+  /* No CPU number: fall back to one fixed home per thread */
+  if (shard_thread < 0)
+    shard_thread = (int)(atomic_fetch_add_explicit(&shard_thread_next, 1, memory_order_relaxed) & INT_MAX);
+  return shard_thread % q->nshards;
+}
+
+/* Stores up to n trays, home shard first. Returns how many, or -1 if the
+ * queue was closed before any went in. */
+static int shard_push(bb_t *q, food_tray_t **trays, int n) {
+  int home = shard_home_index(q), k = 0;
+  for (int i = 0; i < q->nshards && k < n; i++) {
+    bb_shard_t *s = &q->shards[(home + i) % q->nshards];
+    if (atomic_load_explicit(&s->count, memory_order_relaxed) >= s->cap) continue;
+    pthread_mutex_lock(&s->m);
+    if (atomic_load_explicit(&q->closed, memory_order_relaxed)) {
+      pthread_mutex_unlock(&s->m);
+      return k ? k : -1;
+    }
+    while (k < n && (int)(s->tail - s->head) < s->cap) s->buf[s->tail++ & q->mask] = trays[k++];
+    atomic_store_explicit(&s->count, (int)(s->tail - s->head), memory_order_relaxed);
+    pthread_mutex_unlock(&s->m);
+  }
+  return k;
+}
+
+/* Takes up to n trays, home shard first. 'locked' visits every shard under
+ * its lock instead of skipping the ones that look empty. */
+static int shard_pop(bb_t *q, food_tray_t **out, int n, bool locked) {
+  int home = shard_home_index(q), got = 0;
+  for (int i = 0; i < q->nshards && got < n; i++) {
+    bb_shard_t *s = &q->shards[(home + i) % q->nshards];
+    if (!locked && atomic_load_explicit(&s->count, memory_order_relaxed) == 0) continue;
+    pthread_mutex_lock(&s->m);
+    int k = 0;
+    while (got < n && s->head != s->tail) {
+      out[got++] = s->buf[s->head++ & q->mask];
+      k++;
+    }
+    atomic_store_explicit(&s->count, (int)(s->tail - s->head), memory_order_relaxed);
+    pthread_mutex_unlock(&s->m);
+    if (i && k) atomic_fetch_add_explicit(&q->steals, k, memory_order_relaxed);
+  }
+  return got;
+}
+
+/* Some shard has room (producer) or an item (consumer), or the queue is closed */
+static bool shard_ready(bb_t *q, bool producer) {
+  if (atomic_load(&q->closed)) return true;
+  for (int i = 0; i < q->nshards; i++) {
+    int c = atomic_load(&q->shards[i].count);
+    if (producer ? c < q->shards[i].cap : c > 0) return true;
+  }
+  return false;
+}
+
+/* Called after a pass over the shards came back empty-handed: spins while
+ * the budget lasts (*spins counts the rounds, -1 once parked), then sleeps
+ * until a slot/item is handed over. Returns -1 on timeout. */
+static int shard_wait(bb_t *q, bool producer, int *spins, const struct timespec *deadline) {
+  bb_event_t *ev = producer ? &q->not_full : &q->not_empty;
+  if (*spins >= 0) {
+    if (*spins < spin_limit(q)) {
+      (*spins)++;
+      cpu_relax();
+      return 0;
+    }
+    spin_feedback(q, 0);
+    *spins = -1;
+  }
+  unsigned key = ev_prepare(ev);
+  if (shard_ready(q, producer)) {
+    ev_cancel(ev);
+    return 0;
+  }
+  if (ev_wait(ev, key, deadline)) {
+    atomic_fetch_add_explicit(&q->waits_timed_out, 1, memory_order_relaxed);
+    return -1;
+  }
+  return 0;
+}
+
+/* Returns how many of the n trays were queued (at least one), 0 if
+ * !block or the deadline passed, -1 once closed */
+static int shard_put(bb_t *q, food_tray_t **trays, int n, bool block, const struct timespec *deadline) {
+  int spins = 0;
+  for (;;) {
+    if (atomic_load_explicit(&q->closed, memory_order_relaxed)) return -1;
+    int k = shard_push(q, trays, n);
+    if (k) {
+      if (k > 0) {
+        if (spins > 0) spin_feedback(q, spins);
+        ev_signal(&q->not_empty, k);
+      }
+      return k;
+    }
+    if (!block || shard_wait(q, true, &spins, deadline)) return 0;
+  }
+}
+
+/* Returns how many trays were taken (up to max), 0 if !block, the
+ * deadline passed or the queue is closed and drained */
+static int shard_take(bb_t *q, food_tray_t **out, int max, bool block, const struct timespec *deadline) {
+  int spins = 0;
+  for (;;) {
+    bool closed = atomic_load(&q->closed);
+    int got = shard_pop(q, out, max, closed);
+    if (got) {
+      if (spins > 0) spin_feedback(q, spins);
+      ev_signal(&q->not_full, got);
+      return got;
+    }
+    if (closed || !block || shard_wait(q, false, &spins, deadline)) return 0;
+  }
+}
+
+int bb_init_sharded(bb_t *q, int capacity, int nshards) {
+  if (capacity <= 0) return -1;
+  if (nshards <= 0) nshards = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (nshards <= 0) nshards = 1;
+  if (nshards > capacity) nshards = capacity;   /* every shard owns a slot */
+  unsigned ring = 1;
+  while (ring < (unsigned)((capacity + nshards - 1) / nshards)) ring <<= 1;
+  void *mem;
+  if (posix_memalign(&mem, BB_CACHE_LINE, nshards * sizeof(bb_shard_t))) return -1;
+  q->shards = mem;
+  for (int i = 0; i < nshards; i++) {
+    bb_shard_t *s = &q->shards[i];
+    s->buf = calloc(ring, sizeof(food_tray_t*));
+    if (!s->buf) {
+      while (i-- > 0) free(q->shards[i].buf);
+      free(q->shards);
+      return -1;
+    }
+    pthread_mutex_init(&s->m, NULL);
+    s->cap = capacity / nshards + (i < capacity % nshards);
+    s->head = s->tail = 0;
+    atomic_init(&s->count, 0);
+  }
+  q->nshards = nshards;
+  q->buf = NULL;
+  q->cells = NULL;
+  q->cap = capacity;
+  q->mask = ring - 1;
+  q->mode = BB_MODE_SHARDED;
+  q->head = q->tail = 0;
+  atomic_init(&q->steals, 0);
+  bb_wait_init(q);
+  return 0;
+}
+
+/* ------- Bounded Buffer: priority lanes ------- */
+/* empty/full count over all lanes, so the lanes share the capacity; the
+ * lane rings and their stats sit under the bb_t mutex. Aging counts, per
+ * lane, how many takes in a row went to a more urgent lane while this one
+ * had items. */
+
+static void prio_push(bb_t *q, int lane, food_tray_t *tray, uint64_t t) {
+  bb_lane_t *l = &q->lanes[lane];
+  int slot = (l->head + l->count) % q->cap;
+  l->buf[slot] = tray;
+  l->enq_ns[slot] = t;
+  l->count++;
+}
+
+/* NULL if every lane is empty (the caller's unit was a close token) */
+static food_tray_t* prio_pop(bb_t *q) {
+  int pick = -1;
+  for (int i = 0; i < q->nlanes; i++) {
+    if (q->lanes[i].count == 0) continue;
+    if (pick < 0) pick = i;
+    if (q->age_limit > 0 && q->lanes[i].skipped >= q->age_limit) { pick = i; break; }
+  }
+  if (pick < 0) return NULL;
+  for (int i = pick + 1; i < q->nlanes; i++)
+    if (q->lanes[i].count) q->lanes[i].skipped++;
+
+  bb_lane_t *l = &q->lanes[pick];
+  food_tray_t *tray = l->buf[l->head];
+  uint64_t lat = now_ns() - l->enq_ns[l->head];
+  l->head = (l->head + 1) % q->cap;
+  l->count--;
+  l->skipped = 0;
+  l->taken++;
+  if (lat > l->max_ns) l->max_ns = lat;
+  int b = lat ? 63 - __builtin_clzll(lat) : 0;
+  l->hist[b < BB_LAT_BUCKETS ? b : BB_LAT_BUCKETS - 1]++;
+  return tray;
+}
+
+static int sem_put_until(bb_t *q, food_tray_t *tray, int lane, bool block,
+                         const struct timespec *deadline);
+
+int bb_put_prio(bb_t *q, food_tray_t *tray, int lane) {
+  if (q->mode != BB_MODE_PRIO || lane < 0 || lane >= q->nlanes) return -1;
+  uint64_t t0 = TRACE_NOW();
+  int id = tray->tray_id;
+  if (sem_put_until(q, tray, lane, true, NULL)) return -1;
+  TRACE(TR_BB_PUT, q, id, t0);
+  return 0;
+}
+
+static uint64_t lane_percentile(bb_lane_t *l, int pct) {
+  unsigned long rank = (l->taken * pct + 99) / 100;
+  unsigned long seen = 0;
+  for (int b = 0; b < BB_LAT_BUCKETS; b++) {
+    seen += l->hist[b];
+    if (seen >= rank) {
+      uint64_t hi = (2ULL << b) - 1;   /* bucket upper bound */
+      return hi < l->max_ns ? hi : l->max_ns;
+    }
+  }
+  return l->max_ns;
+}
+
+int bb_lane_stats(bb_t *q, int lane, bb_lane_stats_t *out) {
+  if (q->mode != BB_MODE_PRIO || lane < 0 || lane >= q->nlanes) return -1;
+  pthread_mutex_lock(&q->m);
+  bb_lane_t *l = &q->lanes[lane];
+  out->taken = l->taken;
+  out->max_ns = l->max_ns;
+  out->p50_ns = l->taken ? lane_percentile(l, 50) : 0;
+  out->p99_ns = l->taken ? lane_percentile(l, 99) : 0;
+  pthread_mutex_unlock(&q->m);
+  return 0;
+}
+
+static void prio_free_lanes(bb_t *q, int n) {
+  for (int i = 0; i < n; i++) {
+    free(q->lanes[i].buf);
+    free(q->lanes[i].enq_ns);
+  }
+  free(q->lanes);
+}
+
+int bb_init_prio(bb_t *q, int capacity, int nlanes, int age_limit) {
+  if (capacity <= 0 || nlanes <= 0 || age_limit < 0) return -1;
+  q->lanes = calloc(nlanes, sizeof(bb_lane_t));
+  if (!q->lanes) return -1;
+  for (int i = 0; i < nlanes; i++) {
+    q->lanes[i].buf = calloc(capacity, sizeof(food_tray_t*));
+    q->lanes[i].enq_ns = calloc(capacity, sizeof(uint64_t));
+    if (!q->lanes[i].buf || !q->lanes[i].enq_ns) {
+      prio_free_lanes(q, i + 1);
+      return -1;
+    }
   }
+  q->nlanes = nlanes;
+  q->age_limit = age_limit;
+  q->buf = NULL;
+  q->cells = NULL;
+  q->cap = capacity;
+  q->mode = BB_MODE_PRIO;
+  q->head = q->tail = 0;
+  sync_sem_init(&q->empty, capacity);
+  sync_sem_init(&q->full, 0);
+  pthread_mutex_init(&q->m, NULL);
+  bb_wait_init(q);
+  return 0;
+}
+
+int bb_init_engine(bb_t *q, int capacity, const char *engine) {
+  if (strcmp(engine, "locked") == 0) return bb_init(q, capacity);
+  if (strcmp(engine, "spsc") == 0) return bb_init_spsc(q, capacity);
+  if (strcmp(engine, "mpmc") == 0) return bb_init_mpmc(q, capacity);
+  if (strcmp(engine, "sharded") == 0) return bb_init_sharded(q, capacity, 0);
+  if (strncmp(engine, "sharded:", 8) == 0 && atoi(engine + 8) > 0)
+    return bb_init_sharded(q, capacity, atoi(engine + 8));
+  if (strcmp(engine, "prio") == 0) return bb_init_prio(q, capacity, 3, 0);
+  return -1;
 }
 
 /* ------- Bounded Buffer: initialization and operations ------- */
@@ -88,11 +2780,15 @@ int bb_init(bb_t *q, int capacity) {
   // (void)capacity;
   q->buf = calloc(capacity, sizeof(food_tray_t*));
   q->cap = capacity;
+  q->mode = BB_MODE_LOCKED;
+  q->cells = NULL;
   q->head = 0;
   q->tail = 0;
-  sem_init(&q->empty, 0, capacity);
-  sem_init(&q->full, 0, 0);
+  q->items = 0;
+  sync_sem_init(&q->empty, capacity);
+  sync_sem_init(&q->full, 0);
   pthread_mutex_init(&q->m, NULL);
+  bb_wait_init(q);
   return 0;
 }
 
@@ -103,13 +2799,109 @@ void bb_destroy(bb_t *q) {
    * - Free buffer array
    */
   // (void)q;
-  sem_destroy(&q->full);
-  sem_destroy(&q->empty);
-  pthread_mutex_destroy(&q->m);
+  if (q->mode == BB_MODE_LOCKED || q->mode == BB_MODE_PRIO) {
+    sync_sem_destroy(&q->full);
+    sync_sem_destroy(&q->empty);
+    pthread_mutex_destroy(&q->m);
+  }
+  if (q->mode == BB_MODE_PRIO) prio_free_lanes(q, q->nlanes);
+  if (q->mode == BB_MODE_SHARDED) {
+    for (int i = 0; i < q->nshards; i++) {
+      pthread_mutex_destroy(&q->shards[i].m);
+      free(q->shards[i].buf);
+    }
+    free(q->shards);
+  }
   free(q->buf);
+  free(q->cells);
+}
+
+/* Semaphore engines (locked, priority): store n trays the caller holds
+ * empty units for. Fails, storing nothing, once the queue is closed;
+ * closed is only set under the same lock. */
+static bool sem_push(bb_t *q, food_tray_t **trays, int n, int lane) {
+  uint64_t t = q->mode == BB_MODE_PRIO ? now_ns() : 0;
+  pthread_mutex_lock(&q->m);
+  bool ok = !atomic_load_explicit(&q->closed, memory_order_relaxed);
+  for (int i = 0; ok && i < n; i++) {
+    if (q->mode == BB_MODE_PRIO) {
+      prio_push(q, lane, trays[i], t);
+    } else {
+      q->buf[q->tail] = trays[i];
+      q->tail = (q->tail + 1) % q->cap;
+      q->items++;
+    }
+  }
+  pthread_mutex_unlock(&q->m);
+  return ok;
+}
+
+/* Collect trays for the n full units the caller holds. Returns fewer only
+ * after bb_close, whose token units stand for no tray; the caller passes
+ * them on so every blocked consumer gets to see the close. */
+static int sem_pop(bb_t *q, food_tray_t **out, int n) {
+  int k = 0;
+  pthread_mutex_lock(&q->m);
+  if (q->mode == BB_MODE_PRIO) {
+    while (k < n && (out[k] = prio_pop(q)) != NULL) k++;
+  } else {
+    for (; k < n && q->items > 0; k++) {
+      out[k] = q->buf[q->head];
+      q->head = (q->head + 1) % q->cap;
+      q->items--;
+    }
+  }
+  pthread_mutex_unlock(&q->m);
+  return k;
+}
+
+static int sem_put_until(bb_t *q, food_tray_t *tray, int lane, bool block,
+                         const struct timespec *deadline) {
+  if (atomic_load_explicit(&q->closed, memory_order_relaxed)) return -1;
+  if (sem_acquire(q, &q->empty, block, deadline)) return -1;
+  if (!sem_push(q, &tray, 1, lane)) {
+    sem_give(q, &q->empty, 1);   /* closed: hand the unit to the next blocked producer */
+    return -1;
+  }
+  sem_give(q, &q->full, 1);
+  return 0;
+}
+
+/* Shared by the blocking, try and timed entry points; -1 = would block/timed out/closed.
+ * The tray id is read first: once queued, the tray belongs to a consumer. */
+static int put_until(bb_t *q, food_tray_t *tray, bool block, const struct timespec *deadline) {
+  uint64_t t0 = TRACE_NOW();
+  int id = tray->tray_id, rc;
+  if (q->mode == BB_MODE_SPSC) rc = spsc_put(q, tray, block, deadline);
+  else if (q->mode == BB_MODE_MPMC) rc = mpmc_put(q, tray, block, deadline);
+  else if (q->mode == BB_MODE_SHARDED) rc = shard_put(q, &tray, 1, block, deadline) == 1 ? 0 : -1;
+  else rc = sem_put_until(q, tray, q->mode == BB_MODE_PRIO ? q->nlanes - 1 : 0, block, deadline);
+  if (rc == 0) TRACE(TR_BB_PUT, q, id, t0);
+  return rc;
+}
+
+static food_tray_t* take_engine(bb_t *q, bool block, const struct timespec *deadline) {
+  food_tray_t *temp = NULL;
+  if (q->mode == BB_MODE_SPSC) return spsc_take(q, block, deadline);
+  if (q->mode == BB_MODE_MPMC) return mpmc_take(q, block, deadline);
+  if (q->mode == BB_MODE_SHARDED) return shard_take(q, &temp, 1, block, deadline) ? temp : NULL;
+  if (sem_acquire(q, &q->full, block, deadline)) return NULL;
+  if (sem_pop(q, &temp, 1) == 0) {
+    sem_give(q, &q->full, 1);    /* close token: pass it on */
+    return NULL;
+  }
+  sem_give(q, &q->empty, 1);
+  return temp;
 }
 
-void bb_put(bb_t *q, food_tray_t *tray) {
+static food_tray_t* take_until(bb_t *q, bool block, const struct timespec *deadline) {
+  uint64_t t0 = TRACE_NOW();
+  food_tray_t *tray = take_engine(q, block, deadline);
+  if (tray) TRACE(TR_BB_TAKE, q, tray->tray_id, t0);
+  return tray;
+}
+
+int bb_put(bb_t *q, food_tray_t *tray) {
   /* TODO: Put item in buffer (producer)
    * - Wait on empty semaphore
    * - Lock mutex
@@ -120,12 +2912,7 @@ void bb_put(bb_t *q, food_tray_t *tray) {
    */
   // (void)q;
   // (void)tray;
-  sem_wait(&q->empty);
-  pthread_mutex_lock(&q->m);
-  q->buf[q->tail] = tray;
-  q->tail = (q->tail + 1) % q->cap;
-  pthread_mutex_unlock(&q->m);
-  sem_post(&q->full);
+  return put_until(q, tray, true, NULL);
 }
 
 food_tray_t* bb_take(bb_t *q) {
@@ -139,12 +2926,172 @@ food_tray_t* bb_take(bb_t *q) {
    * - Return the tray
    */
   // (void)q;
-  food_tray_t *temp = NULL;
-  sem_wait(&q->full);
+  return take_until(q, true, NULL);
+}
+
+/* ------- Bounded Buffer: non-blocking and deadline-bounded operations ------- */
+int bb_try_put(bb_t *q, food_tray_t *tray) {
+  return put_until(q, tray, false, NULL);
+}
+
+int bb_put_timed(bb_t *q, food_tray_t *tray, const struct timespec *deadline) {
+  return put_until(q, tray, true, deadline);
+}
+
+food_tray_t* bb_try_take(bb_t *q) {
+  return take_until(q, false, NULL);
+}
+
+food_tray_t* bb_take_timed(bb_t *q, const struct timespec *deadline) {
+  return take_until(q, true, deadline);
+}
+
+void bb_wait_stats(bb_t *q, bb_wait_stats_t *out) {
+  out->spun = atomic_load_explicit(&q->waits_spun, memory_order_relaxed);
+  out->parked = atomic_load_explicit(&q->waits_parked, memory_order_relaxed);
+  out->timed_out = atomic_load_explicit(&q->waits_timed_out, memory_order_relaxed);
+  out->spin_budget = spin_limit(q);
+  out->steals = q->mode == BB_MODE_SHARDED ? atomic_load_explicit(&q->steals, memory_order_relaxed) : 0;
+}
+
+/* ------- Bounded Buffer: batched operations ------- */
+/* The semaphore-counted engines (locked, priority) reserve as many
+ * slots/items as are available right away (first one blocking, the rest in
+ * one trywait_many), then move the whole chunk under a single mutex
+ * acquisition and post the chunk at once.
+ * With fsem_t both count adjustments are a single atomic op. The sharded
+ * engine moves as much as fits per shard lock. */
+static int put_many(bb_t *q, food_tray_t **trays, int n) {
+  if (q->mode == BB_MODE_SPSC) return spsc_put_many(q, trays, n);
+  int queued = 0;
+  if (q->mode == BB_MODE_MPMC) {
+    while (queued < n && mpmc_put(q, trays[queued], true, NULL) == 0) queued++;
+    return queued;
+  }
+  if (q->mode == BB_MODE_SHARDED) {
+    for (int k; queued < n && (k = shard_put(q, trays + queued, n - queued, true, NULL)) > 0; )
+      queued += k;
+    return queued;
+  }
+  int lane = q->mode == BB_MODE_PRIO ? q->nlanes - 1 : 0;
+  while (queued < n && !atomic_load_explicit(&q->closed, memory_order_relaxed)) {
+    int k = 1;
+    sem_acquire(q, &q->empty, true, NULL);
+    k += sync_sem_trywait_many(&q->empty, n - queued - 1);
+    if (!sem_push(q, trays + queued, k, lane)) {
+      sem_give(q, &q->empty, k);
+      break;
+    }
+    sem_give(q, &q->full, k);
+    queued += k;
+  }
+  return queued;
+}
+
+static int take_many(bb_t *q, food_tray_t **out, int max) {
+  if (q->mode == BB_MODE_SPSC) return spsc_take_many(q, out, max);
+  if (q->mode == BB_MODE_MPMC) {
+    int k = 0;
+    while (k < max && (out[k] = mpmc_take(q, k == 0, NULL)) != NULL) k++;
+    return k;
+  }
+  if (q->mode == BB_MODE_SHARDED) return shard_take(q, out, max, true, NULL);
+  int k = 1;
+  sem_acquire(q, &q->full, true, NULL);
+  k += sync_sem_trywait_many(&q->full, max - 1);
+  int got = sem_pop(q, out, k);
+  if (got < k) sem_give(q, &q->full, k - got);   /* close token(s): pass on */
+  if (got) sem_give(q, &q->empty, got);
+  return got;
+}
+
+int bb_put_many(bb_t *q, food_tray_t **trays, int n) {
+  uint64_t t0 = TRACE_NOW();
+  int queued = put_many(q, trays, n);
+  if (queued) TRACE(TR_BB_PUT_MANY, q, queued, t0);
+  return queued;
+}
+
+int bb_take_many(bb_t *q, food_tray_t **out, int max) {
+  if (max <= 0) return 0;
+  uint64_t t0 = TRACE_NOW();
+  int got = take_many(q, out, max);
+  if (got) TRACE(TR_BB_TAKE_MANY, q, got, t0);
+  return got;
+}
+
+/* ------- Bounded Buffer: shutdown ------- */
+/* Semaphore engines: closed is set under the lock that guards their
+ * rings, then one extra unit is posted on each semaphore. Whoever wins that
+ * token re-posts it after seeing the close, so blocked threads wake one
+ * after another. Sharded engine: closed is set under every shard lock and
+ * all sleepers are woken. Lock-free engines: see BB_MPMC_CLOSED and
+ * spsc_closed_for. */
+static void mpmc_close(bb_t *q) {
+  atomic_store(&q->closed, 1);
+  atomic_fetch_or(&q->mpmc_tail, BB_MPMC_CLOSED);
+  ev_signal(&q->not_full, INT_MAX);
+  ev_signal(&q->not_empty, INT_MAX);
+}
+
+static void shard_close(bb_t *q) {
+  for (int i = 0; i < q->nshards; i++) pthread_mutex_lock(&q->shards[i].m);
+  atomic_store(&q->closed, 1);
+  for (int i = q->nshards - 1; i >= 0; i--) pthread_mutex_unlock(&q->shards[i].m);
+  ev_signal(&q->not_full, INT_MAX);
+  ev_signal(&q->not_empty, INT_MAX);
+}
+
+void bb_close(bb_t *q) {
+  if (q->mode == BB_MODE_SPSC) { spsc_close(q); return; }
+  if (q->mode == BB_MODE_MPMC) { mpmc_close(q); return; }
+  if (q->mode == BB_MODE_SHARDED) { shard_close(q); return; }
   pthread_mutex_lock(&q->m);
-  temp = q->buf[q->head];
-  q->head = (q->head + 1) % q->cap;
+  int was = atomic_exchange(&q->closed, 1);
   pthread_mutex_unlock(&q->m);
-  sem_post(&q->empty);
-  return temp;
+  if (!was) {
+    sem_give(q, &q->empty, 1);
+    sem_give(q, &q->full, 1);
+  }
+}
+
+/* Polls with a growing sleep: draining is a shutdown step, not a hot path */
+void bb_drain(bb_t *q) {
+  int us = 50;
+  while (bb_count(q) > 0) {
+    usleep(us);
+    if (us < 1000) us *= 2;
+  }
+}
+
+int bb_count(bb_t *q) {
+  int n = 0;
+  switch (q->mode) {
+  case BB_MODE_LOCKED:
+    pthread_mutex_lock(&q->m);
+    n = q->items;
+    pthread_mutex_unlock(&q->m);
+    break;
+  case BB_MODE_SHARDED:
+    for (int i = 0; i < q->nshards; i++)
+      n += atomic_load_explicit(&q->shards[i].count, memory_order_relaxed);
+    break;
+  case BB_MODE_PRIO:
+    pthread_mutex_lock(&q->m);
+    for (int i = 0; i < q->nlanes; i++) n += q->lanes[i].count;
+    pthread_mutex_unlock(&q->m);
+    break;
+  case BB_MODE_SPSC: {
+    /* tail before head: the difference can then only under-count */
+    unsigned t = atomic_load(&q->spsc_tail);
+    n = (int)(t - atomic_load(&q->spsc_head));
+    break;
+  }
+  case BB_MODE_MPMC: {
+    unsigned long t = atomic_load(&q->mpmc_tail) & ~BB_MPMC_CLOSED;
+    n = (int)(long)(t - atomic_load(&q->mpmc_head));
+    break;
+  }
+  }
+  return n < 0 ? 0 : n;
 }
@@ -0,0 +1,19 @@
+#include "sync_utils.h"
+#include <string.h>
+
+/* Usage: trace_decode [--chrome] trace-file
+ *   Prints the records of a trace written between trace_start and
+ *   trace_stop in time order, or with --chrome a trace-event JSON timeline
+ *   (load it in chrome://tracing or ui.perfetto.dev). */
+int main(int argc, char** argv) {
+  bool chrome = argc > 2 && strcmp(argv[1], "--chrome") == 0;
+  if (argc != 2 + chrome) {
+    fprintf(stderr, "usage: %s [--chrome] trace-file\n", argv[0]);
+    return 2;
+  }
+  if (trace_decode(argv[argc - 1], stdout, chrome)) {
+    fprintf(stderr, "%s: not a readable trace\n", argv[argc - 1]);
+    return 1;
+  }
+  return 0;
+}
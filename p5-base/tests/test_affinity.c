@@ -0,0 +1,160 @@
+#define _POSIX_C_SOURCE 200809L
+#include "sync_utils.h"
+#include "test_check.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+/* Thread names and CPU placement in spawn:
+ * - the k-th thread spawned under a name is called name-k, a long name is
+ *   cut so the -k stays; setting the name's policy starts k over
+ * - policies parse (none, compact, scatter, CPU lists), bad ones and CPUs
+ *   we can't run on are refused; compact and scatter each order every
+ *   allowed CPU once
+ * - a thread placed on a CPU runs there from the start
+ * and the round trip of a tray between two threads is reported with both
+ * on one core and, with more than one CPU, on two. */
+int sched_getcpu(void);
+int pthread_getname_np(pthread_t thread, char *name, size_t len);
+
+#define NUM_NAMED 3
+#define LONG_NAME "registrationdesk"
+#define ROUND_TRIPS 20000
+
+typedef struct {
+  char name[16];
+  int cpu;
+} seen_t;
+
+static void* report(void* arg) {
+  seen_t *s = arg;
+  pthread_getname_np(pthread_self(), s->name, sizeof(s->name));
+  s->cpu = sched_getcpu();
+  return NULL;
+}
+
+static void names(void) {
+  seen_t seen[NUM_NAMED + 1];
+  pthread_t t;
+  int ok = 1;
+  for (int i = 0; i < NUM_NAMED; i++) {
+    char expect[16];
+    join(spawn(report, &seen[i], "usher"));
+    snprintf(expect, sizeof(expect), "usher-%d", i);
+    ok &= strcmp(seen[i].name, expect) == 0;
+  }
+  check(ok, "threads spawned as usher are usher-0, usher-1, usher-2");
+
+  t = spawn(report, &seen[NUM_NAMED], LONG_NAME);
+  join(t);
+  check(strcmp(seen[NUM_NAMED].name, "registrationd-0") == 0, "a long name is cut to keep its -k");
+
+  affinity_set("usher", "none");
+  join(spawn(report, &seen[0], "usher"));
+  check(strcmp(seen[0].name, "usher-0") == 0, "setting a name's policy starts its count over");
+}
+
+/* Number of CPUs the policy goes through before wrapping */
+static int period(const char *name) {
+  int k = 1;
+  while (k < 4096 && affinity_cpu(name, k) != affinity_cpu(name, 0)) k++;
+  return k;
+}
+
+static void policies(void) {
+  char what[160], first[16];
+  check(affinity_set("p", "none") == 0 && affinity_cpu("p", 0) == -1, "none leaves threads unpinned");
+  check(affinity_set("p", "compact") == 0 && affinity_set("p", "scatter") == 0, "compact and scatter accepted");
+  check(affinity_set("p", "bogus") == -1 && affinity_set("p", "1-") == -1 && affinity_set("p", "3-1") == -1 &&
+        affinity_set("p", "0,,1") == -1 && affinity_set("p", "4095") == -1,
+        "bad policies and CPUs we can't run on refused");
+
+  affinity_set("compact", "compact");
+  affinity_set("scatter", "scatter");
+  int n = period("compact"), distinct = 1;
+  for (int i = 0; i < n; i++) {
+    int found = 0;
+    for (int k = 0; k < i; k++) distinct &= affinity_cpu("compact", k) != affinity_cpu("compact", i);
+    for (int k = 0; k < n; k++) found |= affinity_cpu("scatter", k) == affinity_cpu("compact", i);
+    distinct &= found && affinity_cpu("compact", i) >= 0;
+  }
+  snprintf(what, sizeof(what), "compact and scatter each take the %d allowed CPUs once, then wrap", n);
+  check(distinct && period("scatter") == n, what);
+
+  snprintf(first, sizeof(first), "%d", affinity_cpu("compact", 0));
+  snprintf(what, sizeof(what), "p=%s;none", first);
+  check(affinity_config(what) == 0 && affinity_cpu("p", 0) == atoi(first) && affinity_cpu("q", 0) == -1,
+        "affinity_config sets a name's policy and the default");
+  check(affinity_config("p=compact;q=nope") == -1, "affinity_config refuses a bad item");
+
+  seen_t s;
+  int last = affinity_cpu("compact", n - 1);
+  snprintf(first, sizeof(first), "%d", last);
+  affinity_set("pinned", first);
+  join(spawn(report, &s, "pinned"));
+  snprintf(what, sizeof(what), "thread placed on CPU %d ran on CPU %d", last, s.cpu);
+  check(s.cpu == last, what);
+}
+
+/* ---- Handoff cost ---- */
+static bb_t ping, pong;
+
+static void* server(void* arg) {
+  (void)arg;
+  for (food_tray_t *t; (t = bb_take(&ping)) != NULL; ) bb_put(&pong, t);
+  return NULL;
+}
+
+static void* client(void* arg) {
+  food_tray_t *t = create_food_tray(1, "Coffee", 0);
+  uint64_t t0 = now_ns();
+  for (int i = 0; i < ROUND_TRIPS; i++) {
+    bb_put(&ping, t);
+    t = bb_take(&pong);
+  }
+  *(double*)arg = (now_ns() - t0) / (double)ROUND_TRIPS;
+  free_food_tray(t);
+  bb_close(&ping);
+  return NULL;
+}
+
+static double handoff(int client_cpu, int server_cpu) {
+  char cpu[16];
+  double ns = 0;
+  bb_init(&ping, 1);
+  bb_init(&pong, 1);
+  snprintf(cpu, sizeof(cpu), "%d", client_cpu);
+  affinity_set("client", cpu);
+  snprintf(cpu, sizeof(cpu), "%d", server_cpu);
+  affinity_set("server", cpu);
+  pthread_t s = spawn(server, NULL, "server");
+  join(spawn(client, &ns, "client"));
+  join(s);
+  bb_destroy(&ping);
+  bb_destroy(&pong);
+  return ns;
+}
+
+static void handoffs(void) {
+  int a = affinity_cpu("scatter", 0), b = affinity_cpu("scatter", 1);
+  double same = handoff(a, a);
+  check(same > 0, "tray round trips with both threads on one CPU");
+  LOG("Round trip on CPU %d: %.0f ns", a, same);
+  if (a != b) {
+    double cross = handoff(a, b);
+    check(cross > 0, "tray round trips with the threads on two CPUs");
+    LOG("Round trip between CPU %d and CPU %d: %.0f ns", a, b, cross);
+  } else {
+    LOG("One CPU here: cross-CPU handoff not measured");
+  }
+}
+
+int main() {
+  LOG("=== Test: thread names and CPU placement ===");
+  names();
+  policies();
+  handoffs();
+
+  return test_finish("Affinity");
+}
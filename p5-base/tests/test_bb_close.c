@@ -0,0 +1,153 @@
+#define _POSIX_C_SOURCE 200809L
+#include "sync_utils.h"
+#include "test_check.h"
+#include <assert.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+
+/* bb_close / bb_drain on every engine.
+ * - threads blocked in bb_take / bb_put are woken by bb_close
+ * - after close, puts fail and takes drain what is left, then return NULL
+ * - bb_drain returns once a consumer has emptied the buffer
+ * - producers and consumers racing with close: every tray that was put is
+ *   taken exactly once (nothing is stranded in a closed buffer) */
+int usleep(unsigned int usec);
+
+static bb_t test_queue;
+
+#define CAPACITY 4
+#define MAX_THREADS 4
+
+static void* blocked_taker(void* arg) {
+  food_tray_t **out = arg;
+  *out = bb_take(&test_queue);
+  return NULL;
+}
+
+static void* blocked_putter(void* arg) {
+  int *rc = arg;
+  food_tray_t *tray = create_food_tray(-1, "Taco", 0);
+  *rc = bb_put(&test_queue, tray);
+  if (*rc) free_food_tray(tray);
+  return NULL;
+}
+
+static void* slow_taker(void* arg) {
+  int *taken = arg;
+  for (food_tray_t *t; (t = bb_take(&test_queue)) != NULL; (*taken)++) {
+    free_food_tray(t);
+    usleep(2000);
+  }
+  return NULL;
+}
+
+static void* racing_putter(void* arg) {
+  long *puts = arg;
+  for (int i = 0;; i++) {
+    food_tray_t *tray = create_food_tray(i, "Wrap", 0);
+    if (bb_put(&test_queue, tray)) {
+      free_food_tray(tray);
+      return NULL;
+    }
+    (*puts)++;
+  }
+}
+
+static void* racing_taker(void* arg) {
+  long *takes = arg;
+  for (food_tray_t *t; (t = bb_take(&test_queue)) != NULL; (*takes)++) free_food_tray(t);
+  return NULL;
+}
+
+static void run_engine(const char *engine) {
+  char what[160];
+  /* The SPSC ring allows only one producer and one consumer thread */
+  int nthreads = (engine[0] == 's' && engine[1] == 'p') ? 1 : MAX_THREADS;
+  pthread_t th[2 * MAX_THREADS];
+  LOG("\n=== Engine: %s ===", engine);
+
+  /* Consumers blocked on an empty buffer */
+  bb_init_engine(&test_queue, CAPACITY, engine);
+  food_tray_t *got[MAX_THREADS];
+  for (int i = 0; i < nthreads; i++) pthread_create(&th[i], NULL, blocked_taker, &got[i]);
+  usleep(30000);
+  bb_close(&test_queue);
+  int all_null = 1;
+  for (int i = 0; i < nthreads; i++) {
+    pthread_join(th[i], NULL);
+    if (got[i]) all_null = 0;
+  }
+  snprintf(what, sizeof(what), "[%s] close wakes %d blocked consumer(s) with NULL", engine, nthreads);
+  check(all_null, what);
+  bb_destroy(&test_queue);
+
+  /* Producers blocked on a full buffer, then drain after close */
+  bb_init_engine(&test_queue, CAPACITY, engine);
+  for (int i = 0; i < CAPACITY; i++) bb_put(&test_queue, create_food_tray(i, "Burger", 0));
+  int rc[MAX_THREADS];
+  for (int i = 0; i < nthreads; i++) pthread_create(&th[i], NULL, blocked_putter, &rc[i]);
+  usleep(30000);
+  bb_close(&test_queue);
+  int all_failed = 1;
+  for (int i = 0; i < nthreads; i++) {
+    pthread_join(th[i], NULL);
+    if (rc[i] != -1) all_failed = 0;
+  }
+  snprintf(what, sizeof(what), "[%s] close fails %d blocked producer(s)", engine, nthreads);
+  check(all_failed, what);
+  food_tray_t *extra = create_food_tray(99, "Taco", 0);
+  snprintf(what, sizeof(what), "[%s] bb_put after close fails fast", engine);
+  check(bb_put(&test_queue, extra) == -1 && bb_try_put(&test_queue, extra) == -1, what);
+  free_food_tray(extra);
+  int drained = 0;
+  for (food_tray_t *t; (t = bb_take(&test_queue)) != NULL; drained++) free_food_tray(t);
+  snprintf(what, sizeof(what), "[%s] takes drain %d/%d buffered trays, then return NULL",
+           engine, drained, CAPACITY);
+  check(drained == CAPACITY && bb_take(&test_queue) == NULL, what);
+  bb_destroy(&test_queue);
+
+  /* bb_drain waits for a slow consumer */
+  bb_init_engine(&test_queue, CAPACITY, engine);
+  for (int i = 0; i < CAPACITY; i++) bb_put(&test_queue, create_food_tray(i, "Salad Bowl", 0));
+  int taken = 0;
+  pthread_create(&th[0], NULL, slow_taker, &taken);
+  bb_drain(&test_queue);
+  int count_after = bb_count(&test_queue);
+  bb_close(&test_queue);
+  pthread_join(th[0], NULL);
+  snprintf(what, sizeof(what), "[%s] bb_drain returns once the buffer is empty", engine);
+  check(count_after == 0 && taken == CAPACITY, what);
+  bb_destroy(&test_queue);
+
+  /* Race: close while producers and consumers are running flat out */
+  int lost_rounds = 0;
+  long total_puts = 0;
+  for (int round = 0; round < 5; round++) {
+    long puts[MAX_THREADS] = {0}, takes[MAX_THREADS] = {0};
+    bb_init_engine(&test_queue, CAPACITY, engine);
+    for (int i = 0; i < nthreads; i++) {
+      pthread_create(&th[i], NULL, racing_putter, &puts[i]);
+      pthread_create(&th[nthreads + i], NULL, racing_taker, &takes[i]);
+    }
+    usleep(10000);
+    bb_close(&test_queue);
+    long p = 0, t = 0;
+    for (int i = 0; i < 2 * nthreads; i++) pthread_join(th[i], NULL);
+    for (int i = 0; i < nthreads; i++) { p += puts[i]; t += takes[i]; }
+    if (p != t || bb_count(&test_queue) != 0) lost_rounds++;
+    total_puts += p;
+    bb_destroy(&test_queue);
+  }
+  snprintf(what, sizeof(what), "[%s] racing close: every put tray taken exactly once (%ld trays)",
+           engine, total_puts);
+  check(lost_rounds == 0, what);
+}
+
+int main() {
+  LOG("=== Test: bb_close / bb_drain ===");
+  const char *engines[] = { "locked", "spsc", "mpmc", "sharded:4", "prio" };
+  for (int i = 0; i < 5; i++) run_engine(engines[i]);
+
+  return test_finish("bb_close");
+}
@@ -0,0 +1,111 @@
+#define _POSIX_C_SOURCE 200809L
+#include "sync_utils.h"
+#include "bb_generic.h"
+#include "test_check.h"
+#include <assert.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+
+/* Macro-generated inline-storage queues (BB_DEFINE).
+ * A by-value message queue is checked single-threaded (FIFO, wrap-around,
+ * try ops on full/empty) and under MPMC load (per-producer order, no loss),
+ * and a food_tray_t* instantiation stands in for bb_t. */
+
+typedef struct {
+  int producer;
+  int seq;
+} msg_t;
+
+BB_DEFINE(msgq, msg_t, 8)
+BB_DEFINE(trayq, food_tray_t*, 4)
+
+static msgq_t test_queue;
+
+#define NUM_PRODUCERS 2
+#define NUM_CONSUMERS 2
+#define PER_PRODUCER  100000
+
+static int last_seq[NUM_CONSUMERS][NUM_PRODUCERS];
+static long consumed[NUM_CONSUMERS];
+
+static void* producer_thread(void* arg) {
+  int id = (int)(long)arg;
+  for (int i = 0; i < PER_PRODUCER; i++)
+    msgq_put(&test_queue, (msg_t){ id, i });
+  return NULL;
+}
+
+static void* consumer_thread(void* arg) {
+  int id = (int)(long)arg;
+  for (int p = 0; p < NUM_PRODUCERS; p++) last_seq[id][p] = -1;
+  for (int i = 0; i < NUM_PRODUCERS * PER_PRODUCER / NUM_CONSUMERS; i++) {
+    msg_t m = msgq_take(&test_queue);
+    /* A single consumer must see each producer's messages in order */
+    if (m.seq <= last_seq[id][m.producer]) test_passed = 0;
+    last_seq[id][m.producer] = m.seq;
+    consumed[id]++;
+  }
+  return NULL;
+}
+
+static double elapsed_ns(struct timespec a, struct timespec b) {
+  return (b.tv_sec - a.tv_sec) * 1e9 + (b.tv_nsec - a.tv_nsec);
+}
+
+int main() {
+  LOG("=== Test: BB_DEFINE inline-storage queues ===");
+
+  /* Single thread: fill, reject, drain across the wrap point */
+  msgq_init(&test_queue);
+  int ok = 1;
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < 8; i++) ok &= msgq_try_put(&test_queue, (msg_t){ 0, round * 8 + i }) == 0;
+    ok &= msgq_try_put(&test_queue, (msg_t){ 0, -1 }) == -1;
+    ok &= msgq_count(&test_queue) == 8;
+    for (int i = 0; i < 8; i++) {
+      msg_t m;
+      ok &= msgq_try_take(&test_queue, &m) == 0 && m.seq == round * 8 + i;
+    }
+    msg_t m;
+    ok &= msgq_try_take(&test_queue, &m) == -1;
+  }
+  check(ok, "by-value FIFO, wrap-around and try ops on full/empty");
+
+  /* Uncontended cost: no allocation per message */
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (int i = 0; i < PER_PRODUCER; i++) {
+    msgq_put(&test_queue, (msg_t){ 0, i });
+    if (msgq_take(&test_queue).seq != i) test_passed = 0;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  LOG("Uncontended put+take: %.1f ns/pair", elapsed_ns(t0, t1) / PER_PRODUCER);
+
+  /* MPMC */
+  pthread_t prod[NUM_PRODUCERS], cons[NUM_CONSUMERS];
+  for (long i = 0; i < NUM_CONSUMERS; i++) pthread_create(&cons[i], NULL, consumer_thread, (void*)i);
+  for (long i = 0; i < NUM_PRODUCERS; i++) pthread_create(&prod[i], NULL, producer_thread, (void*)i);
+  for (int i = 0; i < NUM_PRODUCERS; i++) pthread_join(prod[i], NULL);
+  for (int i = 0; i < NUM_CONSUMERS; i++) pthread_join(cons[i], NULL);
+  long total = 0;
+  for (int i = 0; i < NUM_CONSUMERS; i++) total += consumed[i];
+  check(total == NUM_PRODUCERS * PER_PRODUCER && msgq_count(&test_queue) == 0,
+        "MPMC: every message delivered once, per-producer order kept");
+  msgq_destroy(&test_queue);
+
+  /* Pointer instantiation, equivalent to a fixed-size bb_t */
+  trayq_t tq;
+  trayq_init(&tq);
+  for (int i = 0; i < 4; i++) trayq_put(&tq, create_food_tray(i, "Wrap", 0));
+  ok = trayq_try_put(&tq, NULL) == -1;
+  for (int i = 0; i < 4; i++) {
+    food_tray_t *t = trayq_take(&tq);
+    ok &= t->tray_id == i;
+    free_food_tray(t);
+  }
+  trayq_destroy(&tq);
+  check(ok, "food_tray_t* instantiation behaves like bb_t");
+
+  return test_finish("BB_DEFINE queue");
+}
@@ -0,0 +1,111 @@
+#define _POSIX_C_SOURCE 200809L
+#include "sync_utils.h"
+#include "test_check.h"
+#include <assert.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+
+/* Priority-lane bounded buffer (bb_init_prio).
+ * Checks lane order and shared capacity single-threaded, the aging knob,
+ * and that urgent trays keep a low p99 while the bulk lane is saturated. */
+int usleep(unsigned int usec);
+
+static bb_t test_queue;
+
+/* Takes n trays and compares their ids with expect[] */
+static int take_expect(const int *expect, int n) {
+  int ok = 1;
+  for (int i = 0; i < n; i++) {
+    food_tray_t *t = bb_take(&test_queue);
+    if (t->tray_id != expect[i]) {
+      LOG("  take %d: expected tray #%d, got #%d", i, expect[i], t->tray_id);
+      ok = 0;
+    }
+    free_food_tray(t);
+  }
+  return ok;
+}
+
+#define BULK_ITEMS   4000
+#define URGENT_ITEMS 200
+#define LAT_CAP      16
+
+static void* bulk_cook(void* arg) {
+  (void)arg;
+  for (int i = 0; i < BULK_ITEMS; i++) bb_put(&test_queue, create_food_tray(i, "Pasta Bowl", 0));
+  return NULL;
+}
+
+static void* urgent_cook(void* arg) {
+  (void)arg;
+  for (int i = 0; i < URGENT_ITEMS; i++) {
+    usleep(200);
+    bb_put_prio(&test_queue, create_food_tray(100000 + i, "Sushi Roll", 1), 0);
+  }
+  return NULL;
+}
+
+static void* attendee(void* arg) {
+  (void)arg;
+  for (int i = 0; i < BULK_ITEMS + URGENT_ITEMS; i++) {
+    free_food_tray(bb_take(&test_queue));
+    if (i % 4 == 0) usleep(20);
+  }
+  return NULL;
+}
+
+int main() {
+  LOG("=== Test: Priority-lane bounded buffer ===");
+
+  /* Lane order: most urgent non-empty lane first, FIFO within a lane */
+  bb_init_prio(&test_queue, 6, 3, 0);
+  bb_put(&test_queue, create_food_tray(20, "Wrap", 0));          // lane 2 (default)
+  bb_put_prio(&test_queue, create_food_tray(10, "Salad Bowl", 0), 1);
+  bb_put(&test_queue, create_food_tray(21, "Wrap", 0));
+  bb_put_prio(&test_queue, create_food_tray(0, "Sushi Roll", 0), 0);
+  bb_put_prio(&test_queue, create_food_tray(11, "Salad Bowl", 0), 1);
+  bb_put_prio(&test_queue, create_food_tray(1, "Sushi Roll", 0), 0);
+  food_tray_t *extra = create_food_tray(99, "Taco", 0);
+  check(bb_try_put(&test_queue, extra) == -1 && bb_count(&test_queue) == 6,
+        "lanes share one capacity");
+  free_food_tray(extra);
+  check(bb_put_prio(&test_queue, NULL, 3) == -1, "bb_put_prio rejects an unknown lane");
+  const int order[] = { 0, 1, 10, 11, 20, 21 };
+  check(take_expect(order, 6), "takes serve lane 0, then 1, then 2, FIFO within each");
+  bb_destroy(&test_queue);
+
+  /* Aging: with age_limit 2, a waiting bulk tray is served after being
+   * passed over twice, even though urgent trays are still queued */
+  bb_init_prio(&test_queue, 8, 2, 2);
+  bb_put(&test_queue, create_food_tray(50, "Wrap", 0));
+  bb_put(&test_queue, create_food_tray(51, "Wrap", 0));
+  for (int i = 0; i < 5; i++) bb_put_prio(&test_queue, create_food_tray(i, "Sushi Roll", 0), 0);
+  const int aged[] = { 0, 1, 50, 2, 3, 51, 4 };
+  check(take_expect(aged, 7), "age_limit 2 interleaves the starved lane every third take");
+  bb_destroy(&test_queue);
+
+  /* Latency: bulk cook fills the buffer and keeps it full, urgent trays
+   * must not wait behind it */
+  bb_init_prio(&test_queue, LAT_CAP, 2, 0);
+  pthread_t bulk, urgent, consumer;
+  pthread_create(&bulk, NULL, bulk_cook, NULL);
+  while (bb_count(&test_queue) < LAT_CAP) usleep(100);
+  pthread_create(&urgent, NULL, urgent_cook, NULL);
+  pthread_create(&consumer, NULL, attendee, NULL);
+  pthread_join(bulk, NULL);
+  pthread_join(urgent, NULL);
+  pthread_join(consumer, NULL);
+  bb_lane_stats_t hi, lo;
+  bb_lane_stats(&test_queue, 0, &hi);
+  bb_lane_stats(&test_queue, 1, &lo);
+  LOG("lane 0: %lu taken, p50 %llu ns, p99 %llu ns, max %llu ns", hi.taken,
+      (unsigned long long)hi.p50_ns, (unsigned long long)hi.p99_ns, (unsigned long long)hi.max_ns);
+  LOG("lane 1: %lu taken, p50 %llu ns, p99 %llu ns, max %llu ns", lo.taken,
+      (unsigned long long)lo.p50_ns, (unsigned long long)lo.p99_ns, (unsigned long long)lo.max_ns);
+  check(hi.taken == URGENT_ITEMS && lo.taken == BULK_ITEMS, "per-lane stats count every take");
+  check(hi.p99_ns < lo.p99_ns, "urgent lane p99 below the saturated bulk lane's p99");
+  bb_destroy(&test_queue);
+
+  return test_finish("Priority-lane");
+}
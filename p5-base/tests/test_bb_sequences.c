@@ -9,11 +9,14 @@ int usleep(unsigned int usec);
 // Shared test data
 static bb_t test_queue;
 static int test_passed = 1;
+static int (*queue_init)(bb_t *q, int capacity) = bb_init;
 
 // Thread action types
 typedef enum {
   ACTION_PRODUCE,
-  ACTION_CONSUME
+  ACTION_CONSUME,
+  ACTION_PRODUCE_MANY,   // bb_put_many of 'count' trays: value, value+1, ...
+  ACTION_CONSUME_MANY    // bb_take_many of up to 'count', expecting 'expect' trays from value
 } action_type_t;
 
 // Thread action description
@@ -25,6 +28,13 @@ typedef struct {
   const char *food_name; // Food name for the tray
 } action_t;
 
+// Batch action: value is the first tray_id of the batch
+typedef struct {
+  action_t a;
+  int count;           // Trays to put / max trays to take
+  int expect;          // Consume: how many trays bb_take_many should return
+} batch_action_t;
+
 // Note: We don't check buffer counts in sequential tests because
 // semaphores handle correctness internally. We only verify FIFO ordering.
 
@@ -68,6 +78,42 @@ static void* thread_func(void* arg) {
     LOG("PASS [P%d]: Successfully produced tray #%d", 
         action->thread_id, action->value);
     
+  } else if (action->type == ACTION_PRODUCE_MANY) {
+    batch_action_t *batch = (batch_action_t*)action;
+    food_tray_t *trays[batch->count];
+    LOG("Producer%d: Starting (step %d), putting %d trays #%d..#%d with %s",
+        action->thread_id, action->action_index, batch->count,
+        action->value, action->value + batch->count - 1, action->food_name);
+    for (int i = 0; i < batch->count; i++)
+      trays[i] = create_food_tray(action->value + i, action->food_name, action->thread_id);
+    bb_put_many(&test_queue, trays, batch->count);
+    LOG("PASS [P%d]: Successfully produced %d trays in one batch",
+        action->thread_id, batch->count);
+
+  } else if (action->type == ACTION_CONSUME_MANY) {
+    batch_action_t *batch = (batch_action_t*)action;
+    food_tray_t *trays[batch->count];
+    LOG("Consumer%d: Starting (step %d), taking up to %d trays",
+        action->thread_id, action->action_index, batch->count);
+    int got = bb_take_many(&test_queue, trays, batch->count);
+    if (got != batch->expect) {
+      LOG("FAIL [C%d batch size]: Expected %d trays, got %d",
+          action->thread_id, batch->expect, got);
+      test_passed = 0;
+    }
+    for (int i = 0; i < got; i++) {
+      if (trays[i]->tray_id != action->value + i) {
+        LOG("FAIL [C%d tray_id]: Expected tray_id=%d at batch index %d, got %d",
+            action->thread_id, action->value + i, i, trays[i]->tray_id);
+        test_passed = 0;
+      }
+      free_food_tray(trays[i]);
+    }
+    if (got == batch->expect) {
+      LOG("PASS [C%d]: Got %d trays #%d..#%d in FIFO order",
+          action->thread_id, got, action->value, action->value + got - 1);
+    }
+
   } else { // ACTION_CONSUME
     snprintf(label, sizeof(label), "C%d consuming", action->thread_id);
     LOG("Consumer%d: Starting (step %d)", action->thread_id, action->action_index);
@@ -97,7 +143,7 @@ static void* thread_func(void* arg) {
 }
 
 // Run a sequence of actions
-static int run_sequence(const char *name, action_t *actions, int num_actions, int buffer_size) {
+static int run_steps(const char *name, action_t **actions, int num_actions, int buffer_size) {
   LOG("\n=== Test: %s ===", name);
   test_passed = 1;
   
@@ -106,13 +152,13 @@ static int run_sequence(const char *name, action_t *actions, int num_actions, in
   current_action = 0;
   pthread_mutex_unlock(&seq_mutex);
   
-  bb_init(&test_queue, buffer_size);
+  queue_init(&test_queue, buffer_size);
   
   pthread_t threads[num_actions];
   
   // Create all threads (they'll wait for their turn)
   for (int i = 0; i < num_actions; i++) {
-    pthread_create(&threads[i], NULL, thread_func, &actions[i]);
+    pthread_create(&threads[i], NULL, thread_func, actions[i]);
   }
   
   // Wait for all threads to complete
@@ -131,6 +177,12 @@ static int run_sequence(const char *name, action_t *actions, int num_actions, in
   }
 }
 
+static int run_sequence(const char *name, action_t *actions, int num_actions, int buffer_size) {
+  action_t *steps[num_actions];
+  for (int i = 0; i < num_actions; i++) steps[i] = &actions[i];
+  return run_steps(name, steps, num_actions, buffer_size);
+}
+
 int main(void) {
   int total_passed = 0;
   int total_tests = 0;
@@ -201,6 +253,48 @@ int main(void) {
     if (run_sequence("FIFO-P1->P2->P3->P4->C1->C2->C3->C4", sequence, 8, 5) == 0) total_passed++;
   }
   
+  // Test 6: Batches that wrap around the ring, with partial takes (capacity 4)
+  //   P1 puts #1-#3, C1 takes 2 (#1,#2), P2 puts #4-#6 (wraps to slots 3,0,1),
+  //   C2 asks for 8 and gets the 4 queued (#3-#6), P3 puts #7,#8, C3 asks for 4 and gets 2
+  {
+    batch_action_t sequence[] = {
+      {{ACTION_PRODUCE_MANY, 1, 0, 1, "Bagel"},  3, 0},
+      {{ACTION_CONSUME_MANY, 1, 1, 1, NULL},     2, 2},
+      {{ACTION_PRODUCE_MANY, 2, 2, 4, "Muffin"}, 3, 0},
+      {{ACTION_CONSUME_MANY, 2, 3, 3, NULL},     8, 4},
+      {{ACTION_PRODUCE_MANY, 3, 4, 7, "Donut"},  2, 0},
+      {{ACTION_CONSUME_MANY, 3, 5, 7, NULL},     4, 2}
+    };
+    action_t *steps[6];
+    for (int i = 0; i < 6; i++) steps[i] = &sequence[i].a;
+    const struct { const char *name; int (*init)(bb_t*, int); } engines[] = {
+      {"BATCH-WRAP-LOCKED", bb_init},
+      {"BATCH-WRAP-SPSC",   bb_init_spsc},
+      {"BATCH-WRAP-MPMC",   bb_init_mpmc}
+    };
+    for (int e = 0; e < 3; e++) {
+      queue_init = engines[e].init;
+      total_tests++;
+      if (run_steps(engines[e].name, steps, 6, 4) == 0) total_passed++;
+    }
+    queue_init = bb_init;
+  }
+
+  // Test 7: the MPMC ring needs two cells (with one, a full slot looks free
+  // to the next producer)
+  {
+    bb_t q;
+    bool refused = bb_init_mpmc(&q, 1) == -1, two = bb_init_mpmc(&q, 2) == 0;
+    total_tests++;
+    if (two) bb_destroy(&q);
+    if (refused && two) {
+      total_passed++;
+      LOG("=== MPMC-CAPACITY: PASSED ===\n");
+    } else {
+      LOG("=== MPMC-CAPACITY: FAILED ===\n");
+    }
+  }
+
   LOG("\n=== SUMMARY ===");
   LOG("Passed: %d/%d tests", total_passed, total_tests);
   
@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 /* Stress test for bounded buffer - tests for race conditions */
@@ -37,24 +38,32 @@ static const char* food_names[] = {
 };
 static const int num_food_types = 8;
 
+// Items currently in the buffer. The default engine is inspected directly
+// under its mutex; the lock-free engines report through bb_count().
+static int buffer_count(void) {
+  int count = 0;
+  if (test_queue.mode != BB_MODE_LOCKED) return bb_count(&test_queue);
+  pthread_mutex_lock(&test_queue.m);
+  count = (test_queue.tail - test_queue.head + test_queue.cap) % test_queue.cap;
+  pthread_mutex_unlock(&test_queue.m);
+  return count;
+}
+
 // Producer thread
 static void* producer_thread(void* arg) {
   int producer_id = *(int*)arg;
   
   for (int i = 0; i < ITEMS_PER_PRODUCER; i++) {
     // Random delay before producing
-    usleep(rand() % MAX_SLEEP_US);
+    usleep(rng_below(MAX_SLEEP_US));
     
     // Create unique tray_id: producer_id * 1000 + item_number
     int tray_id = producer_id * 1000 + i;
     
     // Check buffer state before putting
-    int count_before = 0;
-    pthread_mutex_lock(&test_queue.m);
-    count_before = (test_queue.tail - test_queue.head + test_queue.cap) % test_queue.cap;
-    pthread_mutex_unlock(&test_queue.m);
+    int count_before = buffer_count();
     
-    if (count_before >= test_queue.cap) {
+    if (count_before > test_queue.cap) {
       pthread_mutex_lock(&violation_mutex);
       LOG("OVERFLOW WARNING: Producer%d sees buffer full before put (count=%d, cap=%d)", 
           producer_id, count_before, test_queue.cap);
@@ -63,7 +72,7 @@ static void* producer_thread(void* arg) {
     }
     
     // Create a food tray
-    const char* food = food_names[rand() % num_food_types];
+    const char* food = food_names[rng_below(num_food_types)];
     food_tray_t *tray = create_food_tray(tray_id, food, producer_id);
     
     bb_put(&test_queue, tray);
@@ -77,7 +86,7 @@ static void* producer_thread(void* arg) {
         producer_id, tray_id, food, i+1, ITEMS_PER_PRODUCER);
     
     // Small delay while holding conceptual "producer slot"
-    usleep(rand() % 500);
+    usleep(rng_below(500));
   }
   
   return NULL;
@@ -95,13 +104,10 @@ static void* consumer_thread(void* arg) {
   
   for (int i = 0; i < items_to_consume; i++) {
     // Random delay before consuming
-    usleep(rand() % MAX_SLEEP_US);
+    usleep(rng_below(MAX_SLEEP_US));
     
     // Check buffer state before taking
-    int count_before = 0;
-    pthread_mutex_lock(&test_queue.m);
-    count_before = (test_queue.tail - test_queue.head + test_queue.cap) % test_queue.cap;
-    pthread_mutex_unlock(&test_queue.m);
+    int count_before = buffer_count();
     
     if (count_before < 0) {
       pthread_mutex_lock(&violation_mutex);
@@ -122,7 +128,7 @@ static void* consumer_thread(void* arg) {
         consumer_id, tray->tray_id, tray->food_name, i+1, items_to_consume);
     
     // Small delay while processing
-    usleep(rand() % 500);
+    usleep(rng_below(500));
     
     // IMPORTANT: Free the tray after consuming
     free_food_tray(tray);
@@ -131,20 +137,29 @@ static void* consumer_thread(void* arg) {
   return NULL;
 }
 
-int main(void) {
+int main(int argc, char **argv) {
+  // Optional engine selection: ./test_bb_stress [locked|mpmc|sharded[:N]]
+  const char *engine = (argc > 1) ? argv[1] : "locked";
+  if (strcmp(engine, "spsc") == 0 || bb_init_engine(&test_queue, BUFFER_CAPACITY, engine)) {
+    fprintf(stderr, "usage: %s [locked|mpmc|sharded[:N]]\n", argv[0]);
+    return 2;
+  }
+
   LOG("=== Bounded Buffer Stress Test ===");
   LOG("Configuration:");
+  LOG("  Engine: %s", engine);
   LOG("  Producers: %d (each produces %d items)", NUM_PRODUCERS, ITEMS_PER_PRODUCER);
   LOG("  Consumers: %d (total consume %d items)", NUM_CONSUMERS, TOTAL_ITEMS);
   LOG("  Buffer capacity: %d", BUFFER_CAPACITY);
   LOG("  Total items: %d", TOTAL_ITEMS);
   LOG("");
   
-  // Seed random number generator
-  srand(time(NULL));
+  // Seed the per-thread generators
+  rng_seed((uint64_t)time(NULL));
+  LOG("Seed %llu", (unsigned long long)rng_master());
   
-  // Initialize
-  bb_init(&test_queue, BUFFER_CAPACITY);
+  // Initialize (queue was set up during engine selection)
+  uint64_t start_ms = now_ms();
   test_failed = 0;
   overflow_detected = 0;
   underflow_detected = 0;
@@ -193,6 +208,12 @@ int main(void) {
   
   // Final validation
   LOG("=== Results ===");
+  LOG("Elapsed: %llu ms", (unsigned long long)(now_ms() - start_ms));
+  if (test_queue.mode == BB_MODE_SHARDED) {
+    bb_wait_stats_t st;
+    bb_wait_stats(&test_queue, &st);
+    LOG("Shards: %d, takes stolen from another shard: %lu", test_queue.nshards, st.steals);
+  }
   LOG("Total items produced: %d (expected %d)", total_produced, TOTAL_ITEMS);
   LOG("Total items consumed: %d (expected %d)", total_consumed, TOTAL_ITEMS);
   LOG("Production checksum: %d", items_checksum_produced);
@@ -239,10 +260,7 @@ int main(void) {
   }
   
   // Check buffer is empty at the end
-  int final_count = 0;
-  pthread_mutex_lock(&test_queue.m);
-  final_count = (test_queue.tail - test_queue.head + test_queue.cap) % test_queue.cap;
-  pthread_mutex_unlock(&test_queue.m);
+  int final_count = buffer_count();
   
   if (final_count != 0) {
     LOG("FAIL: Buffer not empty at end (count=%d)", final_count);
@@ -0,0 +1,101 @@
+#define _POSIX_C_SOURCE 200809L
+#include "sync_utils.h"
+#include "test_check.h"
+#include <assert.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+
+/* Non-blocking and deadline-bounded bounded buffer operations.
+ * Each engine is checked for: try ops on empty/full buffers, timed ops that
+ * expire, and a timed take that is satisfied by a late producer. */
+int usleep(unsigned int usec);
+
+static bb_t test_queue;
+
+#define CAPACITY 3
+
+static long elapsed_ms(struct timespec since) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - since.tv_sec) * 1000L + (now.tv_nsec - since.tv_nsec) / 1000000L;
+}
+
+static void* late_producer(void* arg) {
+  (void)arg;
+  usleep(20000); // 20ms
+  bb_put(&test_queue, create_food_tray(42, "Sushi", 1));
+  return NULL;
+}
+
+static void run_engine(const char *name) {
+  char what[128];
+  LOG("\n=== Engine: %s ===", name);
+  bb_init_engine(&test_queue, CAPACITY, name);
+
+  snprintf(what, sizeof(what), "[%s] bb_try_take on empty buffer returns NULL", name);
+  check(bb_try_take(&test_queue) == NULL, what);
+
+  int accepted = 0;
+  for (int i = 0; i < CAPACITY; i++)
+    if (bb_try_put(&test_queue, create_food_tray(i, "Wrap", 0)) == 0) accepted++;
+  snprintf(what, sizeof(what), "[%s] bb_try_put fills the buffer (%d/%d)", name, accepted, CAPACITY);
+  check(accepted == CAPACITY, what);
+
+  food_tray_t *extra = create_food_tray(99, "Taco", 0);
+  snprintf(what, sizeof(what), "[%s] bb_try_put on full buffer fails", name);
+  check(bb_try_put(&test_queue, extra) == -1, what);
+
+  struct timespec start, dl;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  dl = deadline_in_ms(50);
+  int rc = bb_put_timed(&test_queue, extra, &dl);
+  long waited = elapsed_ms(start);
+  snprintf(what, sizeof(what), "[%s] bb_put_timed on full buffer times out (waited %ld ms)", name, waited);
+  check(rc == -1 && waited >= 45, what);
+  free_food_tray(extra);
+
+  int in_order = 1;
+  for (int i = 0; i < CAPACITY; i++) {
+    food_tray_t *t = bb_try_take(&test_queue);
+    if (!t || t->tray_id != i) in_order = 0;
+    free_food_tray(t);
+  }
+  snprintf(what, sizeof(what), "[%s] bb_try_take drains in FIFO order", name);
+  check(in_order, what);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  dl = deadline_in_ms(50);
+  food_tray_t *t = bb_take_timed(&test_queue, &dl);
+  waited = elapsed_ms(start);
+  snprintf(what, sizeof(what), "[%s] bb_take_timed on empty buffer times out (waited %ld ms)", name, waited);
+  check(t == NULL && waited >= 45, what);
+
+  pthread_t producer;
+  pthread_create(&producer, NULL, late_producer, NULL);
+  dl = deadline_in_ms(2000);
+  t = bb_take_timed(&test_queue, &dl);
+  pthread_join(producer, NULL);
+  snprintf(what, sizeof(what), "[%s] bb_take_timed is satisfied by a producer before the deadline", name);
+  check(t != NULL && t->tray_id == 42, what);
+  free_food_tray(t);
+
+  bb_wait_stats_t st;
+  bb_wait_stats(&test_queue, &st);
+  LOG("[%s] waits: spun=%lu parked=%lu timed_out=%lu (spin budget %d)",
+      name, st.spun, st.parked, st.timed_out, st.spin_budget);
+  snprintf(what, sizeof(what), "[%s] both expired waits are counted", name);
+  check(st.timed_out == 2, what);
+
+  bb_destroy(&test_queue);
+}
+
+int main() {
+  LOG("=== Test: Non-blocking and timed bounded buffer operations ===");
+  run_engine("locked");
+  run_engine("spsc");
+  run_engine("mpmc");
+  run_engine("sharded");
+
+  return test_finish("Timed bb");
+}
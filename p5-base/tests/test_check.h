@@ -0,0 +1,31 @@
+#ifndef TEST_CHECK_H
+#define TEST_CHECK_H
+
+#include "sync_utils.h"
+
+/* Shared by the unit tests: check logs one PASS/FAIL line per condition,
+ * test_finish logs the verdict the test's .run script greps for
+ * ("PASS: <name> test completed successfully") and returns main's exit
+ * status. A test may also clear test_passed itself. */
+static int test_passed = 1;
+
+static void check(int ok, const char *what) {
+  if (ok) {
+    LOG("PASS: %s", what);
+  } else {
+    LOG("FAIL: %s", what);
+    test_passed = 0;
+  }
+}
+
+static int test_finish(const char *name) {
+  LOG("");
+  if (test_passed) {
+    LOG("PASS: %s test completed successfully", name);
+  } else {
+    LOG("FAIL: %s test failed", name);
+  }
+  return test_passed ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,192 @@
+#define _POSIX_C_SOURCE 200809L
+#include "sync_utils.h"
+#include "test_check.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+/* Asynchronous LOG (log_async_start). Threads log through the unchanged
+ * LOG macro into a file:
+ * - every line comes out exactly once and whole, each thread's lines in
+ *   the order it logged them, with rings filling up (writers sleep) and
+ *   threads exiting before the flusher reaches their lines
+ * - lines from different threads come out in timestamp order (give or
+ *   take a line published just after a drain)
+ * - log_flush writes out everything logged so far, and after
+ *   log_async_stop LOG writes to stdout again
+ * - stopping while threads log loses no line: each one lands in the file
+ *   or, once stopped, on stdout
+ * and the same stream is timed with direct and async LOG to /dev/null. */
+int usleep(unsigned int usec);
+
+#define NUM_THREADS 6
+#define LINES_PER_THREAD 2000   // Several rings' worth
+#define LOG_PATH "/tmp/test_log_async.log"
+#define DIRECT_PATH "/tmp/test_log_async.direct"
+
+static int lines_per_thread;
+
+static void* logger(void* arg) {
+  long id = (long)arg;
+  for (int i = 0; i < lines_per_thread; i++) LOG("logger %ld line %d", id, i);
+  return NULL;
+}
+
+static void run_loggers(int lines) {
+  pthread_t th[NUM_THREADS];
+  lines_per_thread = lines;
+  for (long i = 0; i < NUM_THREADS; i++) pthread_create(&th[i], NULL, logger, (void*)i);
+  for (int i = 0; i < NUM_THREADS; i++) pthread_join(th[i], NULL);
+}
+
+static void lines_and_order(void) {
+  char what[160], line[LOG_LINE_MAX + 64];
+  int next[NUM_THREADS] = { 0 };
+  int total = 0, bad = 0, out_of_order = 0, backwards = 0;
+  double last_ms = 0, ms;
+
+  int started = log_async_start(LOG_PATH) == 0 && log_async_start(NULL) == -1;
+  run_loggers(LINES_PER_THREAD);
+  log_async_stop();
+  check(started, "log_async_start opens the file, a second start fails");
+
+  FILE *f = fopen(LOG_PATH, "r");
+  while (f && fgets(line, sizeof(line), f)) {
+    long id;
+    int n;
+    total++;
+    if (sscanf(line, "[%lf ms] logger %ld line %d", &ms, &id, &n) != 3 || id < 0 ||
+        id >= NUM_THREADS || line[strlen(line) - 1] != '\n') {
+      bad++;
+      continue;
+    }
+    if (n != next[id]++) out_of_order++;
+    if (ms < last_ms) backwards++;
+    last_ms = ms;
+  }
+  if (f) fclose(f);
+  snprintf(what, sizeof(what), "%d threads x %d lines: %d lines written, all whole",
+           NUM_THREADS, LINES_PER_THREAD, total);
+  check(total == NUM_THREADS * LINES_PER_THREAD && bad == 0, what);
+  check(out_of_order == 0, "each thread's lines in the order it logged them");
+  /* A line published after a drain can be older than ones already out */
+  snprintf(what, sizeof(what), "lines merged across threads in timestamp order (%d step(s) back)", backwards);
+  check(backwards <= total / 100, what);
+}
+
+static void flush_and_stop(void) {
+  char line[LOG_LINE_MAX + 64];
+  int found = 0;
+  log_async_start(LOG_PATH);
+  LOG("flushed line");
+  log_flush();
+  FILE *f = fopen(LOG_PATH, "r");
+  while (f && fgets(line, sizeof(line), f)) found += strstr(line, "flushed line") != NULL;
+  if (f) fclose(f);
+  log_async_stop();
+  check(found == 1, "log_flush writes out the lines logged so far");
+
+  /* Long lines are cut at LOG_LINE_MAX, still ending the line */
+  char big[2 * LOG_LINE_MAX];
+  memset(big, 'x', sizeof(big) - 1);
+  big[sizeof(big) - 1] = '\0';
+  log_async_start(LOG_PATH);
+  LOG("%s", big);
+  log_async_stop();
+  f = fopen(LOG_PATH, "r");
+  size_t len = f && fgets(line, sizeof(line), f) ? strlen(line) : 0;
+  if (f) fclose(f);
+  check(len == LOG_LINE_MAX - 1 && line[len - 1] == '\n', "long lines truncated to LOG_LINE_MAX");
+}
+
+/* Counts logger lines in path into seen[id][n]; returns lines that don't parse */
+static int tally(const char *path, int seen[][LINES_PER_THREAD]) {
+  char line[LOG_LINE_MAX + 64];
+  int bad = 0;
+  FILE *f = fopen(path, "r");
+  while (f && fgets(line, sizeof(line), f)) {
+    double ms;
+    long id;
+    int n;
+    if (sscanf(line, "[%lf ms] logger %ld line %d", &ms, &id, &n) == 3 && id >= 0 &&
+        id < NUM_THREADS && n >= 0 && n < LINES_PER_THREAD)
+      seen[id][n]++;
+    else
+      bad++;
+  }
+  if (f) fclose(f);
+  return bad;
+}
+
+static void stop_while_logging(void) {
+  static int seen[NUM_THREADS][LINES_PER_THREAD];
+  char what[160];
+  pthread_t th[NUM_THREADS];
+  fflush(stdout);
+  int saved = dup(STDOUT_FILENO), direct = open(DIRECT_PATH, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  dup2(direct, STDOUT_FILENO);
+  log_async_start(LOG_PATH);
+  lines_per_thread = LINES_PER_THREAD;
+  for (long i = 0; i < NUM_THREADS; i++) pthread_create(&th[i], NULL, logger, (void*)i);
+  usleep(1000);
+  log_async_stop();
+  for (int i = 0; i < NUM_THREADS; i++) pthread_join(th[i], NULL);
+  fflush(stdout);
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+  close(direct);
+
+  int bad = tally(LOG_PATH, seen) + tally(DIRECT_PATH, seen), lost = 0, twice = 0;
+  for (int i = 0; i < NUM_THREADS; i++) {
+    for (int n = 0; n < LINES_PER_THREAD; n++) {
+      lost += seen[i][n] == 0;
+      twice += seen[i][n] > 1;
+    }
+  }
+  remove(DIRECT_PATH);
+  snprintf(what, sizeof(what), "stop while %d threads log: no line lost (%d) or doubled (%d)",
+           NUM_THREADS, lost, twice);
+  check(lost == 0 && twice == 0 && bad == 0, what);
+}
+
+static double ms_since(const struct timespec *t0) {
+  struct timespec t1;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  return (t1.tv_sec - t0->tv_sec) * 1e3 + (t1.tv_nsec - t0->tv_nsec) / 1e6;
+}
+
+/* Same stream, direct (stdout pointed at /dev/null) and async */
+static void timing(void) {
+  struct timespec t0;
+  fflush(stdout);
+  int saved = dup(STDOUT_FILENO), null = open("/dev/null", O_WRONLY);
+  dup2(null, STDOUT_FILENO);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  run_loggers(LINES_PER_THREAD);
+  double direct_ms = ms_since(&t0);
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+  close(null);
+
+  log_async_start("/dev/null");
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  run_loggers(LINES_PER_THREAD);
+  double async_ms = ms_since(&t0);
+  log_async_stop();
+  LOG("%d threads x %d lines: direct LOG %.1f ms, async LOG %.1f ms (to /dev/null)",
+      NUM_THREADS, LINES_PER_THREAD, direct_ms, async_ms);
+}
+
+int main() {
+  LOG("=== Test: asynchronous LOG ===");
+  lines_and_order();
+  flush_and_stop();
+  stop_while_logging();
+  timing();
+  remove(LOG_PATH);
+
+  return test_finish("Async log");
+}
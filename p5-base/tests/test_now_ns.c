@@ -0,0 +1,93 @@
+#define _POSIX_C_SOURCE 200809L
+#include "sync_utils.h"
+#include "test_check.h"
+#include <assert.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+
+/* now_ns, on CLOCK_MONOTONIC and (where the CPU has an invariant TSC) on
+ * the calibrated TSC:
+ * - never goes backwards within a thread, with sub-microsecond steps
+ * - a sleep measured with it matches CLOCK_MONOTONIC
+ * - the TSC clock continues the monotonic one without a jump
+ * and the cost of one call is reported for both sources. */
+int usleep(unsigned int usec);
+
+#define NUM_THREADS 4
+#define CALLS 200000
+#define SLEEP_MS 50
+
+typedef struct {
+  int backwards;
+  uint64_t min_step;       // Smallest non-zero difference seen
+} run_t;
+
+static void* caller(void* arg) {
+  run_t *r = arg;
+  uint64_t last = now_ns();
+  r->backwards = 0;
+  r->min_step = UINT64_MAX;
+  for (int i = 0; i < CALLS; i++) {
+    uint64_t t = now_ns();
+    if (t < last) r->backwards++;
+    else if (t > last && t - last < r->min_step) r->min_step = t - last;
+    last = t;
+  }
+  return NULL;
+}
+
+static void run_source(const char *source) {
+  char what[160];
+  pthread_t th[NUM_THREADS];
+  run_t r[NUM_THREADS];
+  LOG("\n=== Clock: %s ===", source);
+
+  for (int i = 0; i < NUM_THREADS; i++) pthread_create(&th[i], NULL, caller, &r[i]);
+  int backwards = 0;
+  uint64_t min_step = UINT64_MAX;
+  for (int i = 0; i < NUM_THREADS; i++) {
+    pthread_join(th[i], NULL);
+    backwards += r[i].backwards;
+    if (r[i].min_step < min_step) min_step = r[i].min_step;
+  }
+  snprintf(what, sizeof(what), "[%s] %d threads x %d calls: never backwards, smallest step %llu ns",
+           source, NUM_THREADS, CALLS, (unsigned long long)min_step);
+  check(backwards == 0 && min_step < 1000, what);
+
+  uint64_t m0 = mono_ns(), t0 = now_ns();
+  usleep(SLEEP_MS * 1000);
+  uint64_t t1 = now_ns(), m1 = mono_ns();
+  double now_ms = (t1 - t0) / 1e6, mono_ms = (m1 - m0) / 1e6;
+  snprintf(what, sizeof(what), "[%s] %d ms sleep: %.3f ms by now_ns, %.3f ms by CLOCK_MONOTONIC",
+           source, SLEEP_MS, now_ms, mono_ms);
+  check(now_ms >= SLEEP_MS && now_ms <= mono_ms + 0.5, what);
+
+  uint64_t c0 = mono_ns();
+  volatile uint64_t sink = 0;
+  for (int i = 0; i < CALLS; i++) sink += now_ns();
+  LOG("[%s] %.1f ns per now_ns call", source, (mono_ns() - c0) / (double)CALLS);
+}
+
+int main() {
+  LOG("=== Test: now_ns clock ===");
+  now_ns_use_tsc(false);
+  run_source("monotonic");
+
+  uint64_t before = now_ns();
+  if (now_ns_use_tsc(true) == 0) {
+    uint64_t after = now_ns(), mono = mono_ns();
+    char what[160];
+    snprintf(what, sizeof(what), "switching to the TSC: no step back, %lld ns off CLOCK_MONOTONIC",
+             (long long)(after - mono));
+    check(after >= before && (after > mono ? after - mono : mono - after) < 100000, what);
+    run_source("tsc");
+    now_ns_use_tsc(false);
+  } else {
+    LOG("No steady invariant TSC here: TSC clock not tested");
+  }
+  check(now_ms() == now_ns() / 1000000ULL || now_ms() + 1 == now_ns() / 1000000ULL,
+        "now_ms is now_ns in milliseconds");
+
+  return test_finish("now_ns");
+}
@@ -0,0 +1,299 @@
+#define _POSIX_C_SOURCE 200809L
+#include "sync_utils.h"
+#include "test_check.h"
+#include <assert.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <dirent.h>
+
+/* Thread pool and actors:
+ * - futures return their task's result, task_done tells a running task
+ *   from a finished one
+ * - recursive fork-join on two workers finishes (waiters run queued tasks)
+ * - tasks pushed on one worker's deque are stolen by the others
+ * - producers and consumers taking turns on a small bb_t, tens of
+ *   thousands of them as pooled actors, run on far fewer workers; actors
+ *   without a pool get a thread each
+ * - thousands of pooled consumers all blocked on an empty bb_t at once
+ *   park instead of holding a kernel thread each, and the workers added
+ *   meanwhile retire once idle
+ * - actors that only return once all of them run at the same time, more
+ *   of them than the pool has workers, all get a worker
+ * - a task waiting on a future doesn't run an actor it spawned in the
+ *   meantime, which waits for what the task does after that wait
+ * and the cost per actor is reported for pooled and per-thread actors. */
+int usleep(unsigned int usec);
+
+static bb_t test_queue;
+static pool_t *test_pool;
+
+#define NUM_WORKERS 4
+#define NUM_TASKS 1000
+#define FIB_N 18
+#define FIB_RESULT 2584
+#define NUM_STOLEN 64
+#define NUM_ACTORS 20000         // Half producers, half consumers
+#define NUM_THREAD_ACTORS 2000
+#define QUEUE_CAPACITY 8
+#define NUM_BLOCKERS (2 * NUM_WORKERS)
+#define BLOCKER_ROUNDS 50
+#define BLOCKER_WAIT_NS 5000000000ULL
+#define NUM_WAITERS 2000         // Consumers spawned before any producer
+
+/* ---- Futures ---- */
+static void* twice(void* arg) {
+  return (void*)((long)arg * 2);
+}
+
+static atomic_int gate;
+
+static void* held(void* arg) {
+  while (!atomic_load(&gate)) usleep(100);
+  return arg;
+}
+
+static void futures(void) {
+  static task_t *tasks[NUM_TASKS];
+  for (long i = 0; i < NUM_TASKS; i++) tasks[i] = pool_submit(test_pool, twice, (void*)i);
+  long sum = 0;
+  for (int i = 0; i < NUM_TASKS; i++) sum += (long)task_wait(tasks[i]);
+  check(sum == (long)NUM_TASKS * (NUM_TASKS - 1), "every future returns its task's result");
+
+  task_t *t = pool_submit(test_pool, held, (void*)42L);
+  usleep(10000);
+  bool early = task_done(t);
+  atomic_store(&gate, 1);
+  while (!task_done(t)) usleep(100);
+  check(!early && task_wait(t) == (void*)42L, "task_done false while running, true once finished");
+}
+
+/* ---- Fork-join from inside the pool ---- */
+static void* fib(void* arg) {
+  long n = (long)arg;
+  if (n < 2) return arg;
+  task_t *left = pool_submit(test_pool, fib, (void*)(n - 1));
+  long right = (long)fib((void*)(n - 2));
+  return (void*)((long)task_wait(left) + right);
+}
+
+/* ---- Stealing ---- */
+static pthread_t ran_on[NUM_STOLEN];
+
+static void* nap(void* arg) {
+  ran_on[(long)arg] = pthread_self();
+  usleep(1000);
+  return NULL;
+}
+
+static void* spread(void* arg) {
+  (void)arg;
+  task_t *t[NUM_STOLEN];
+  for (long i = 0; i < NUM_STOLEN; i++) t[i] = pool_submit(test_pool, nap, (void*)i);
+  for (int i = NUM_STOLEN - 1; i >= 0; i--) task_wait(t[i]);
+  return (void*)pthread_self();
+}
+
+static void stealing(void) {
+  char what[160];
+  pthread_t owner = (pthread_t)task_wait(pool_submit(test_pool, spread, NULL));
+  int elsewhere = 0, distinct = 0;
+  for (int i = 0; i < NUM_STOLEN; i++) {
+    elsewhere += !pthread_equal(ran_on[i], owner);
+    int k = 0;
+    while (k < i && !pthread_equal(ran_on[k], ran_on[i])) k++;
+    distinct += k == i;
+  }
+  snprintf(what, sizeof(what), "%d of %d tasks pushed by one worker stolen, run on %d workers",
+           elsewhere, NUM_STOLEN, distinct);
+  check(elsewhere > 0 && distinct > 1, what);
+}
+
+/* ---- Actors blocking on each other ---- */
+static void* producer(void* arg) {
+  bb_put(&test_queue, create_food_tray((long)arg, "Bagel", 0));
+  return arg;
+}
+
+static void* consumer(void* arg) {
+  free_food_tray(bb_take(&test_queue));
+  return arg;
+}
+
+/* ns per actor; *sum collects the results */
+static double run_actors(int n, long *sum) {
+  static task_t *actors[NUM_ACTORS];
+  uint64_t t0 = now_ns();
+  bb_init(&test_queue, QUEUE_CAPACITY);
+  for (long i = 0; i < n; i++) actors[i] = actor_spawn(i % 2 ? consumer : producer, (void*)i, "actor");
+  *sum = 0;
+  for (int i = 0; i < n; i++) *sum += (long)actor_join(actors[i]);
+  bb_destroy(&test_queue);
+  return (now_ns() - t0) / (double)n;
+}
+
+static void actors(void) {
+  char what[160];
+  long sum;
+  pool_t *pool = pool_create(NUM_WORKERS);
+  actors_use_pool(pool);
+  double pooled = run_actors(NUM_ACTORS, &sum);
+  int workers = pool_workers(pool);
+  snprintf(what, sizeof(what), "%d pooled actors blocking on a %d-slot queue ran on %d workers",
+           NUM_ACTORS, QUEUE_CAPACITY, workers);
+  check(sum == (long)NUM_ACTORS * (NUM_ACTORS - 1) / 2 && workers < NUM_ACTORS / 10, what);
+  actors_use_pool(NULL);
+  pool_destroy(pool);
+
+  double threaded = run_actors(NUM_THREAD_ACTORS, &sum);
+  check(sum == (long)NUM_THREAD_ACTORS * (NUM_THREAD_ACTORS - 1) / 2, "actors without a pool run on threads of their own");
+  LOG("%.2f us per pooled actor, %.2f us per actor on its own thread", pooled / 1000, threaded / 1000);
+}
+
+/* ---- Consumers all blocked at once ---- */
+/* Kernel threads in this process */
+static int thread_count(void) {
+  DIR *d = opendir("/proc/self/task");
+  int n = 0;
+  if (!d) return -1;
+  for (struct dirent *e; (e = readdir(d)) != NULL; ) n += e->d_name[0] != '.';
+  closedir(d);
+  return n;
+}
+
+static void parked_consumers(void) {
+  static task_t *actors[2 * NUM_WAITERS];
+  char what[160];
+  bb_wait_stats_t st;
+  pool_t *pool = pool_create(NUM_WORKERS);
+  actors_use_pool(pool);
+  bb_init(&test_queue, QUEUE_CAPACITY);
+  int before = thread_count();
+  for (long i = 0; i < NUM_WAITERS; i++) actors[i] = actor_spawn(consumer, (void*)i, "consumer");
+  uint64_t deadline = now_ns() + BLOCKER_WAIT_NS;
+  do {
+    usleep(1000);
+    bb_wait_stats(&test_queue, &st);
+  } while (st.parked < NUM_WAITERS && now_ns() < deadline);
+  int added = thread_count() - before;
+  snprintf(what, sizeof(what), "%lu of %d pooled consumers blocked on an empty queue, %d threads added",
+           st.parked, NUM_WAITERS, added);
+  check(st.parked == NUM_WAITERS && added < NUM_WAITERS / 10, what);
+
+  for (long i = NUM_WAITERS; i < 2 * NUM_WAITERS; i++) actors[i] = actor_spawn(producer, (void*)i, "producer");
+  long sum = 0;
+  for (int i = 0; i < 2 * NUM_WAITERS; i++) sum += (long)actor_join(actors[i]);
+  bb_destroy(&test_queue);
+  int peak = pool_workers(pool);
+  deadline = now_ns() + BLOCKER_WAIT_NS;
+  while (pool_workers(pool) > NUM_WORKERS && now_ns() < deadline) usleep(1000);
+  snprintf(what, sizeof(what), "then fed by as many producers; %d workers retire back to %d once idle",
+           peak, pool_workers(pool));
+  check(sum == (long)NUM_WAITERS * (2 * NUM_WAITERS - 1) && pool_workers(pool) == NUM_WORKERS, what);
+  actors_use_pool(NULL);
+  pool_destroy(pool);
+}
+
+/* ---- Every worker blocked ---- */
+static atomic_int arrived;
+
+/* Returns arg once all blockers are running, NULL if that takes too long */
+static void* blocker(void* arg) {
+  uint64_t deadline = now_ns() + BLOCKER_WAIT_NS;
+  atomic_fetch_add(&arrived, 1);
+  while (atomic_load(&arrived) < NUM_BLOCKERS) {
+    if (now_ns() > deadline) return NULL;
+    usleep(100);
+  }
+  return arg;
+}
+
+/* Each spawner thread spawns one blocker, all at once */
+static pthread_barrier_t spawn_start;
+
+static void* spawner(void* arg) {
+  task_t **slot = arg;
+  pthread_barrier_wait(&spawn_start);
+  *slot = actor_spawn(blocker, slot, "blocker");
+  return NULL;
+}
+
+static void blocked_workers(void) {
+  char what[160];
+  task_t *b[NUM_BLOCKERS];
+  pthread_t th[NUM_BLOCKERS];
+  int met = 0;
+  pthread_barrier_init(&spawn_start, NULL, NUM_BLOCKERS);
+  for (int round = 0; round < BLOCKER_ROUNDS; round++) {
+    pool_t *pool = pool_create(NUM_WORKERS);
+    actors_use_pool(pool);
+    atomic_store(&arrived, 0);
+    for (int i = 0; i < NUM_BLOCKERS; i++) pthread_create(&th[i], NULL, spawner, &b[i]);
+    for (int i = 0; i < NUM_BLOCKERS; i++) pthread_join(th[i], NULL);
+    int all = 1;
+    for (int i = 0; i < NUM_BLOCKERS; i++) all &= actor_join(b[i]) != NULL;
+    met += all;
+    actors_use_pool(NULL);
+    pool_destroy(pool);
+  }
+  pthread_barrier_destroy(&spawn_start);
+  snprintf(what, sizeof(what), "%d actors waiting for each other on %d workers all ran (%d/%d rounds)",
+           NUM_BLOCKERS, NUM_WORKERS, met, BLOCKER_ROUNDS);
+  check(met == BLOCKER_ROUNDS, what);
+}
+
+/* ---- Actor spawned under a fork-join task ---- */
+static atomic_int released;
+
+/* Returns arg once the forking task got past its task_wait, NULL if that
+ * takes too long (it ran nested inside that wait) */
+static void* until_released(void* arg) {
+  uint64_t deadline = now_ns() + BLOCKER_WAIT_NS;
+  while (!atomic_load(&released)) {
+    if (now_ns() > deadline) return NULL;
+    usleep(100);
+  }
+  return arg;
+}
+
+static void* fork_with_actor(void* arg) {
+  (void)arg;
+  task_t *child = pool_submit(test_pool, twice, (void*)21L);
+  task_t *actor = actor_spawn(until_released, (void*)7L, "forked");
+  long got = (long)task_wait(child);   /* the actor is on top of our deque */
+  atomic_store(&released, 1);
+  return got == 42 ? actor : NULL;
+}
+
+static void actor_under_fork(void) {
+  pool_t *one = pool_create(1);
+  test_pool = one;
+  actors_use_pool(one);
+  task_t *actor = task_wait(pool_submit(one, fork_with_actor, NULL));
+  check(actor && actor_join(actor) == (void*)7L, "an actor spawned by a task waiting on a future isn't run inside that wait");
+  actors_use_pool(NULL);
+  pool_destroy(one);
+}
+
+int main() {
+  LOG("=== Test: thread pool ===");
+  test_pool = pool_create(NUM_WORKERS);
+  assert(test_pool && pool_workers(test_pool) == NUM_WORKERS);
+  futures();
+
+  pool_t *pair = pool_create(2);
+  pool_t *big = test_pool;
+  test_pool = pair;
+  long f = (long)task_wait(pool_submit(test_pool, fib, (void*)FIB_N));
+  check(f == FIB_RESULT && pool_workers(pair) == 2, "recursive fork-join on 2 workers completes");
+  pool_destroy(pair);
+  test_pool = big;
+
+  stealing();
+  pool_destroy(test_pool);
+  actors();
+  parked_consumers();
+  blocked_workers();
+  actor_under_fork();
+
+  return test_finish("Pool");
+}
@@ -0,0 +1,192 @@
+#define _POSIX_C_SOURCE 200809L
+#include "sync_utils.h"
+#include "test_check.h"
+#include <assert.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+
+/* RCU-style publication (rcu_read_lock / rcu_publish / rcu_retire).
+ * - a retired version is not freed while a reader that saw it is inside
+ *   its read section, and is freed once that reader leaves
+ * - readers traversing under a stream of updates never see a torn version
+ * - read cost against rw_rlock at reader:writer ratios of 100:1 and 1000:1 */
+int usleep(unsigned int usec);
+
+#define NUM_VALUES  16
+#define NUM_THREADS 4
+#define OPS_PER_THREAD 200000
+
+typedef struct {
+  int version;
+  int values[NUM_VALUES];   // All equal to version in a consistent snapshot
+} board_t;
+
+static _Atomic(board_t*) board;
+static atomic_int freed;
+static atomic_int stop;
+
+static board_t* new_board(int version) {
+  board_t *b = malloc(sizeof(*b));
+  b->version = version;
+  for (int i = 0; i < NUM_VALUES; i++) b->values[i] = version;
+  return b;
+}
+
+static void free_board(void *p) {
+  atomic_fetch_add(&freed, 1);
+  free(p);
+}
+
+/* Publishes version v and retires the previous one */
+static void update(int v) {
+  rcu_retire(rcu_publish(board, new_board(v)), free_board);
+}
+
+static int board_sum(board_t *b) {
+  int sum = 0;
+  for (int i = 0; i < NUM_VALUES; i++) sum += b->values[i];
+  return sum;
+}
+
+/* ---- Deferred free ---- */
+static atomic_int reader_in, reader_release;
+
+static void* holding_reader(void* arg) {
+  int *seen = arg;
+  rcu_read_lock();
+  board_t *b = rcu_dereference(board);
+  atomic_store(&reader_in, 1);
+  while (!atomic_load(&reader_release)) usleep(1000);
+  *seen = board_sum(b);    // Still valid: retired but not freed
+  rcu_read_unlock();
+  return NULL;
+}
+
+/* ---- Consistency under updates ---- */
+static atomic_long torn, traversals;
+
+static void* traversing_reader(void* arg) {
+  (void)arg;
+  long n = 0, bad = 0;
+  while (!atomic_load(&stop)) {
+    rcu_read_lock();
+    board_t *b = rcu_dereference(board);
+    if (board_sum(b) != NUM_VALUES * b->version) bad++;
+    rcu_read_unlock();
+    n++;
+  }
+  atomic_fetch_add(&torn, bad);
+  atomic_fetch_add(&traversals, n);
+  return NULL;
+}
+
+/* ---- Benchmark: every ratio-th operation is a write ---- */
+static rwlock_t bench_lock;
+static board_t bench_board;
+static int bench_ratio;
+static pthread_mutex_t bench_edit = PTHREAD_MUTEX_INITIALIZER;
+static atomic_long bench_sink;
+
+static void* bench_rwlock(void* arg) {
+  long id = (long)arg, sink = 0;
+  for (int i = 1; i <= OPS_PER_THREAD; i++) {
+    if ((i + id) % bench_ratio == 0) {
+      rw_wlock(&bench_lock);
+      bench_board.version++;
+      for (int k = 0; k < NUM_VALUES; k++) bench_board.values[k] = bench_board.version;
+      rw_wunlock(&bench_lock);
+    } else {
+      rw_rlock(&bench_lock);
+      sink += board_sum(&bench_board);
+      rw_runlock(&bench_lock);
+    }
+  }
+  atomic_fetch_add(&bench_sink, sink);
+  return NULL;
+}
+
+static void* bench_rcu(void* arg) {
+  long id = (long)arg, sink = 0;
+  for (int i = 1; i <= OPS_PER_THREAD; i++) {
+    if ((i + id) % bench_ratio == 0) {
+      pthread_mutex_lock(&bench_edit);
+      int v = atomic_load_explicit(&board, memory_order_relaxed)->version + 1;
+      board_t *old = rcu_publish(board, new_board(v));
+      pthread_mutex_unlock(&bench_edit);
+      rcu_retire(old, free_board);
+    } else {
+      rcu_read_lock();
+      sink += board_sum(rcu_dereference(board));
+      rcu_read_unlock();
+    }
+  }
+  atomic_fetch_add(&bench_sink, sink);
+  return NULL;
+}
+
+static double run_bench(thread_fn fn) {
+  pthread_t th[NUM_THREADS];
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (long i = 0; i < NUM_THREADS; i++) pthread_create(&th[i], NULL, fn, (void*)i);
+  for (int i = 0; i < NUM_THREADS; i++) pthread_join(th[i], NULL);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  double ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+  return ns / ((double)NUM_THREADS * OPS_PER_THREAD);
+}
+
+int main() {
+  LOG("=== Test: RCU-style publication ===");
+
+  /* A reader holding version 0 delays its reclamation, nothing else */
+  atomic_store(&board, new_board(0));
+  int seen = -1;
+  pthread_t th[NUM_THREADS];
+  pthread_create(&th[0], NULL, holding_reader, &seen);
+  while (!atomic_load(&reader_in)) usleep(1000);
+  update(1);
+  check(atomic_load(&freed) == 0 && rcu_pending() == 1,
+        "version held by a reader is retired but not freed");
+  atomic_store(&reader_release, 1);
+  pthread_join(th[0], NULL);
+  rcu_synchronize();
+  check(seen == 0 && atomic_load(&freed) == 1 && rcu_pending() == 0,
+        "version freed after its reader left (reader saw it intact)");
+
+  /* Readers traverse while versions are replaced underneath them */
+  atomic_store(&freed, 0);
+  for (long i = 0; i < NUM_THREADS; i++) pthread_create(&th[i], NULL, traversing_reader, NULL);
+  const int updates = 2000;
+  for (int v = 2; v < 2 + updates; v++) {
+    update(v);
+    if (v % 64 == 0) usleep(100);
+  }
+  atomic_store(&stop, 1);
+  for (int i = 0; i < NUM_THREADS; i++) pthread_join(th[i], NULL);
+  rcu_synchronize();
+  LOG("%ld traversals during %d updates", atomic_load(&traversals), updates);
+  check(atomic_load(&torn) == 0, "no reader saw a torn version");
+  check(atomic_load(&freed) == updates && rcu_pending() == 0,
+        "every replaced version was freed exactly once");
+
+  /* Read cost: RCU against rw_rlock on the default and single-word engines */
+  const int ratios[] = { 100, 1000 };
+  for (int r = 0; r < 2; r++) {
+    bench_ratio = ratios[r];
+    double rcu = run_bench(bench_rcu);
+    rcu_synchronize();
+    rw_init(&bench_lock);
+    double sem = run_bench(bench_rwlock);
+    rw_destroy(&bench_lock);
+    rw_init_futex(&bench_lock);
+    double fut = run_bench(bench_rwlock);
+    rw_destroy(&bench_lock);
+    LOG("%d:1 readers:writers, %d threads: rcu %.1f ns/op, rw_rlock sem %.1f ns/op, futex %.1f ns/op",
+        bench_ratio, NUM_THREADS, rcu, sem, fut);
+  }
+  free(rcu_publish(board, NULL));
+  check(rcu_pending() == 0, "nothing left to reclaim after the benchmark");
+
+  return test_finish("RCU");
+}
@@ -0,0 +1,141 @@
+#define _POSIX_C_SOURCE 200809L
+#include "sync_utils.h"
+#include "test_check.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+/* Per-thread PRNG:
+ * - the same master seed and stream give the same sequence, other streams
+ *   and other seeds a different one; rng_seed restarts every stream
+ * - rng_below stays in range and spreads evenly over it
+ * - threads that pick their stream get the same draws whatever order they
+ *   start in, and a thread left on an automatic stream draws none of theirs
+ * and the cost of one draw is reported against rand(). */
+
+#define NUM_THREADS 8
+#define DRAWS 64
+#define BUCKETS 10
+#define SAMPLES 1000000
+#define CALLS 2000000
+
+static void draw(uint64_t *out, int n) {
+  for (int i = 0; i < n; i++) out[i] = rng_next();
+}
+
+static int same(const uint64_t *a, const uint64_t *b, int n) {
+  for (int i = 0; i < n; i++) {
+    if (a[i] != b[i]) return 0;
+  }
+  return 1;
+}
+
+static void sequences(void) {
+  uint64_t a[DRAWS], b[DRAWS], c[DRAWS], d[DRAWS];
+  rng_seed(42);
+  rng_thread(3);
+  draw(a, DRAWS);
+  rng_thread(3);
+  draw(b, DRAWS);
+  check(same(a, b, DRAWS), "same seed and stream: same sequence");
+
+  rng_thread(4);
+  draw(c, DRAWS);
+  rng_seed(43);
+  rng_thread(3);
+  draw(d, DRAWS);
+  check(!same(a, c, DRAWS) && !same(a, d, DRAWS), "another stream or another seed: another sequence");
+
+  rng_seed(42);                // Same stream number, picked up again at the next draw
+  draw(b, DRAWS);
+  check(same(a, b, DRAWS) && rng_master() == 42, "rng_seed restarts the thread's stream from the new seed");
+}
+
+static void distribution(void) {
+  char what[160];
+  int count[BUCKETS] = { 0 }, out_of_range = 0;
+  for (int i = 0; i < SAMPLES; i++) {
+    uint32_t v = rng_below(BUCKETS);
+    if (v >= BUCKETS) out_of_range++;
+    else count[v]++;
+  }
+  double chi2 = 0, expect = SAMPLES / (double)BUCKETS;
+  for (int i = 0; i < BUCKETS; i++) chi2 += (count[i] - expect) * (count[i] - expect) / expect;
+  /* 9 degrees of freedom: 27.9 is the 0.1% tail */
+  snprintf(what, sizeof(what), "rng_below(%d) x %d: all in range, chi-square %.1f", BUCKETS, SAMPLES, chi2);
+  check(out_of_range == 0 && chi2 < 27.9, what);
+
+  int zero = 0;
+  for (int i = 0; i < 1000; i++) zero += rng_below(1) == 0;
+  check(zero == 1000, "rng_below(1) is always 0");
+}
+
+/* ---- Threads on fixed streams ---- */
+typedef struct {
+  int stream;
+  uint64_t out[DRAWS];
+} job_t;
+
+static void* worker(void* arg) {
+  job_t *j = arg;
+  rng_thread(j->stream);
+  draw(j->out, DRAWS);
+  return NULL;
+}
+
+static void run_jobs(job_t *jobs, const int *order) {
+  pthread_t th[NUM_THREADS];
+  for (int i = 0; i < NUM_THREADS; i++) {
+    jobs[order[i]].stream = order[i];
+    pthread_create(&th[i], NULL, worker, &jobs[order[i]]);
+  }
+  for (int i = 0; i < NUM_THREADS; i++) pthread_join(th[i], NULL);
+}
+
+static void threads(void) {
+  static job_t first[NUM_THREADS], second[NUM_THREADS];
+  int forward[NUM_THREADS], backward[NUM_THREADS];
+  for (int i = 0; i < NUM_THREADS; i++) {
+    forward[i] = i;
+    backward[i] = NUM_THREADS - 1 - i;
+  }
+  rng_seed(7);
+  run_jobs(first, forward);
+  run_jobs(second, backward);
+  int repeat = 1, distinct = 1;
+  for (int i = 0; i < NUM_THREADS; i++) {
+    repeat &= same(first[i].out, second[i].out, DRAWS);
+    for (int k = 0; k < i; k++) distinct &= !same(first[i].out, first[k].out, DRAWS);
+  }
+  check(repeat, "threads on fixed streams repeat their draws in any start order");
+  check(distinct, "every stream distinct from the others");
+
+  job_t automatic = { .stream = -1 };
+  pthread_t th;
+  pthread_create(&th, NULL, worker, &automatic);
+  pthread_join(th, NULL);
+  int apart = 1;
+  for (int i = 0; i < NUM_THREADS; i++) apart &= !same(automatic.out, first[i].out, DRAWS);
+  check(apart, "an automatic stream is none of the streams threads pick");
+}
+
+static void cost(void) {
+  volatile uint64_t sink = 0;
+  uint64_t t0 = now_ns();
+  for (int i = 0; i < CALLS; i++) sink += rng_below(1000);
+  uint64_t t1 = now_ns();
+  for (int i = 0; i < CALLS; i++) sink += rand() % 1000;
+  uint64_t t2 = now_ns();
+  LOG("%.1f ns per rng_below draw, %.1f ns per rand()", (t1 - t0) / (double)CALLS, (t2 - t1) / (double)CALLS);
+}
+
+int main() {
+  LOG("=== Test: per-thread PRNG ===");
+  sequences();
+  distribution();
+  threads();
+  cost();
+
+  return test_finish("rng");
+}
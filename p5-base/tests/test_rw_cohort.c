@@ -0,0 +1,190 @@
+#define _POSIX_C_SOURCE 200809L
+#include "sync_utils.h"
+#include "test_check.h"
+#include <assert.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+
+/* Cohort rwlock (rw_init_cohort). Threads are placed on nodes with
+ * rw_cohort_set_node, so this runs the same on a single-socket box:
+ * - the topology is read (from /sys, or split into the nodes asked for)
+ * - writers of one node take the lock in runs of at most max_batch + 1,
+ *   with far fewer node switches than the plain percpu engine, and
+ *   readers on every node stay excluded
+ * - timed and try writers that give up leave the lock usable from every
+ *   node (no turn is left stranded on a node) */
+int usleep(unsigned int usec);
+
+static rwlock_t test_board;
+
+#define NUM_NODES 2
+#define WRITERS_PER_NODE 3
+#define READERS_PER_NODE 1
+#define WRITES_PER_WRITER 100
+#define TOTAL_WRITES (NUM_NODES * WRITERS_PER_NODE * WRITES_PER_WRITER)
+
+static int owners[TOTAL_WRITES];   // Node of each successive writer
+static int nwrites;
+static atomic_int in_readers, in_writers, overlaps, readers_done;
+
+static void topology(void) {
+  char what[160];
+  rw_init_cohort(&test_board, 0);
+  int sys_nodes = test_board.cohort->nnodes;
+  snprintf(what, sizeof(what), "topology from /sys: %d node(s), one reader slot each", sys_nodes);
+  check(sys_nodes >= 1 && test_board.nslots == sys_nodes, what);
+  rw_destroy(&test_board);
+
+  rw_init_engine(&test_board, "cohort:3");
+  snprintf(what, sizeof(what), "\"cohort:3\" splits the CPUs into %d nodes, batch of %d",
+           test_board.cohort->nnodes, test_board.cohort->max_batch);
+  check(test_board.cohort->nnodes == 3 && test_board.nslots == 3 &&
+        test_board.cohort->max_batch == RW_COHORT_BATCH, what);
+  rw_destroy(&test_board);
+}
+
+/* ---- Node locality under a writer stream ---- */
+static void* stream_writer(void* arg) {
+  long node = (long)arg;
+  rw_cohort_set_node(node);
+  for (int i = 0; i < WRITES_PER_WRITER; i++) {
+    rw_wlock(&test_board);
+    if (atomic_fetch_add(&in_writers, 1) || atomic_load(&in_readers)) atomic_fetch_add(&overlaps, 1);
+    owners[nwrites++] = node;
+    usleep(50);
+    atomic_fetch_sub(&in_writers, 1);
+    rw_wunlock(&test_board);
+  }
+  return NULL;
+}
+
+static void* stream_reader(void* arg) {
+  rw_cohort_set_node((long)arg);
+  while (!atomic_load(&readers_done)) {
+    rw_rlock(&test_board);
+    atomic_fetch_add(&in_readers, 1);
+    if (atomic_load(&in_writers)) atomic_fetch_add(&overlaps, 1);
+    atomic_fetch_sub(&in_readers, 1);
+    rw_runlock(&test_board);
+    usleep(200);
+  }
+  return NULL;
+}
+
+/* Runs the stream; returns the number of node switches, *max_run the
+ * longest run of one node */
+static int stream(const char *engine, int *max_run) {
+  pthread_t th[NUM_NODES * (WRITERS_PER_NODE + READERS_PER_NODE)];
+  int n = 0;
+  rw_init_engine(&test_board, engine);
+  nwrites = 0;
+  atomic_store(&overlaps, 0);
+  atomic_store(&readers_done, 0);
+  for (long node = 0; node < NUM_NODES; node++) {
+    for (int i = 0; i < READERS_PER_NODE; i++) pthread_create(&th[n++], NULL, stream_reader, (void*)node);
+  }
+  int first_writer = n;
+  for (int i = 0; i < WRITERS_PER_NODE; i++) {
+    for (long node = 0; node < NUM_NODES; node++) pthread_create(&th[n++], NULL, stream_writer, (void*)node);
+  }
+  for (int i = first_writer; i < n; i++) pthread_join(th[i], NULL);
+  atomic_store(&readers_done, 1);
+  for (int i = 0; i < first_writer; i++) pthread_join(th[i], NULL);
+  rw_destroy(&test_board);
+
+  int switches = 0, run = 1;
+  *max_run = 1;
+  for (int i = 1; i < nwrites; i++) {
+    if (owners[i] != owners[i - 1]) {
+      switches++;
+      run = 1;
+    } else if (++run > *max_run) {
+      *max_run = run;
+    }
+  }
+  return switches;
+}
+
+static void locality(void) {
+  char what[160];
+  int percpu_run, cohort_run;
+  int percpu_switches = stream("percpu", &percpu_run);
+  check(atomic_load(&overlaps) == 0 && nwrites == TOTAL_WRITES, "[percpu] exclusion held, all writes done");
+
+  char engine[16];
+  snprintf(engine, sizeof(engine), "cohort:%d", NUM_NODES);
+  int cohort_switches = stream(engine, &cohort_run);
+  check(atomic_load(&overlaps) == 0 && nwrites == TOTAL_WRITES, "[cohort] exclusion held, all writes done");
+  LOG("%d writes from %d nodes: percpu %d node switches (longest run %d), cohort %d (longest run %d)",
+      TOTAL_WRITES, NUM_NODES, percpu_switches, percpu_run, cohort_switches, cohort_run);
+  snprintf(what, sizeof(what), "[cohort] one node keeps the lock at most %d times in a row",
+           RW_COHORT_BATCH + 1);
+  check(cohort_run <= RW_COHORT_BATCH + 1, what);
+  check(cohort_run > 1 && cohort_switches < percpu_switches,
+        "[cohort] writers of a node hand over to each other (fewer node switches than percpu)");
+}
+
+/* ---- Giving up ---- */
+static int holder_node;
+static atomic_int holder_in, holder_release;
+
+static void* holder(void* arg) {
+  (void)arg;
+  rw_cohort_set_node(holder_node);
+  rw_wlock(&test_board);
+  atomic_store(&holder_in, 1);
+  while (!atomic_load(&holder_release)) usleep(1000);
+  rw_wunlock(&test_board);
+  return NULL;
+}
+
+typedef struct { int node, timed_rc, try_rc, later_rc; } quitter_t;
+
+static void* quitter(void* arg) {
+  quitter_t *q = arg;
+  struct timespec dl;
+  rw_cohort_set_node(q->node);
+  q->try_rc = rw_trywlock(&test_board);
+  dl = deadline_in_ms(20);
+  q->timed_rc = rw_wlock_timed(&test_board, &dl);
+  atomic_store(&holder_release, 1);
+  dl = deadline_in_ms(2000);
+  q->later_rc = rw_wlock_timed(&test_board, &dl);
+  if (q->later_rc == 0) rw_wunlock(&test_board);
+  return NULL;
+}
+
+static void give_up(int same_node) {
+  char what[160];
+  pthread_t h, t;
+  quitter_t q = { .node = same_node ? 0 : 1 };
+  rw_init_cohort(&test_board, NUM_NODES);
+  holder_node = 0;
+  atomic_store(&holder_in, 0);
+  atomic_store(&holder_release, 0);
+  pthread_create(&h, NULL, holder, NULL);
+  while (!atomic_load(&holder_in)) usleep(1000);
+  pthread_create(&t, NULL, quitter, &q);
+  pthread_join(t, NULL);
+  pthread_join(h, NULL);
+  /* Both nodes can still get in */
+  rw_cohort_set_node(0);
+  int node0 = rw_trywlock(&test_board);
+  if (node0 == 0) rw_wunlock(&test_board);
+  rw_cohort_set_node(-1);
+  snprintf(what, sizeof(what), "[%s node] trywlock and wlock_timed give up, the lock stays usable",
+           same_node ? "same" : "other");
+  check(q.try_rc == -1 && q.timed_rc == -1 && q.later_rc == 0 && node0 == 0, what);
+  rw_destroy(&test_board);
+}
+
+int main() {
+  LOG("=== Test: cohort rwlock ===");
+  topology();
+  locality();
+  give_up(1);
+  give_up(0);
+
+  return test_finish("Cohort rwlock");
+}
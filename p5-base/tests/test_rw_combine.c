@@ -0,0 +1,158 @@
+#define _POSIX_C_SOURCE 200809L
+#include "sync_utils.h"
+#include "test_check.h"
+#include <assert.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+/* rw_combine (flat-combining writes). On each engine, writers that pile up
+ * post their updates and one of them applies the batch:
+ * - every update runs exactly once, under the write lock (readers check)
+ * - versions come out as with version++ under rw_wlock: 1..N, no gaps or
+ *   repeats, and each thread sees its own updates in order
+ * - several updates end up sharing one write section
+ * and the same stream through plain rw_wlock / rw_wunlock is timed for
+ * comparison. */
+int usleep(unsigned int usec);
+
+static rwlock_t test_board;
+
+#define NUM_WRITERS 6
+#define NUM_READERS 2
+#define UPDATES_PER_WRITER 300
+#define TOTAL (NUM_WRITERS * UPDATES_PER_WRITER)
+
+static int version;                       // Only touched under the write lock
+static unsigned char seen[TOTAL + 1];     // Versions handed out
+static atomic_int in_readers, in_writers, overlaps, readers_done;
+
+typedef struct {
+  int last;                 // Version of this thread's previous update
+  int out_of_order;
+  int applied;              // Sum of rw_combine's return values
+  int max_batch;
+} writer_t;
+
+/* The update: whoever runs it, it runs alone */
+static void bump(void *arg) {
+  writer_t *w = arg;
+  if (atomic_fetch_add(&in_writers, 1) || atomic_load(&in_readers)) atomic_fetch_add(&overlaps, 1);
+  int v = ++version;
+  if (v <= TOTAL) seen[v]++;
+  if (v <= w->last) w->out_of_order++;
+  w->last = v;
+  usleep(20);
+  atomic_fetch_sub(&in_writers, 1);
+}
+
+static int combining;
+
+static void* writer_thread(void* arg) {
+  writer_t *w = arg;
+  for (int i = 0; i < UPDATES_PER_WRITER; i++) {
+    if (combining) {
+      int n = rw_combine(&test_board, bump, w);
+      w->applied += n;
+      if (n > w->max_batch) w->max_batch = n;
+    } else {
+      rw_wlock(&test_board);
+      bump(w);
+      rw_wunlock(&test_board);
+      w->applied++;
+    }
+  }
+  return NULL;
+}
+
+static void* reader_thread(void* arg) {
+  (void)arg;
+  while (!atomic_load(&readers_done)) {
+    rw_rlock(&test_board);
+    atomic_fetch_add(&in_readers, 1);
+    if (atomic_load(&in_writers)) atomic_fetch_add(&overlaps, 1);
+    atomic_fetch_sub(&in_readers, 1);
+    rw_runlock(&test_board);
+    usleep(100);
+  }
+  return NULL;
+}
+
+static double ms_since(const struct timespec *t0) {
+  struct timespec t1;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  return (t1.tv_sec - t0->tv_sec) * 1e3 + (t1.tv_nsec - t0->tv_nsec) / 1e6;
+}
+
+/* Runs the writers (and a few readers) once; returns the elapsed ms */
+static double run_stream(const char *engine, int combine, writer_t *w) {
+  pthread_t wt[NUM_WRITERS], rt[NUM_READERS];
+  struct timespec t0;
+  rw_init_engine(&test_board, engine);
+  combining = combine;
+  version = 0;
+  memset(seen, 0, sizeof(seen));
+  atomic_store(&overlaps, 0);
+  atomic_store(&readers_done, 0);
+  for (int i = 0; i < NUM_READERS; i++) pthread_create(&rt[i], NULL, reader_thread, NULL);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (int i = 0; i < NUM_WRITERS; i++) {
+    w[i] = (writer_t){ 0 };
+    pthread_create(&wt[i], NULL, writer_thread, &w[i]);
+  }
+  for (int i = 0; i < NUM_WRITERS; i++) pthread_join(wt[i], NULL);
+  double ms = ms_since(&t0);
+  atomic_store(&readers_done, 1);
+  for (int i = 0; i < NUM_READERS; i++) pthread_join(rt[i], NULL);
+  rw_destroy(&test_board);
+  return ms;
+}
+
+static void run_engine(const char *engine) {
+  char what[160];
+  writer_t w[NUM_WRITERS];
+  LOG("\n=== Engine: %s ===", engine);
+
+  double plain_ms = run_stream(engine, 0, w);
+  double combine_ms = run_stream(engine, 1, w);
+
+  int applied = 0, max_batch = 0, out_of_order = 0, once = 1;
+  for (int i = 0; i < NUM_WRITERS; i++) {
+    applied += w[i].applied;
+    out_of_order += w[i].out_of_order;
+    if (w[i].max_batch > max_batch) max_batch = w[i].max_batch;
+  }
+  for (int v = 1; v <= TOTAL; v++) once &= seen[v] == 1;
+
+  snprintf(what, sizeof(what), "[%s] %d updates applied exactly once, versions 1..%d",
+           engine, TOTAL, version);
+  check(version == TOTAL && once && applied == TOTAL, what);
+  snprintf(what, sizeof(what), "[%s] exclusion held, each writer's updates in order", engine);
+  check(atomic_load(&overlaps) == 0 && out_of_order == 0, what);
+  snprintf(what, sizeof(what), "[%s] updates shared write sections (largest batch %d)", engine, max_batch);
+  check(max_batch > 1, what);
+  LOG("[%s] %d writers x %d updates: rw_wlock %.1f ms, rw_combine %.1f ms", engine,
+      NUM_WRITERS, UPDATES_PER_WRITER, plain_ms, combine_ms);
+}
+
+/* A closure posted on an idle lock is simply applied by its caller */
+static void uncontended(void) {
+  writer_t w = { 0 };
+  rw_init(&test_board);
+  version = 0;
+  int n = rw_combine(&test_board, bump, &w);
+  check(n == 1 && version == 1 && rw_trywlock(&test_board) == 0,
+        "uncontended rw_combine applies its own update and releases the lock");
+  rw_wunlock(&test_board);
+  rw_destroy(&test_board);
+}
+
+int main() {
+  LOG("=== Test: rw_combine flat-combining writes ===");
+  uncontended();
+  const char *engines[] = { "sem", "phase-fair", "percpu", "futex" };
+  for (int i = 0; i < 4; i++) run_engine(engines[i]);
+
+  return test_finish("rw_combine");
+}
@@ -0,0 +1,186 @@
+#define _POSIX_C_SOURCE 200809L
+#include "sync_utils.h"
+#include "test_check.h"
+#include <assert.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+
+/* rwlock_t fairness policies (rw_init_ex).
+ * Two fixed interleavings show who goes first under each policy, then a
+ * steady stream of writers against readers reports p50/p99/p999 acquire
+ * latency per policy (and checks exclusion while doing so). */
+int usleep(unsigned int usec);
+
+static rwlock_t test_board;
+static int test_schedule = 0;
+
+static const char *policy_names[] = { "writer-pref", "reader-pref", "phase-fair" };
+
+/* ---- Fixed interleavings ---- */
+typedef struct {
+  int start_ms;     // Delay before requesting the lock
+  int hold_ms;
+  int seen;         // Readers: value read
+} actor_t;
+
+static void* timed_reader(void* arg) {
+  actor_t *a = arg;
+  usleep(a->start_ms * 1000);
+  rw_rlock(&test_board);
+  a->seen = test_schedule;
+  usleep(a->hold_ms * 1000);
+  rw_runlock(&test_board);
+  return NULL;
+}
+
+static void* timed_writer(void* arg) {
+  actor_t *a = arg;
+  usleep(a->start_ms * 1000);
+  rw_wlock(&test_board);
+  test_schedule++;
+  usleep(a->hold_ms * 1000);
+  rw_wunlock(&test_board);
+  return NULL;
+}
+
+/* Runs the actors (readers first) and returns what the last reader saw */
+static int interleave(rw_policy_t policy, actor_t *readers, int nr, actor_t *writers, int nw) {
+  pthread_t th[8];
+  test_schedule = 0;
+  rw_init_ex(&test_board, policy);
+  for (int i = 0; i < nr; i++) pthread_create(&th[i], NULL, timed_reader, &readers[i]);
+  for (int i = 0; i < nw; i++) pthread_create(&th[nr + i], NULL, timed_writer, &writers[i]);
+  for (int i = 0; i < nr + nw; i++) pthread_join(th[i], NULL);
+  rw_destroy(&test_board);
+  return readers[nr - 1].seen;
+}
+
+/* R1 holds the lock, W1 queues, R2 arrives: does R2 pass W1? */
+static int reader_behind_waiting_writer(rw_policy_t policy) {
+  actor_t r[2] = { { 0, 60, -1 }, { 20, 0, -1 } };
+  actor_t w[1] = { { 10, 0, -1 } };
+  return interleave(policy, r, 2, w, 1);
+}
+
+/* W1 holds the lock, R1 then W2 queue: who goes when W1 releases? */
+static int reader_vs_writer_after_writer(rw_policy_t policy) {
+  actor_t r[1] = { { 10, 0, -1 } };
+  actor_t w[2] = { { 0, 60, -1 }, { 20, 0, -1 } };
+  return interleave(policy, r, 1, w, 2);
+}
+
+/* ---- Latency under a steady stream of writers ---- */
+#define NUM_READERS 6
+#define NUM_WRITERS 2
+#define READS_PER_READER  400
+#define WRITES_PER_WRITER 200
+
+static uint64_t read_ns[NUM_READERS * READS_PER_READER];
+static uint64_t write_ns[NUM_WRITERS * WRITES_PER_WRITER];
+static atomic_int in_readers, in_writers, overlaps;
+
+static uint64_t ns_since(const struct timespec *t0) {
+  struct timespec t1;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  return (uint64_t)((t1.tv_sec - t0->tv_sec) * 1000000000LL + (t1.tv_nsec - t0->tv_nsec));
+}
+
+static void* stream_reader(void* arg) {
+  long id = (long)arg;
+  for (int i = 0; i < READS_PER_READER; i++) {
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    rw_rlock(&test_board);
+    read_ns[id * READS_PER_READER + i] = ns_since(&t0);
+    atomic_fetch_add(&in_readers, 1);
+    if (atomic_load(&in_writers)) atomic_fetch_add(&overlaps, 1);
+    usleep(50);
+    atomic_fetch_sub(&in_readers, 1);
+    rw_runlock(&test_board);
+    usleep(rng_below(100));
+  }
+  return NULL;
+}
+
+static void* stream_writer(void* arg) {
+  long id = (long)arg;
+  for (int i = 0; i < WRITES_PER_WRITER; i++) {
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    rw_wlock(&test_board);
+    write_ns[id * WRITES_PER_WRITER + i] = ns_since(&t0);
+    if (atomic_fetch_add(&in_writers, 1) || atomic_load(&in_readers)) atomic_fetch_add(&overlaps, 1);
+    test_schedule++;
+    usleep(200);
+    atomic_fetch_sub(&in_writers, 1);
+    rw_wunlock(&test_board);
+    usleep(100);
+  }
+  return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+/* Sorts the samples and reports p50/p99/p999 in microseconds */
+static void report(const char *who, uint64_t *ns, size_t n) {
+  qsort(ns, n, sizeof(*ns), cmp_u64);
+  const double q[3] = { 0.50, 0.99, 0.999 };
+  double pct[3];
+  for (int i = 0; i < 3; i++) pct[i] = ns[(size_t)(q[i] * (n - 1))] / 1000.0;
+  LOG("  %-6s p50 %9.1f us   p99 %9.1f us   p999 %9.1f us", who, pct[0], pct[1], pct[2]);
+}
+
+static void stream(rw_policy_t policy) {
+  pthread_t th[NUM_READERS + NUM_WRITERS];
+  test_schedule = 0;
+  atomic_store(&overlaps, 0);
+  rw_init_ex(&test_board, policy);
+  for (long i = 0; i < NUM_READERS; i++) pthread_create(&th[i], NULL, stream_reader, (void*)i);
+  for (long i = 0; i < NUM_WRITERS; i++) pthread_create(&th[NUM_READERS + i], NULL, stream_writer, (void*)i);
+  for (int i = 0; i < NUM_READERS + NUM_WRITERS; i++) pthread_join(th[i], NULL);
+  rw_destroy(&test_board);
+
+  LOG("%s acquire latency:", policy_names[policy]);
+  report("read", read_ns, NUM_READERS * READS_PER_READER);
+  report("write", write_ns, NUM_WRITERS * WRITES_PER_WRITER);
+  char what[120];
+  snprintf(what, sizeof(what), "[%s] exclusion held and all %d writes applied",
+           policy_names[policy], NUM_WRITERS * WRITES_PER_WRITER);
+  check(atomic_load(&overlaps) == 0 && test_schedule == NUM_WRITERS * WRITES_PER_WRITER, what);
+}
+
+int main() {
+  LOG("=== Test: rwlock_t fairness policies ===");
+  char what[160];
+
+  /* Writer priority and phase-fair hold R2 back for the queued writer;
+   * reader priority lets it join R1 */
+  const int expect_r2[] = { 1, 0, 1 };
+  for (int p = 0; p < 3; p++) {
+    int seen = reader_behind_waiting_writer(p);
+    snprintf(what, sizeof(what), "[%s] reader arriving behind a queued writer reads v%d",
+             policy_names[p], seen);
+    check(seen == expect_r2[p], what);
+  }
+
+  /* When a writer releases with a reader and a writer queued, only writer
+   * priority lets the second writer go first */
+  const int expect_r1[] = { 2, 1, 1 };
+  for (int p = 0; p < 3; p++) {
+    int seen = reader_vs_writer_after_writer(p);
+    snprintf(what, sizeof(what), "[%s] reader queued behind a writer reads v%d",
+             policy_names[p], seen);
+    check(seen == expect_r1[p], what);
+  }
+
+  rng_seed((uint64_t)time(NULL));
+  LOG("Seed %llu", (unsigned long long)rng_master());
+  LOG("%d readers (50 us reads), %d writers (200 us writes, 100 us apart)", NUM_READERS, NUM_WRITERS);
+  for (int p = 0; p < 3; p++) stream(p);
+
+  return test_finish("Fairness policy");
+}
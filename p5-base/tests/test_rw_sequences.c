@@ -1,7 +1,9 @@
+#define _POSIX_C_SOURCE 200809L
 #include "sync_utils.h"
 #include <assert.h>
 #include <stdio.h>
 #include <pthread.h>
+#include <time.h>
 
 /* Multiple reader-writer sequence tests with different orderings */
 int usleep(unsigned int usec);
@@ -10,6 +12,7 @@ int usleep(unsigned int usec);
 static rwlock_t test_board;
 static int test_schedule = 0;
 static int test_passed = 1;
+static const char *engine = "sem";
 
 // Thread action types
 typedef enum {
@@ -27,6 +30,12 @@ typedef struct {
 
 // Access internal rwlock_t fields for testing
 static int get_readers_count(rwlock_t *rw) {
+  if (rw->mode == RW_MODE_FUTEX) return atomic_load(&rw->word) & RW_READERS_MASK;
+  if (rw->mode == RW_MODE_PERCPU) {
+    int n = 0;
+    for (int i = 0; i < rw->nslots; i++) n += atomic_load(&rw->slots[i].readers);
+    return n;
+  }
   return rw->readers_active;
 }
 
@@ -127,7 +136,7 @@ static int run_sequence(const char *name, action_t *actions, int num_actions, in
   current_action = 0;
   pthread_mutex_unlock(&seq_mutex);
   
-  rw_init(&test_board);
+  rw_init_engine(&test_board, engine);
   
   pthread_t threads[num_actions];
   
@@ -160,9 +169,262 @@ static int run_sequence(const char *name, action_t *actions, int num_actions, in
   }
 }
 
-int main(void) {
+// Writer priority: R1 holds the lock, W1 queues behind it, then R2 arrives.
+// R2 must not join R1 but wait for W1, so it reads the updated value.
+static void* prio_reader(void* arg) {
+  int *value = arg;
+  rw_rlock(&test_board);
+  *value = test_schedule;
+  usleep(60000);
+  rw_runlock(&test_board);
+  return NULL;
+}
+
+static void* prio_writer(void* arg) {
+  (void)arg;
+  rw_wlock(&test_board);
+  test_schedule++;
+  check_writer_exclusive("W1 queued behind R1");
+  rw_wunlock(&test_board);
+  return NULL;
+}
+
+static int run_writer_priority(void) {
+  const char *name = "R1 holding, W1 waiting, R2 arrives";
+  LOG("\n=== Test: %s ===", name);
+  test_schedule = 0;
+  test_passed = 1;
+  rw_init_engine(&test_board, engine);
+  int r1 = -1, r2 = -1;
+  pthread_t tr1, tw1, tr2;
+  pthread_create(&tr1, NULL, prio_reader, &r1);
+  usleep(10000);
+  pthread_create(&tw1, NULL, prio_writer, NULL);
+  usleep(10000);
+  pthread_create(&tr2, NULL, prio_reader, &r2);
+  pthread_join(tr1, NULL);
+  pthread_join(tw1, NULL);
+  pthread_join(tr2, NULL);
+  rw_destroy(&test_board);
+  if (r1 != 0 || r2 != 1) {
+    LOG("FAIL [Writer priority]: R1 read %d (expected 0), R2 read %d (expected 1)", r1, r2);
+    test_passed = 0;
+  } else {
+    LOG("PASS [Writer priority]: R2 waited for the queued writer");
+  }
+  LOG("=== %s: %s ===\n", name, test_passed ? "PASSED" : "FAILED");
+  return test_passed ? 0 : 1;
+}
+
+static void check(int ok, const char *what) {
+  if (ok) {
+    LOG("PASS [%s]", what);
+  } else {
+    LOG("FAIL [%s]", what);
+    test_passed = 0;
+  }
+}
+
+static int ms_since(const struct timespec *t0) {
+  struct timespec t1;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  return (int)((t1.tv_sec - t0->tv_sec) * 1000 + (t1.tv_nsec - t0->tv_nsec) / 1000000);
+}
+
+static int begin_test(const char *name) {
+  LOG("\n=== Test: %s ===", name);
+  test_schedule = 0;
+  test_passed = 1;
+  return rw_init_engine(&test_board, engine);
+}
+
+static int end_test(const char *name) {
+  rw_destroy(&test_board);
+  LOG("=== %s: %s ===\n", name, test_passed ? "PASSED" : "FAILED");
+  return test_passed ? 0 : 1;
+}
+
+// Try acquires never block, so one thread can walk through every case
+static int run_try(void) {
+  const char *name = "rw_tryrlock / rw_trywlock";
+  begin_test(name);
+  rw_wlock(&test_board);
+  check(rw_tryrlock(&test_board) == -1 && rw_trywlock(&test_board) == -1,
+        "both fail while a writer holds the lock");
+  rw_wunlock(&test_board);
+  check(rw_tryrlock(&test_board) == 0, "tryrlock succeeds on a free lock");
+  check(rw_trywlock(&test_board) == -1, "trywlock fails while a reader holds the lock");
+  check(rw_tryrlock(&test_board) == 0, "a second tryrlock shares the read lock");
+  rw_runlock(&test_board);
+  rw_runlock(&test_board);
+  check(rw_trywlock(&test_board) == 0, "trywlock succeeds once the readers left");
+  check_writer_exclusive("trywlock");
+  rw_wunlock(&test_board);
+  return end_test(name);
+}
+
+// Holders for the timed and downgrade tests
+static atomic_int holder_in;
+
+static void* hold_write(void* arg) {
+  int ms = *(int*)arg;
+  rw_wlock(&test_board);
+  test_schedule++;
+  atomic_store(&holder_in, 1);
+  usleep(ms * 1000);
+  atomic_store(&holder_in, 0);
+  rw_wunlock(&test_board);
+  return NULL;
+}
+
+static void* hold_read(void* arg) {
+  int ms = *(int*)arg;
+  rw_rlock(&test_board);
+  atomic_store(&holder_in, 1);
+  usleep(ms * 1000);
+  atomic_store(&holder_in, 0);
+  rw_runlock(&test_board);
+  return NULL;
+}
+
+// Arrives 30 ms in (behind a queued writer) and notes whether the holder
+// was still inside when it got the read lock
+static void* late_reader(void* arg) {
+  int *shared = arg;
+  usleep(30000);
+  rw_rlock(&test_board);
+  *shared = atomic_load(&holder_in);
+  rw_runlock(&test_board);
+  return NULL;
+}
+
+static int run_timed(void) {
+  const char *name = "rw_rlock_timed / rw_wlock_timed";
+  begin_test(name);
+  struct timespec t0, dl;
+  pthread_t th, late;
+  int hold_ms = 150;
+
+  /* A writer holds the lock for 150 ms: 20 ms deadlines expire, a 2 s one
+   * is met once the writer leaves */
+  atomic_store(&holder_in, 0);
+  pthread_create(&th, NULL, hold_write, &hold_ms);
+  while (!atomic_load(&holder_in)) usleep(1000);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  dl = deadline_in_ms(20);
+  int rc = rw_rlock_timed(&test_board, &dl);
+  int waited = ms_since(&t0);
+  check(rc == -1 && waited >= 19 && waited < hold_ms, "rlock_timed gives up at its deadline");
+  dl = deadline_in_ms(20);
+  check(rw_wlock_timed(&test_board, &dl) == -1, "wlock_timed gives up at its deadline");
+  dl = deadline_in_ms(2000);
+  rc = rw_rlock_timed(&test_board, &dl);
+  check(rc == 0 && test_schedule == 1 && !atomic_load(&holder_in),
+        "rlock_timed succeeds once the writer released");
+  if (rc == 0) rw_runlock(&test_board);
+  pthread_join(th, NULL);
+
+  /* R1 holds the lock; a writer queues with a 60 ms deadline and R2 queues
+   * behind it. When the writer gives up, R2 must join R1 right away. */
+  int shared = 0;
+  pthread_create(&th, NULL, hold_read, &hold_ms);
+  while (!atomic_load(&holder_in)) usleep(1000);
+  pthread_create(&late, NULL, late_reader, &shared);
+  dl = deadline_in_ms(60);
+  check(rw_wlock_timed(&test_board, &dl) == -1, "wlock_timed gives up while a reader holds");
+  pthread_join(late, NULL);
+  check(shared, "reader queued behind the timed-out writer joined the holder");
+  pthread_join(th, NULL);
+  check(rw_trywlock(&test_board) == 0, "no trace of the withdrawn writer is left");
+  rw_wunlock(&test_board);
+  return end_test(name);
+}
+
+static void* queued_writer(void* arg) {
+  (void)arg;
+  rw_wlock(&test_board);
+  test_schedule = test_schedule * 10 + 2;
+  rw_wunlock(&test_board);
+  return NULL;
+}
+
+// W1 downgrades while W2 is queued: W2 must not get in between
+static int run_downgrade(void) {
+  const char *name = "rw_downgrade with a writer queued";
+  begin_test(name);
+  pthread_t w2;
+  rw_wlock(&test_board);
+  test_schedule = 1;
+  pthread_create(&w2, NULL, queued_writer, NULL);
+  usleep(20000);
+  rw_downgrade(&test_board);
+  usleep(20000);
+  check(test_schedule == 1 && get_readers_count(&test_board) == 1,
+        "still reading our own write after the downgrade");
+  check(rw_trywlock(&test_board) == -1, "the downgraded lock keeps writers out");
+  rw_runlock(&test_board);
+  pthread_join(w2, NULL);
+  check(test_schedule == 12, "queued writer ran after the read section");
+  return end_test(name);
+}
+
+// Upgradable read: shared with a plain reader, exclusive against a second
+// upgradable reader, and upgraded ahead of a writer that queued meanwhile
+static atomic_int u2_in;
+
+static void* second_upgrader(void* arg) {
+  (void)arg;
+  rw_ulock(&test_board);
+  atomic_store(&u2_in, 1);
+  rw_uunlock(&test_board);
+  return NULL;
+}
+
+static int run_upgrade(void) {
+  const char *name = "rw_ulock / rw_upgrade";
+  begin_test(name);
+  pthread_t pr, u2, w;
+  int hold_ms = 60;
+  atomic_store(&holder_in, 0);
+  atomic_store(&u2_in, 0);
+  rw_ulock(&test_board);
+  pthread_create(&pr, NULL, hold_read, &hold_ms);
+  pthread_create(&u2, NULL, second_upgrader, NULL);
+  usleep(10000);
+  pthread_create(&w, NULL, queued_writer, NULL);
+  usleep(10000);
+  check(atomic_load(&holder_in) && !atomic_load(&u2_in),
+        "plain reader shares the lock, second upgradable reader waits");
+  if (rw_upgrade(&test_board) == 0) {
+    check(!atomic_load(&holder_in), "upgrade waited for the plain reader to leave");
+    check_writer_exclusive("upgraded");
+    test_schedule = test_schedule * 10 + 1;
+    rw_wunlock(&test_board);
+    pthread_join(w, NULL);
+    check(test_schedule == 12, "upgrade went ahead of the queued writer");
+  } else {
+    check(test_board.mode == RW_MODE_PERCPU, "only the percpu engine refuses to upgrade");
+    rw_uunlock(&test_board);
+    pthread_join(w, NULL);
+  }
+  pthread_join(pr, NULL);
+  pthread_join(u2, NULL);
+  check(atomic_load(&u2_in), "second upgradable reader got in afterwards");
+  return end_test(name);
+}
+
+int main(int argc, char **argv) {
   int total_passed = 0;
   int total_tests = 0;
+
+  // Optional engine selection: ./test_rw_sequences [sem|reader-pref|phase-fair|percpu|futex]
+  if (argc > 1) engine = argv[1];
+  if (rw_init_engine(&test_board, engine)) {
+    fprintf(stderr, "usage: %s [sem|reader-pref|phase-fair|percpu|futex]\n", argv[0]);
+    return 2;
+  }
+  rw_destroy(&test_board);
+  LOG("Engine: %s", engine);
   
   // Test 1: Original sequence R1 -> W1 -> R2 -> W2 -> R3
   {
@@ -230,6 +492,20 @@ int main(void) {
     if (run_sequence("R1->W1->W2->W3->R2", sequence, 5, 3) == 0) total_passed++;
   }
   
+  // Test 6: Writer priority with overlapping requests
+  total_tests++;
+  if (run_writer_priority() == 0) total_passed++;
+
+  // Tests 7-10: try, timed, downgrade and upgradable acquires
+  total_tests++;
+  if (run_try() == 0) total_passed++;
+  total_tests++;
+  if (run_timed() == 0) total_passed++;
+  total_tests++;
+  if (run_downgrade() == 0) total_passed++;
+  total_tests++;
+  if (run_upgrade() == 0) total_passed++;
+  
   // Summary
   LOG("\n======================================");
   LOG("SUMMARY: %d/%d tests passed", total_passed, total_tests);
@@ -0,0 +1,186 @@
+#define _POSIX_C_SOURCE 200809L
+#include "sync_utils.h"
+#include <assert.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+
+/* rwlock_t contention statistics (built with -DRW_STATS).
+ * On each engine:
+ * - uncontended acquires are counted, never as contended, with no handoffs
+ * - failed try / timed acquires are counted as failed
+ * - readers queued behind a writer show up as contended, in max_queue, in
+ *   the wait time, and the writer's release counts as a handoff
+ * - a mixed stream reports p50/p99 wait and hold times per side */
+int usleep(unsigned int usec);
+
+static rwlock_t test_board;
+static int test_schedule = 0;
+static int test_passed = 1;
+
+#define NUM_QUEUED 3
+#define HOLD_MS    50
+
+static void check(int ok, const char *what) {
+  if (ok) {
+    LOG("PASS: %s", what);
+  } else {
+    LOG("FAIL: %s", what);
+    test_passed = 0;
+  }
+}
+
+static unsigned long hist_total(const unsigned long *hist) {
+  unsigned long n = 0;
+  for (int b = 0; b < RW_HIST_BUCKETS; b++) n += hist[b];
+  return n;
+}
+
+static void* queued_reader(void* arg) {
+  (void)arg;
+  rw_rlock(&test_board);
+  rw_runlock(&test_board);
+  return NULL;
+}
+
+/* ---- Mixed stream ---- */
+#define NUM_READERS 4
+#define NUM_WRITERS 2
+#define OPS_PER_THREAD 300
+
+static void* stream_reader(void* arg) {
+  (void)arg;
+  for (int i = 0; i < OPS_PER_THREAD; i++) {
+    rw_rlock(&test_board);
+    usleep(20);
+    rw_runlock(&test_board);
+  }
+  return NULL;
+}
+
+static void* stream_writer(void* arg) {
+  (void)arg;
+  for (int i = 0; i < OPS_PER_THREAD; i++) {
+    rw_wlock(&test_board);
+    test_schedule++;
+    usleep(50);
+    rw_wunlock(&test_board);
+    usleep(100);
+  }
+  return NULL;
+}
+
+/* Percentile in microseconds: the bucket's upper bound, capped at the max */
+static double pct_us(const unsigned long *hist, int pct, uint64_t max_ns) {
+  uint64_t ns = rw_hist_percentile(hist, pct);
+  return (ns < max_ns ? ns : max_ns) / 1000.0;
+}
+
+static void report(const char *who, const rw_side_stats_t *s) {
+  LOG("  %-5s %5lu acquires (%lu contended, %lu failed), max queue %d", who,
+      s->acquires, s->contended, s->failed, s->max_queue);
+  LOG("        wait p50 %8.1f us  p99 %8.1f us  max %8.1f us", pct_us(s->wait_hist, 50, s->wait_max_ns),
+      pct_us(s->wait_hist, 99, s->wait_max_ns), s->wait_max_ns / 1000.0);
+  LOG("        hold p50 %8.1f us  p99 %8.1f us  max %8.1f us", pct_us(s->hold_hist, 50, s->hold_max_ns),
+      pct_us(s->hold_hist, 99, s->hold_max_ns), s->hold_max_ns / 1000.0);
+}
+
+static void run_engine(const char *engine) {
+  char what[160];
+  rw_stats_t st;
+  LOG("\n=== Engine: %s ===", engine);
+  rw_init_engine(&test_board, engine);
+
+  /* Uncontended */
+  for (int i = 0; i < 10; i++) {
+    rw_rlock(&test_board);
+    rw_runlock(&test_board);
+  }
+  for (int i = 0; i < 5; i++) {
+    rw_wlock(&test_board);
+    rw_wunlock(&test_board);
+  }
+  rw_stats(&test_board, &st);
+  snprintf(what, sizeof(what), "[%s] 10 + 5 uncontended acquires, none contended, no handoffs", engine);
+  check(st.read.acquires == 10 && st.write.acquires == 5 && st.read.contended == 0 &&
+        st.write.contended == 0 && st.handoffs == 0 && st.read.max_queue == 0, what);
+  snprintf(what, sizeof(what), "[%s] every acquire has a wait and a hold sample", engine);
+  check(hist_total(st.read.wait_hist) == 10 && hist_total(st.read.hold_hist) == 10 &&
+        hist_total(st.write.wait_hist) == 5 && hist_total(st.write.hold_hist) == 5, what);
+
+  /* Failed try and timed acquires */
+  rw_stats_reset(&test_board);
+  rw_rlock(&test_board);
+  struct timespec dl = deadline_in_ms(10);
+  int try_rc = rw_trywlock(&test_board);
+  int timed_rc = rw_wlock_timed(&test_board, &dl);
+  rw_runlock(&test_board);
+  rw_stats(&test_board, &st);
+  snprintf(what, sizeof(what), "[%s] trywlock and wlock_timed under a reader count as failed", engine);
+  check(try_rc == -1 && timed_rc == -1 && st.write.failed == 2 && st.write.acquires == 0 &&
+        st.read.acquires == 1, what);
+
+  /* Readers queued behind a writer */
+  rw_stats_reset(&test_board);
+  pthread_t th[NUM_QUEUED];
+  rw_wlock(&test_board);
+  for (int i = 0; i < NUM_QUEUED; i++) pthread_create(&th[i], NULL, queued_reader, NULL);
+  usleep(HOLD_MS * 1000);
+  rw_wunlock(&test_board);
+  for (int i = 0; i < NUM_QUEUED; i++) pthread_join(th[i], NULL);
+  rw_stats(&test_board, &st);
+  snprintf(what, sizeof(what), "[%s] %d readers behind a writer: %lu contended, max queue %d",
+           engine, NUM_QUEUED, st.read.contended, st.read.max_queue);
+  check(st.read.contended == NUM_QUEUED && st.read.max_queue == NUM_QUEUED, what);
+  snprintf(what, sizeof(what), "[%s] wait max %.1f ms, writer hold max %.1f ms, %lu handoff(s)",
+           engine, st.read.wait_max_ns / 1e6, st.write.hold_max_ns / 1e6, st.handoffs);
+  check(st.read.wait_max_ns >= (HOLD_MS - 20) * 1000000ULL &&
+        st.write.hold_max_ns >= HOLD_MS * 1000000ULL && st.handoffs >= 1, what);
+
+  /* Mixed stream */
+  rw_stats_reset(&test_board);
+  test_schedule = 0;
+  pthread_t sth[NUM_READERS + NUM_WRITERS];
+  for (int i = 0; i < NUM_READERS; i++) pthread_create(&sth[i], NULL, stream_reader, NULL);
+  for (int i = 0; i < NUM_WRITERS; i++) pthread_create(&sth[NUM_READERS + i], NULL, stream_writer, NULL);
+  for (int i = 0; i < NUM_READERS + NUM_WRITERS; i++) pthread_join(sth[i], NULL);
+  rw_stats(&test_board, &st);
+  LOG("%d readers, %d writers, %d ops each: %lu handoffs", NUM_READERS, NUM_WRITERS,
+      OPS_PER_THREAD, st.handoffs);
+  report("read", &st.read);
+  report("write", &st.write);
+  snprintf(what, sizeof(what), "[%s] stream: every acquire counted once", engine);
+  check(st.read.acquires == NUM_READERS * OPS_PER_THREAD &&
+        st.write.acquires == NUM_WRITERS * OPS_PER_THREAD &&
+        hist_total(st.write.hold_hist) == st.write.acquires &&
+        test_schedule == NUM_WRITERS * OPS_PER_THREAD, what);
+
+  rw_stats_reset(&test_board);
+  rw_stats(&test_board, &st);
+  snprintf(what, sizeof(what), "[%s] rw_stats_reset clears the counters", engine);
+  check(st.read.acquires == 0 && st.write.acquires == 0 && st.handoffs == 0 &&
+        st.read.max_queue == 0 && hist_total(st.read.wait_hist) == 0, what);
+  rw_destroy(&test_board);
+}
+
+int main() {
+  LOG("=== Test: rwlock_t contention statistics ===");
+  rw_stats_t st;
+  rw_init(&test_board);
+  int rc = rw_stats(&test_board, &st);
+  rw_destroy(&test_board);
+  if (rc) {
+    LOG("FAIL: built without RW_STATS");
+    return 1;
+  }
+  const char *engines[] = { "sem", "percpu", "futex" };
+  for (int i = 0; i < 3; i++) run_engine(engines[i]);
+
+  LOG("");
+  if (test_passed) {
+    LOG("PASS: rw_stats test completed successfully");
+  } else {
+    LOG("FAIL: rw_stats test failed");
+  }
+  return test_passed ? 0 : 1;
+}
@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 /* Stress test for reader-writer locks - tests for race conditions */
@@ -14,6 +15,7 @@ static int shared_counter = 0;
 static int test_failed = 0;
 static int total_reads = 0;
 static int total_writes = 0;
+static atomic_ulong read_lock_ns;   // Time spent inside rw_rlock, all readers
 
 // Track violations
 static int race_condition_detected = 0;
@@ -32,9 +34,14 @@ static void* reader_thread(void* arg) {
   
   for (int i = 0; i < ITERATIONS_PER_THREAD; i++) {
     // Random delay before acquiring lock
-    usleep(rand() % MAX_SLEEP_US);
+    usleep(rng_below(MAX_SLEEP_US));
     
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
     rw_rlock(&test_board);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    atomic_fetch_add(&read_lock_ns,
+                     (t1.tv_sec - t0.tv_sec) * 1000000000L + (t1.tv_nsec - t0.tv_nsec));
     
     // NOTE: Removed direct access to test_board.readers to avoid TSan false positive
     // The lock implementation itself should ensure mutual exclusion
@@ -42,7 +49,7 @@ static void* reader_thread(void* arg) {
     
     // Read the counter multiple times - should be consistent
     int val1 = shared_counter;
-    usleep(rand() % 100); // Small delay
+    usleep(rng_below(100)); // Small delay
     int val2 = shared_counter;
     
     if (val1 != val2) {
@@ -55,7 +62,7 @@ static void* reader_thread(void* arg) {
     }
     
     // Hold the lock for a random time to increase contention
-    usleep(rand() % 1000);
+    usleep(rng_below(1000));
     
     rw_runlock(&test_board);
     
@@ -73,7 +80,7 @@ static void* writer_thread(void* arg) {
   
   for (int i = 0; i < ITERATIONS_PER_THREAD; i++) {
     // Random delay before acquiring lock
-    usleep(rand() % MAX_SLEEP_US);
+    usleep(rng_below(MAX_SLEEP_US));
     
     rw_wlock(&test_board);
     
@@ -83,7 +90,7 @@ static void* writer_thread(void* arg) {
     
     // Perform write operation
     int old_val = shared_counter;
-    usleep(rand() % 100); // Simulate work
+    usleep(rng_below(100)); // Simulate work
     shared_counter = old_val + 1;
     
     // Verify write took effect
@@ -97,7 +104,7 @@ static void* writer_thread(void* arg) {
     }
     
     // Hold the lock for a random time to increase contention
-    usleep(rand() % 1000);
+    usleep(rng_below(1000));
     
     rw_wunlock(&test_board);
     
@@ -109,19 +116,28 @@ static void* writer_thread(void* arg) {
   return NULL;
 }
 
-int main(void) {
+int main(int argc, char **argv) {
+  // Optional engine selection: ./test_rw_stress [sem|reader-pref|phase-fair|percpu|futex]
+  const char *engine = (argc > 1) ? argv[1] : "sem";
+  if (rw_init_engine(&test_board, engine)) {
+    fprintf(stderr, "usage: %s [sem|reader-pref|phase-fair|percpu|futex]\n", argv[0]);
+    return 2;
+  }
+
   LOG("=== Reader-Writer Stress Test ===");
   LOG("Configuration:");
+  LOG("  Engine: %s", engine);
   LOG("  Readers: %d (each performs %d reads)", NUM_READERS, ITERATIONS_PER_THREAD);
   LOG("  Writers: %d (each performs %d writes)", NUM_WRITERS, ITERATIONS_PER_THREAD);
   LOG("  Expected final counter value: %d", NUM_WRITERS * ITERATIONS_PER_THREAD);
   LOG("");
   
-  // Seed random number generator
-  srand(time(NULL));
+  // Seed the per-thread generators
+  rng_seed((uint64_t)time(NULL));
+  LOG("Seed %llu", (unsigned long long)rng_master());
   
-  // Initialize
-  rw_init(&test_board);
+  // Initialize (lock was set up during engine selection)
+  uint64_t start_ms = now_ms();
   shared_counter = 0;
   test_failed = 0;
   race_condition_detected = 0;
@@ -167,6 +183,9 @@ int main(void) {
   int expected_final = NUM_WRITERS * ITERATIONS_PER_THREAD;
   
   LOG("=== Results ===");
+  LOG("Elapsed: %llu ms", (unsigned long long)(now_ms() - start_ms));
+  LOG("Mean rw_rlock latency: %lu ns",
+      atomic_load(&read_lock_ns) / (NUM_READERS * ITERATIONS_PER_THREAD));
   LOG("Total reads completed: %d (expected %d)", total_reads, NUM_READERS * ITERATIONS_PER_THREAD);
   LOG("Total writes completed: %d (expected %d)", total_writes, expected_final);
   LOG("Final counter value: %d (expected %d)", shared_counter, expected_final);
@@ -3,6 +3,7 @@
 #include <stdio.h>
 
 extern int schedule_run(void);
+extern int schedule_run_engine(const char *engine);
 extern int get_final_schedule_version(void); // Needs to be exposed for testing
 extern int get_violation_count(void); // New: to access catch of bad overlaps
 
@@ -11,9 +12,10 @@ static int pass(const char* name, int rc) {
   return rc;
 }
 
-int main(void) {
+/* Usage: test_scenario [schedule-engine]  (any rw_init_engine name, seqlock, rcu, combine) */
+int main(int argc, char **argv) {
   int ok = 1;
-  int rc = schedule_run();
+  int rc = (argc > 1) ? schedule_run_engine(argv[1]) : schedule_run();
   ok &= (pass("schedule (readers-writers run completes)", rc) == 0);
   int expected_version = 2 * 3; // 2 writers * 3 updates per writer
   int actual_version = get_final_schedule_version();
@@ -0,0 +1,210 @@
+#define _POSIX_C_SOURCE 200809L
+#include "sync_utils.h"
+#include <assert.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+/* Binary event tracing (built with -DSYNC_TRACE):
+ * - a known single-thread sequence of bb_t and rwlock_t operations is
+ *   recorded one record each, in order, with tray ids and counts
+ * - a contended rw_wlock records how long it waited
+ * - several threads fill more than one chunk each: every record is there,
+ *   each thread's in time order, locks and unlocks balanced
+ * - trace_decode prints one line per record, and a Chrome timeline with a
+ *   begin and an end per hold; nothing is recorded after trace_stop */
+int usleep(unsigned int usec);
+
+static bb_t test_queue;
+static rwlock_t test_board;
+static int test_passed = 1;
+
+#define TRACE_PATH "/tmp/test_trace.trc"
+#define NUM_THREADS 4
+#define OPS_PER_THREAD 3000      // 2 records each: more than a chunk per thread
+#define HOLD_MS 20
+
+static void check(int ok, const char *what) {
+  if (ok) {
+    LOG("PASS: %s", what);
+  } else {
+    LOG("FAIL: %s", what);
+    test_passed = 0;
+  }
+}
+
+/* Reads the records back in file order (chunk by chunk) */
+static trace_record_t* read_trace(int *n) {
+  FILE *f = fopen(TRACE_PATH, "rb");
+  if (!f) return NULL;
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  int cap = (size - TRACE_CHUNK_BYTES) / sizeof(trace_record_t);
+  trace_record_t *recs = malloc(cap * sizeof(trace_record_t));
+  fseek(f, TRACE_CHUNK_BYTES, SEEK_SET);
+  *n = 0;
+  for (int i = 0; i < cap && fread(&recs[*n], sizeof(trace_record_t), 1, f) == 1; i++) {
+    if (recs[*n].event != TR_NONE) (*n)++;
+  }
+  fclose(f);
+  return recs;
+}
+
+/* Lines of trace_decode's output containing needle */
+static int decode_count(bool chrome, const char *needle, int *lines) {
+  char line[512];
+  int found = 0;
+  FILE *out = tmpfile();
+  if (trace_decode(TRACE_PATH, out, chrome)) return -1;
+  rewind(out);
+  *lines = 0;
+  while (fgets(line, sizeof(line), out)) {
+    (*lines)++;
+    for (char *p = line; (p = strstr(p, needle)) != NULL; p++) found++;
+  }
+  fclose(out);
+  return found;
+}
+
+/* ---- Known sequence ---- */
+static void* holder(void* arg) {
+  (void)arg;
+  rw_wlock(&test_board);
+  usleep(HOLD_MS * 1000);
+  rw_wunlock(&test_board);
+  return NULL;
+}
+
+static void sequence(void) {
+  char what[160];
+  food_tray_t *trays[3], *got[3];
+  pthread_t h;
+  bb_init(&test_queue, 8);
+  rw_init(&test_board);
+  check(trace_start(TRACE_PATH) == 0 && trace_start(TRACE_PATH) == -1,
+        "trace_start creates the file, a second start fails");
+
+  for (int i = 0; i < 3; i++) bb_put(&test_queue, create_food_tray(i + 1, "Soup", 0));
+  for (int i = 0; i < 3; i++) free_food_tray(bb_take(&test_queue));
+  for (int i = 0; i < 2; i++) trays[i] = create_food_tray(10 + i, "Tea", 0);
+  bb_put_many(&test_queue, trays, 2);
+  int taken = bb_take_many(&test_queue, got, 3);
+  for (int i = 0; i < taken; i++) free_food_tray(got[i]);
+  rw_rlock(&test_board);
+  rw_runlock(&test_board);
+  rw_trywlock(&test_board);
+  rw_downgrade(&test_board);
+  rw_runlock(&test_board);
+
+  pthread_create(&h, NULL, holder, NULL);
+  usleep(HOLD_MS * 1000 / 4);
+  rw_wlock(&test_board);       // Waits for the holder
+  rw_wunlock(&test_board);
+  pthread_join(h, NULL);
+  trace_stop();
+  rw_rlock(&test_board);       // Not recorded any more
+  rw_runlock(&test_board);
+
+  int n;
+  trace_record_t *r = read_trace(&n);
+  static const int expect[] = {
+    TR_BB_PUT, TR_BB_PUT, TR_BB_PUT, TR_BB_TAKE, TR_BB_TAKE, TR_BB_TAKE,
+    TR_BB_PUT_MANY, TR_BB_TAKE_MANY, TR_RW_RLOCK, TR_RW_RUNLOCK,
+    TR_RW_WLOCK, TR_RW_WUNLOCK, TR_RW_RLOCK, TR_RW_RUNLOCK,
+  };
+  int nexpect = sizeof(expect) / sizeof(expect[0]), same = r != NULL && n >= nexpect;
+  for (int i = 0; same && i < nexpect; i++) same = r[i].event == expect[i] && r[i].tid == r[0].tid;
+  check(same, "single-thread sequence recorded one record per operation, in order");
+  check(same && r[0].arg == 1 && r[2].arg == 3 && r[3].arg == 1 && r[6].arg == 2 && r[7].arg == 2 &&
+        r[0].obj == (uintptr_t)&test_queue && r[8].obj == (uintptr_t)&test_board,
+        "tray ids, counts and objects recorded");
+
+  /* Holder: wlock, wunlock; main: wlock (waited), wunlock, in time order */
+  uint64_t waited = 0;
+  int writes = 0;
+  for (int i = nexpect; r && i < n; i++) {
+    if (r[i].event == TR_RW_WLOCK && r[i].tid == r[0].tid) waited = r[i].wait_ns;
+    writes += r[i].event == TR_RW_WLOCK || r[i].event == TR_RW_WUNLOCK;
+  }
+  snprintf(what, sizeof(what), "contended rw_wlock waited %.1f ms behind a %d ms hold", waited / 1e6, HOLD_MS);
+  check(n == nexpect + 4 && writes == 4 && waited >= (HOLD_MS / 2) * 1000000ULL, what);
+  free(r);
+  rw_destroy(&test_board);
+  bb_destroy(&test_queue);
+}
+
+/* ---- Several threads, several chunks each ---- */
+static void* worker(void* arg) {
+  (void)arg;
+  for (int i = 0; i < OPS_PER_THREAD; i++) {
+    if (i % 4 == 0) {
+      rw_wlock(&test_board);
+      rw_wunlock(&test_board);
+    } else {
+      rw_rlock(&test_board);
+      rw_runlock(&test_board);
+    }
+  }
+  return NULL;
+}
+
+static void threads(void) {
+  char what[160];
+  pthread_t th[NUM_THREADS];
+  rw_init_engine(&test_board, "futex");
+  trace_start(TRACE_PATH);
+  for (int i = 0; i < NUM_THREADS; i++) pthread_create(&th[i], NULL, worker, NULL);
+  for (int i = 0; i < NUM_THREADS; i++) pthread_join(th[i], NULL);
+  trace_stop();
+  rw_destroy(&test_board);
+
+  int n, tids = 0, out_of_order = 0, unbalanced = 0;
+  struct { uint32_t tid; uint64_t last; int depth; } seen[NUM_THREADS + 1] = { 0 };
+  trace_record_t *r = read_trace(&n);
+  for (int i = 0; r && i < n; i++) {
+    int t = 0;
+    while (t < tids && seen[t].tid != r[i].tid) t++;
+    if (t == tids) {
+      if (tids == NUM_THREADS) break;
+      seen[tids++].tid = r[i].tid;
+    }
+    if (r[i].ns < seen[t].last) out_of_order++;
+    seen[t].last = r[i].ns;
+    seen[t].depth += r[i].event == TR_RW_RLOCK || r[i].event == TR_RW_WLOCK ? 1 : -1;
+    if (seen[t].depth < 0 || seen[t].depth > 1) unbalanced++;
+  }
+  free(r);
+  snprintf(what, sizeof(what), "%d threads x %d lock/unlock pairs: %d records from %d threads",
+           NUM_THREADS, OPS_PER_THREAD, n, tids);
+  check(n == NUM_THREADS * OPS_PER_THREAD * 2 && tids == NUM_THREADS, what);
+  check(out_of_order == 0 && unbalanced == 0, "each thread's records in time order, locks and unlocks paired");
+
+  int lines, lock_lines = decode_count(false, "rw_wlock", &lines);
+  snprintf(what, sizeof(what), "trace_decode: %d lines, %d rw_wlock", lines, lock_lines);
+  check(lines == n && lock_lines == NUM_THREADS * OPS_PER_THREAD / 4, what);
+  int ends, begins = decode_count(true, "\"ph\":\"B\"", &lines);
+  ends = decode_count(true, "\"ph\":\"E\"", &lines);
+  check(begins == NUM_THREADS * OPS_PER_THREAD && ends == begins &&
+        decode_count(true, "{\"traceEvents\":[", &lines) == 1,
+        "Chrome timeline: one begin and one end per hold");
+}
+
+int main() {
+  LOG("=== Test: binary event tracing ===");
+  sequence();
+  threads();
+  FILE *f = fopen(TRACE_PATH, "w");
+  fputs("not a trace\n", f);
+  fclose(f);
+  check(trace_decode(TRACE_PATH, stdout, false) == -1, "trace_decode rejects a file that isn't a trace");
+  remove(TRACE_PATH);
+
+  LOG("");
+  if (test_passed) {
+    LOG("PASS: Trace test completed successfully");
+  } else {
+    LOG("FAIL: Trace test failed");
+  }
+  return test_passed ? 0 : 1;
+}
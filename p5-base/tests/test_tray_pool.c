@@ -0,0 +1,94 @@
+#define _POSIX_C_SOURCE 200809L
+#include "sync_utils.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+/* Tray pool and food name interning.
+ * Cooks allocate and attendees free, as in the snacks module, so every tray
+ * crosses threads. Once the magazines are warm no further trays should come
+ * from malloc, however many trays go through the buffer. */
+
+static bb_t test_queue;
+static int test_passed = 1;
+
+#define NUM_COOKS      2
+#define NUM_ATTENDEES  2
+#define ITEMS_PER_COOK 100000
+#define CAPACITY       8
+
+static const char* food_names[] = {
+  "Pizza Slice", "Sandwich", "Salad Bowl", "Fruit Plate",
+  "Pasta Bowl", "Burger", "Wrap", "Sushi Roll"
+};
+
+static void* cook(void* arg) {
+  long id = (long)arg;
+  for (int i = 0; i < ITEMS_PER_COOK; i++)
+    bb_put(&test_queue, create_food_tray(i, food_names[i % 8], (int)id));
+  return NULL;
+}
+
+static void* attendee(void* arg) {
+  (void)arg;
+  for (int i = 0; i < NUM_COOKS * ITEMS_PER_COOK / NUM_ATTENDEES; i++) {
+    food_tray_t *tray = bb_take(&test_queue);
+    if (tray->food_name != intern_food_name(food_names[tray->tray_id % 8])) test_passed = 0;
+    free_food_tray(tray);
+  }
+  return NULL;
+}
+
+static double elapsed_ms(struct timespec a, struct timespec b) {
+  return (b.tv_sec - a.tv_sec) * 1e3 + (b.tv_nsec - a.tv_nsec) / 1e6;
+}
+
+int main() {
+  LOG("=== Test: Tray pool and interned food names ===");
+
+  /* Interning: equal names share one pointer, no copy per tray */
+  char buf[32];
+  strcpy(buf, "Burger");
+  food_tray_t *a = create_food_tray(1, "Burger", 0);
+  food_tray_t *b = create_food_tray(2, buf, 0);
+  if (a->food_name != b->food_name || strcmp(a->food_name, "Burger") != 0) {
+    LOG("FAIL: equal food names were not interned to one pointer");
+    test_passed = 0;
+  }
+  free_food_tray(a);
+  free_food_tray(b);
+
+  /* Cross-thread alloc/free through the bounded buffer */
+  if (bb_init(&test_queue, CAPACITY) != 0) {
+    LOG("FAIL: Buffer initialization failed");
+    return 1;
+  }
+  struct timespec t0, t1;
+  pthread_t cooks[NUM_COOKS], attendees[NUM_ATTENDEES];
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (long i = 0; i < NUM_COOKS; i++) pthread_create(&cooks[i], NULL, cook, (void*)i);
+  for (long i = 0; i < NUM_ATTENDEES; i++) pthread_create(&attendees[i], NULL, attendee, (void*)i);
+  for (int i = 0; i < NUM_COOKS; i++) pthread_join(cooks[i], NULL);
+  for (int i = 0; i < NUM_ATTENDEES; i++) pthread_join(attendees[i], NULL);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  bb_destroy(&test_queue);
+
+  /* Upper bound: two magazines per thread plus what fits in the buffer */
+  unsigned long allocated = tray_pool_allocated();
+  unsigned long bound = (NUM_COOKS + NUM_ATTENDEES + 1) * 2 * TRAY_MAG_SIZE + CAPACITY;
+  LOG("%d trays in %.1f ms, %lu obtained from malloc (bound %lu)",
+      NUM_COOKS * ITEMS_PER_COOK, elapsed_ms(t0, t1), allocated, bound);
+  if (allocated > bound) {
+    LOG("FAIL: tray pool did not recycle trays across threads");
+    test_passed = 0;
+  }
+
+  if (test_passed) {
+    LOG("PASS: Tray pool test completed successfully");
+  } else {
+    LOG("FAIL: Tray pool test failed");
+  }
+  return test_passed ? 0 : 1;
+}